@@ -25,7 +25,8 @@
 # define  GB_REPLACE_HELP_STR "gluster-block replace <volname/blockname> "     \
                                 "<old-node> <new-node> [force] [--json*]"
 # define  GB_INFO_HELP_STR    "gluster-block info <volname/blockname> [--json*]"
-# define  GB_LIST_HELP_STR    "gluster-block list <volname> [--json*]"
+# define  GB_LIST_HELP_STR    "gluster-block list <volname> [offset <cookie>] "\
+                                "[limit <count>] [--json*]"
 
 
 # define  GB_ARGCHECK_OR_RETURN(argcount, count, cmd, helpstr)        \
@@ -37,6 +38,7 @@
           } while(0)
 
 # define  GB_DEFAULT_SECTOR_SIZE  512
+# define  GB_LIST_PAGE            1024  /* blocks per reply, listing all */
 
 extern const char *argp_program_version;
 
@@ -140,6 +142,8 @@ glusterBlockCliRPC_1(void *cobj, clioperations opt)
           clnt_sperror(clnt, "block_list_cli_1"), list_obj->volume);
       goto out;
     }
+    /* where the next page starts, 0 once done */
+    list_obj->offset = reply.offset;
     break;
   case MODIFY_CLI:
     modify_obj = cobj;
@@ -206,8 +210,9 @@ glusterBlockHelp(void)
       "                              <host1[,host2,...]> <size>\n"
       "        create block device [defaults: ha 1, auth disable, prealloc no, size in bytes]\n"
       "\n"
-      "  list    <volname>\n"
-      "        list available block devices.\n"
+      "  list    <volname> [offset <cookie>] [limit <count>]\n"
+      "        list available block devices, <count> at most, starting at\n"
+      "        <cookie> from the previous page.\n"
       "\n"
       "  info    <volname/blockname>\n"
       "        details about block device.\n"
@@ -484,18 +489,65 @@ static int
 glusterBlockList(int argcount, char **options, int json)
 {
   blockListCli cobj = {0};
+  unsigned long long offset = 0;
+  unsigned int limit = 0;
+  size_t optind = 3;
+  bool all = false;
   int ret = -1;
 
 
-  GB_ARGCHECK_OR_RETURN(argcount, 3, "list", GB_LIST_HELP_STR);
+  if (argcount < 3 || argcount > 7) {
+    MSG("Inadequate arguments for list:\n%s\n", GB_LIST_HELP_STR);
+    return -1;
+  }
   cobj.json_resp = json;
 
   GB_STRCPYSTATIC(cobj.volume, options[2]);
 
-  ret = glusterBlockCliRPC_1(&cobj, LIST_CLI);
+  if ((argcount - optind) && !strcmp(options[optind], "offset")) {
+    optind++;
+    if (!(argcount - optind) ||
+        sscanf(options[optind++], "%llu", &offset) != 1) {
+      MSG("%s\n", "'offset' option is incorrect");
+      MSG("%s\n", GB_LIST_HELP_STR);
+      return -1;
+    }
+  }
+
+  if ((argcount - optind) && !strcmp(options[optind], "limit")) {
+    optind++;
+    if (!(argcount - optind) ||
+        sscanf(options[optind++], "%u", &limit) != 1 || !limit) {
+      MSG("%s\n", "'limit' option is incorrect");
+      MSG("%s\n", GB_LIST_HELP_STR);
+      return -1;
+    }
+  }
+
+  if (argcount - optind) {
+    MSG("Unknown option: '%s'\n%s\n", options[optind], GB_LIST_HELP_STR);
+    return -1;
+  }
+
+  cobj.offset = offset;
+  cobj.limit = limit;
+
+  /* plain listings of all come in pages, each printed as it arrives;
+   * a json reply has to be one document */
+  if (!limit && !json) {
+    cobj.limit = GB_LIST_PAGE;
+    all = true;
+  }
+
+  do {
+    ret = glusterBlockCliRPC_1(&cobj, LIST_CLI);
+  } while (!ret && all && cobj.offset);
+
   if (ret) {
     LOG("cli", GB_LOG_ERROR, "failed listing blocks from volume %s",
         cobj.volume);
+  } else if (!all && !json && cobj.offset) {
+    MSG("next offset: %llu\n", (unsigned long long)cobj.offset);
   }
 
   return ret;
@@ -19,18 +19,27 @@
 # include  "config.h"
 # include  "common.h"
 # include  "lru.h"
+# include  "workers.h"
 # include  "block.h"
 # include  "block_svc.h"
+# include  "lio-operations.h"
+# include  "glfs-operations.h"
+# include  "tgcli-pool.h"
+# include  "runner.h"
 
-# define   GB_TGCLI_GLOBALS     "targetcli set "                               \
-                                "global auto_add_default_portal=false "        \
-                                "auto_enable_tpgt=false loglevel_file=info "   \
-                                "logfile=%s && targetcli / saveconfig"
+# define   GB_TGCLI_LOGFILE     "logfile=%s"
+# define   GB_PREWARM_ALL       "all"
 
 
 extern size_t glfsLruCount;
+extern size_t glfsLruIdleTimeout;
+extern size_t glfsLruMemory;
+extern size_t gbRpcWorkerCount;
+extern size_t gbVolumeWorkerCount;
 extern const char *argp_program_version;
 
+static const char *gbPrewarmVolumes;
+
 
 static void
 glusterBlockDHelp(void)
@@ -39,10 +48,37 @@ glusterBlockDHelp(void)
       "gluster-blockd ("PACKAGE_VERSION")\n"
       "usage:\n"
       "  gluster-blockd [--glfs-lru-count <COUNT>] [--log-level <LOGLEVEL>]\n"
+      "                 [--glfs-lru-idle-timeout <SECONDS>] [--glfs-lru-memory <MiB>]\n"
+      "                 [--rpc-workers <COUNT>] [--volume-workers <COUNT>]\n"
+      "                 [--backend <targetcli|configfs>] [--targetcli-procs <COUNT>]\n"
+      "                 [--meta-layout <flat|hashed>]\n"
+      "                 [--prewarm-volumes <VOLNAME[,VOLNAME...]|all>]\n"
       "\n"
       "commands:\n"
       "  --glfs-lru-count <COUNT>\n"
       "        glfs objects cache capacity [max: 512] [default: 5]\n"
+      "  --glfs-lru-idle-timeout <SECONDS>\n"
+      "        release glfs objects unused that long, 0 never [max: 604800] [default: 0]\n"
+      "  --glfs-lru-memory <MiB>\n"
+      "        estimated memory the cached glfs objects may take, 0 unbounded\n"
+      "        [max: 1048576] [default: 0]\n"
+      "  --rpc-workers <COUNT>\n"
+      "        threads serving cli and peer requests, each [max: 64] [default: 8]\n"
+      "  --volume-workers <COUNT>\n"
+      "        cli requests served at once per volume, on different blocks or\n"
+      "        only reading [max: 64] [default: 4]\n"
+      "  --backend <targetcli|configfs>\n"
+      "        how LIO is configured, configfs is new and falls back to\n"
+      "        targetcli when configfs is not mounted [default: targetcli]\n"
+      "  --targetcli-procs <COUNT>\n"
+      "        targetcli processes kept running to serve requests [max: 8] [default: 1]\n"
+      "  --meta-layout <flat|hashed>\n"
+      "        hashed moves the metadata files of flat volumes into subdirectories\n"
+      "        on first use, online; older daemons can't read a moved volume, so\n"
+      "        upgrade all nodes first [default: flat]\n"
+      "  --prewarm-volumes <VOLNAME[,VOLNAME...]|all>\n"
+      "        volumes to initialize in the background at start, all for those\n"
+      "        backing the blocks configured on this node, up to glfs-lru-count\n"
       "  --log-level <LOGLEVEL>\n"
       "        Logging severity. Valid options are,\n"
       "        TRACE, DEBUG, INFO, WARNING, ERROR and NONE [default: INFO]\n"
@@ -55,8 +91,8 @@ glusterBlockDHelp(void)
 }
 
 
-void *
-glusterBlockCliThreadProc (void *vargp)
+static int
+glusterBlockCliSvcCreate(void)
 {
   register SVCXPRT *transp = NULL;
   struct sockaddr_un saun = {0, };
@@ -101,14 +137,14 @@ glusterBlockCliThreadProc (void *vargp)
   }
 
   if (!svc_register(transp, GLUSTER_BLOCK_CLI, GLUSTER_BLOCK_CLI_VERS,
-                    gluster_block_cli_1, IPPROTO_IP)) {
+                    gluster_block_cli_1_mt, IPPROTO_IP)) {
 		LOG("mgmt", GB_LOG_ERROR,
         "unable to register (GLUSTER_BLOCK_CLI, GLUSTER_BLOCK_CLI_VERS: %s)",
         strerror (errno));
     goto out;
 	}
 
-  svc_run ();
+  return 0;
 
  out:
   if (transp) {
@@ -119,12 +155,12 @@ glusterBlockCliThreadProc (void *vargp)
     close(sockfd);
   }
 
-  return NULL;
+  return -1;
 }
 
 
-void *
-glusterBlockServerThreadProc(void *vargp)
+static void
+glusterBlockServerSvcCreate(void)
 {
   register SVCXPRT *transp = NULL;
   struct sockaddr_in sain = {0, };
@@ -163,13 +199,13 @@ glusterBlockServerThreadProc(void *vargp)
   }
 
   if (!svc_register(transp, GLUSTER_BLOCK, GLUSTER_BLOCK_VERS,
-                    gluster_block_1, IPPROTO_TCP)) {
+                    gluster_block_1_mt, IPPROTO_TCP)) {
     snprintf (errMsg, sizeof (errMsg), "%s", "Please check if rpcbind "
               "service is running.");
     goto out;
   }
 
-  svc_run ();
+  return;
 
  out:
   if (transp) {
@@ -185,7 +221,6 @@ glusterBlockServerThreadProc(void *vargp)
     MSG("%s\n", errMsg);
     exit(EXIT_FAILURE);
   }
-  return NULL;
 }
 
 
@@ -242,6 +277,140 @@ glusterBlockDParseArgs(int count, char **options)
       }
       break;
 
+    case GB_DAEMON_GLFS_LRU_IDLE:
+      if (count - optind  < 1) {
+        MSG("option '%s' needs argument <SECONDS>\n", options[optind-1]);
+        return -1;
+      }
+      if (sscanf(options[optind], "%zu", &glfsLruIdleTimeout) != 1) {
+        MSG("option '%s' expect argument type integer <SECONDS>\n",
+            options[optind-1]);
+        return -1;
+      }
+      if (glfsLruIdleTimeout > LRU_IDLE_TIMEOUT_MAX) {
+        MSG("glfs-lru-idle-timeout argument should be [0 <= SECONDS <= %d]\n",
+            LRU_IDLE_TIMEOUT_MAX);
+        LOG("mgmt", GB_LOG_ERROR,
+            "glfs-lru-idle-timeout argument should be [0 <= SECONDS <= %d]\n",
+            LRU_IDLE_TIMEOUT_MAX);
+        return -1;
+      }
+      break;
+
+    case GB_DAEMON_GLFS_LRU_MEM:
+      if (count - optind  < 1) {
+        MSG("option '%s' needs argument <MiB>\n", options[optind-1]);
+        return -1;
+      }
+      if (sscanf(options[optind], "%zu", &glfsLruMemory) != 1) {
+        MSG("option '%s' expect argument type integer <MiB>\n",
+            options[optind-1]);
+        return -1;
+      }
+      if (glfsLruMemory > LRU_MEMORY_MAX) {
+        MSG("glfs-lru-memory argument should be [0 <= MiB <= %d]\n",
+            LRU_MEMORY_MAX);
+        LOG("mgmt", GB_LOG_ERROR,
+            "glfs-lru-memory argument should be [0 <= MiB <= %d]\n",
+            LRU_MEMORY_MAX);
+        return -1;
+      }
+      break;
+
+    case GB_DAEMON_RPC_WORKERS:
+      if (count - optind  < 1) {
+        MSG("option '%s' needs argument <COUNT>\n", options[optind-1]);
+        return -1;
+      }
+      if (sscanf(options[optind], "%zu", &gbRpcWorkerCount) != 1) {
+        MSG("option '%s' expect argument type integer <COUNT>\n",
+            options[optind-1]);
+        return -1;
+      }
+      if (!gbRpcWorkerCount || (gbRpcWorkerCount > GB_WORKERS_MAX)) {
+        MSG("rpc-workers argument should be [0 < COUNT <= %d]\n",
+            GB_WORKERS_MAX);
+        LOG("mgmt", GB_LOG_ERROR,
+            "rpc-workers argument should be [0 < COUNT <= %d]\n",
+            GB_WORKERS_MAX);
+        return -1;
+      }
+      break;
+
+    case GB_DAEMON_VOLUME_WORKERS:
+      if (count - optind  < 1) {
+        MSG("option '%s' needs argument <COUNT>\n", options[optind-1]);
+        return -1;
+      }
+      if (sscanf(options[optind], "%zu", &gbVolumeWorkerCount) != 1) {
+        MSG("option '%s' expect argument type integer <COUNT>\n",
+            options[optind-1]);
+        return -1;
+      }
+      if (!gbVolumeWorkerCount || (gbVolumeWorkerCount > GB_WORKERS_MAX)) {
+        MSG("volume-workers argument should be [0 < COUNT <= %d]\n",
+            GB_WORKERS_MAX);
+        LOG("mgmt", GB_LOG_ERROR,
+            "volume-workers argument should be [0 < COUNT <= %d]\n",
+            GB_WORKERS_MAX);
+        return -1;
+      }
+      break;
+
+    case GB_DAEMON_BACKEND:
+      if (count - optind  < 1) {
+        MSG("option '%s' needs argument <BACKEND>\n", options[optind-1]);
+        return -1;
+      }
+      gbLioBackendType = gbLioBackendEnumParse(options[optind]);
+      if (gbLioBackendType >= GB_LIO_BACKEND_MAX) {
+        MSG("unknown BACKEND: '%s'\n", options[optind]);
+        return -1;
+      }
+      break;
+
+    case GB_DAEMON_TGCLI_PROCS:
+      if (count - optind  < 1) {
+        MSG("option '%s' needs argument <COUNT>\n", options[optind-1]);
+        return -1;
+      }
+      if (sscanf(options[optind], "%zu", &gbTgcliProcCount) != 1) {
+        MSG("option '%s' expect argument type integer <COUNT>\n",
+            options[optind-1]);
+        return -1;
+      }
+      if (!gbTgcliProcCount || (gbTgcliProcCount > GB_TGCLI_PROCS_MAX)) {
+        MSG("targetcli-procs argument should be [0 < COUNT <= %d]\n",
+            GB_TGCLI_PROCS_MAX);
+        LOG("mgmt", GB_LOG_ERROR,
+            "targetcli-procs argument should be [0 < COUNT <= %d]\n",
+            GB_TGCLI_PROCS_MAX);
+        return -1;
+      }
+      break;
+
+    case GB_DAEMON_META_LAYOUT:
+      if (count - optind  < 1) {
+        MSG("option '%s' needs argument <LAYOUT>\n", options[optind-1]);
+        return -1;
+      }
+      gbMetaLayoutType = gbMetaLayoutEnumParse(options[optind]);
+      if (gbMetaLayoutType != GB_META_LAYOUT_FLAT &&
+          gbMetaLayoutType != GB_META_LAYOUT_HASHED) {
+        MSG("unknown LAYOUT: '%s'\n", options[optind]);
+        return -1;
+      }
+      break;
+
+    case GB_DAEMON_PREWARM:
+      if (count - optind  < 1) {
+        MSG("option '%s' needs argument <VOLNAME[,VOLNAME...]|all>\n",
+            options[optind-1]);
+        return -1;
+      }
+      gbPrewarmVolumes = options[optind];
+      break;
+
     case GB_DAEMON_LOG_LEVEL:
       if (count - optind  < 1) {
         MSG("option '%s' needs argument <LOG-LEVEL>\n", options[optind-1]);
@@ -261,39 +430,130 @@ glusterBlockDParseArgs(int count, char **options)
   return 0;
 }
 
+/* Starts initializing the volumes listed, as many as the glfs cache
+ * holds, so the first requests after a restart don't pay for it */
+static void
+glusterBlockDPrewarm(const char *list)
+{
+  char **volumes = NULL;
+  size_t count = 0;
+  size_t started = 0;
+  char *dup = NULL;
+  char *vol;
+  char *sptr = NULL;
+  size_t i;
+
+
+  if (!list || !*list) {
+    return;
+  }
+
+  if (!strcmp(list, GB_PREWARM_ALL)) {
+    if (glusterBlockLioIndexVolumes(&volumes, &count)) {
+      LOG("mgmt", GB_LOG_WARNING, "%s",
+          "listing the volumes of configured blocks failed, not prewarming");
+      return;
+    }
+    if (!count) {
+      LOG("mgmt", GB_LOG_INFO, "%s", "no configured blocks, not prewarming");
+    }
+  } else {
+    if (GB_STRDUP(dup, list) < 0) {
+      return;
+    }
+    for (vol = strtok_r(dup, ",", &sptr); vol;
+         vol = strtok_r(NULL, ",", &sptr)) {
+      if (GB_REALLOC_N(volumes, count + 1) < 0 ||
+          GB_STRDUP(volumes[count], vol) < 0) {
+        goto out;
+      }
+      count++;
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    if (started == glfsLruCount) {
+      LOG("mgmt", GB_LOG_WARNING,
+          "not prewarming volume %s, glfs-lru-count %zu reached",
+          volumes[i], glfsLruCount);
+      continue;
+    }
+    if (!glusterBlockVolumeInitAsync(volumes[i])) {
+      LOG("mgmt", GB_LOG_INFO, "prewarming volume %s", volumes[i]);
+      started++;
+    }
+  }
+
+ out:
+  glusterBlockLioIndexVolumesFree(volumes, count);
+  GB_FREE(dup);
+}
+
+
+/* exit status of argv, -1 if it didn't exit by itself */
+static int
+blockSanityRun(char *const argv[])
+{
+  gbRunResult res;
+  int errsv;
+  int ret;
+
+
+  ret = gbRun(argv, NULL, GB_RUN_TIMEOUT, &res);
+  errsv = errno;
+  if (!ret) {
+    ret = res.status;
+  }
+  gbRunResultFree(&res);
+  errno = errsv;
+
+  return ret;
+}
+
+
 static int
 blockNodeSanityCheck(void)
 {
   int ret;
-  char *global_opts;
+  char *logfile = NULL;
+  char *tcmuCheck[] = {"pgrep", "-x", "tcmu-runner", NULL};
+  char *tgcliCheck[] = {"targetcli", "/backstores/user:glfs", "ls", NULL};
+  char *tgcliGlobals[] = {"targetcli", "set", "global",
+                          "auto_add_default_portal=false",
+                          "auto_enable_tpgt=false", "loglevel_file=info",
+                          NULL, NULL};
+  char *tgcliSave[] = {"targetcli", "/", "saveconfig", NULL};
 
 
   /* Check if tcmu-runner is running */
-  ret = gbRunner("ps aux ww | grep -w '[t]cmu-runner' > /dev/null");
+  ret = blockSanityRun(tcmuCheck);
   if (ret) {
     LOG("mgmt", GB_LOG_ERROR, "%s", "tcmu-runner not running");
     return ESRCH;
   }
 
   /* Check targetcli has user:glfs handler listed */
-  ret = gbRunner("targetcli /backstores/user:glfs ls > /dev/null");
-  if (ret) {
+  ret = blockSanityRun(tgcliCheck);
+  if (ret == -1 && errno == ENOENT) {
+    LOG("mgmt", GB_LOG_ERROR, "%s", "targetcli not found");
+    return EKEYEXPIRED;
+  } else if (ret) {
     LOG("mgmt", GB_LOG_ERROR, "%s",
         "tcmu-runner running, but targetcli doesn't list user:glfs handler");
     return  ENODEV;
   }
 
-  if (ret == EKEYEXPIRED) {
-    LOG("mgmt", GB_LOG_ERROR, "%s", "targetcli not found");
-    return EKEYEXPIRED;
-  }
-
-  if (GB_ASPRINTF(&global_opts, GB_TGCLI_GLOBALS, gbConf.configShellLogFile) == -1) {
+  if (GB_ASPRINTF(&logfile, GB_TGCLI_LOGFILE, gbConf.configShellLogFile) == -1) {
     return ENOMEM;
   }
+  tgcliGlobals[6] = logfile;
+
   /* Set targetcli globals */
-  ret = gbRunner(global_opts);
-  GB_FREE(global_opts);
+  ret = blockSanityRun(tgcliGlobals);
+  if (!ret) {
+    ret = blockSanityRun(tgcliSave);
+  }
+  GB_FREE(logfile);
   if (ret) {
     LOG("mgmt", GB_LOG_ERROR, "%s",
         "targetcli set global attr failed");
@@ -307,8 +567,6 @@ int
 main (int argc, char **argv)
 {
   int fd;
-  pthread_t cli_thread;
-  pthread_t server_thread;
   struct flock lock = {0, };
   int errnosv = 0;
 
@@ -344,19 +602,31 @@ main (int argc, char **argv)
     exit(errnosv);
   }
 
+  if (glusterBlockLioInit()) {
+    exit(EXIT_FAILURE);
+  }
+
   initCache();
 
+  glusterBlockDPrewarm(gbPrewarmVolumes);
+
   /* set signal */
   signal(SIGPIPE, SIG_IGN);
 
   pmap_unset(GLUSTER_BLOCK_CLI, GLUSTER_BLOCK_CLI_VERS);
   pmap_unset(GLUSTER_BLOCK, GLUSTER_BLOCK_VERS);
 
-  pthread_create(&cli_thread, NULL, glusterBlockCliThreadProc, NULL);
-  pthread_create(&server_thread, NULL, glusterBlockServerThreadProc, NULL);
+  if (glusterBlockSvcDispatchInit()) {
+    exit(EXIT_FAILURE);
+  }
+
+  /* transports must be created on the thread that polls them */
+  if (glusterBlockCliSvcCreate()) {
+    LOG("mgmt", GB_LOG_ERROR, "%s", "cli rpc service is not available");
+  }
+  glusterBlockServerSvcCreate();
 
-  pthread_join(cli_thread, NULL);
-  pthread_join(server_thread, NULL);
+  glusterBlockSvcRun();
 
   LOG("mgmt", GB_LOG_ERROR, "svc_run returned (%s)", strerror (errno));
 
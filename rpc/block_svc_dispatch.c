@@ -0,0 +1,377 @@
+/*
+  Copyright (c) 2018 Red Hat, Inc. <http://www.redhat.com>
+  This file is part of gluster-block.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+
+# define   _GNU_SOURCE
+# include  <fcntl.h>
+# include  <pthread.h>
+# include  <sys/select.h>
+
+# include  "common.h"
+# include  "workers.h"
+# include  "block.h"
+# include  "block_svc.h"
+
+# define   GB_FANOUT_PER_WORKER   4   /* fan-out workers per cli worker */
+
+
+size_t gbRpcWorkerCount = GB_WORKERS_DEFAULT;  /* per rpc program */
+size_t gbVolumeWorkerCount = GB_KEY_WORKERS_DEFAULT;
+
+/* remote calls fanned out by the cli handlers, see glusterBlock*RemoteAsync */
+gbWorkerPool *gbFanoutPool;
+
+typedef bool_t (*gbSvcProc)(char *, void *, struct svc_req *);
+typedef int (*gbSvcFreeResult)(SVCXPRT *, xdrproc_t, caddr_t);
+
+/* A decoded request, handed from the listener to a worker */
+typedef struct gbSvcCall {
+  SVCXPRT *transp;
+  struct svc_req req;
+  xdrproc_t xdr_argument;
+  xdrproc_t xdr_result;
+  gbSvcProc local;
+  gbSvcFreeResult freeresult;
+
+  union {
+    blockCreate block_create_1_arg;
+    blockDelete block_delete_1_arg;
+    blockModify block_modify_1_arg;
+    blockReplace block_replace_1_arg;
+    blockCreateBatch block_create_batch_1_arg;
+    blockDeleteBatch block_delete_batch_1_arg;
+    blockCreateCli block_create_cli_1_arg;
+    blockListCli block_list_cli_1_arg;
+    blockInfoCli block_info_cli_1_arg;
+    blockDeleteCli block_delete_cli_1_arg;
+    blockModifyCli block_modify_cli_1_arg;
+    blockReplaceCli block_replace_cli_1_arg;
+  } argument;
+  union {
+    blockResponse response;
+    blockBatchResponse batch;
+  } result;
+} gbSvcCall;
+
+
+/* Separate pools, so cli handlers waiting on peer rpcs (possibly to this
+ * very node) can never use up the workers that serve them. */
+static gbWorkerPool *cliPool;
+static gbWorkerPool *serverPool;
+
+/* Transports with a call in flight; the listener leaves them alone until
+ * the worker has sent the reply. */
+static fd_set busyFds;
+static pthread_mutex_t busyLock = PTHREAD_MUTEX_INITIALIZER;
+static int wakeFds[2] = {-1, -1};
+
+
+static void
+glusterBlockSvcRelease(int fd)
+{
+  LOCK(busyLock);
+  FD_CLR(fd, &busyFds);
+  UNLOCK(busyLock);
+
+  /* kick the listener, so it starts polling this transport again */
+  if (write(wakeFds[1], "", 1) < 0 && errno != EAGAIN) {
+    LOG("mgmt", GB_LOG_ERROR, "failed to wake rpc listener (%s)",
+        strerror(errno));
+  }
+}
+
+
+static void
+glusterBlockSvcCallRun(void *data)
+{
+  gbSvcCall *call = (gbSvcCall *)data;
+  SVCXPRT *transp = call->transp;
+  int fd = transp->xp_sock;
+  bool_t retval;
+
+
+  retval = call->local((char *)&call->argument, (void *)&call->result,
+                       &call->req);
+  if (retval > 0 && !svc_sendreply(transp, call->xdr_result,
+                                   (char *)&call->result)) {
+    svcerr_systemerr(transp);
+  }
+
+  if (!svc_freeargs(transp, call->xdr_argument, (caddr_t)&call->argument)) {
+    LOG("mgmt", GB_LOG_ERROR, "%s", "unable to free arguments");
+  }
+
+  if (!call->freeresult(transp, call->xdr_result, (caddr_t)&call->result)) {
+    LOG("mgmt", GB_LOG_ERROR, "%s", "unable to free results");
+  }
+
+  GB_FREE(call);
+  glusterBlockSvcRelease(fd);
+}
+
+
+/* cli requests are scheduled per block hosting volume */
+static const char *
+glusterBlockCliCallVolume(gbSvcCall *call)
+{
+  switch (call->req.rq_proc) {
+  case BLOCK_CREATE_CLI:
+    return call->argument.block_create_cli_1_arg.volume;
+  case BLOCK_LIST_CLI:
+    return call->argument.block_list_cli_1_arg.volume;
+  case BLOCK_INFO_CLI:
+    return call->argument.block_info_cli_1_arg.volume;
+  case BLOCK_DELETE_CLI:
+    return call->argument.block_delete_cli_1_arg.volume;
+  case BLOCK_MODIFY_CLI:
+    return call->argument.block_modify_cli_1_arg.volume;
+  case BLOCK_REPLACE_CLI:
+    return call->argument.block_replace_cli_1_arg.volume;
+  }
+
+  return NULL;
+}
+
+
+static void
+glusterBlockSvcQueue(gbWorkerPool *pool, struct svc_req *rqstp,
+                     SVCXPRT *transp, xdrproc_t xdr_argument,
+                     xdrproc_t xdr_result, gbSvcProc local,
+                     gbSvcFreeResult freeresult,
+                     const char *(*getkey)(gbSvcCall *))
+{
+  gbSvcCall *call;
+
+
+  if (GB_ALLOC(call) < 0) {
+    svcerr_systemerr(transp);
+    return;
+  }
+
+  call->transp = transp;
+  call->xdr_argument = xdr_argument;
+  call->xdr_result = xdr_result;
+  call->local = local;
+  call->freeresult = freeresult;
+
+  /* credentials live on the listener stack, handlers don't look at them */
+  call->req = *rqstp;
+  call->req.rq_clntcred = NULL;
+
+  if (!svc_getargs(transp, xdr_argument, (caddr_t)&call->argument)) {
+    svcerr_decode(transp);
+    GB_FREE(call);
+    return;
+  }
+
+  LOCK(busyLock);
+  FD_SET(transp->xp_sock, &busyFds);
+  UNLOCK(busyLock);
+
+  if (gbWorkerPoolSubmit(pool, getkey ? getkey(call) : NULL,
+                         glusterBlockSvcCallRun, call)) {
+    /* better late than dropped */
+    glusterBlockSvcCallRun(call);
+  }
+}
+
+
+void
+gluster_block_1_mt(struct svc_req *rqstp, register SVCXPRT *transp)
+{
+  xdrproc_t xdr_argument;
+  xdrproc_t xdr_result = (xdrproc_t) xdr_blockResponse;
+  gbSvcProc local;
+
+
+  switch (rqstp->rq_proc) {
+  case NULLPROC:
+    (void) svc_sendreply(transp, (xdrproc_t) xdr_void, (char *)NULL);
+    return;
+
+  case BLOCK_CREATE:
+    xdr_argument = (xdrproc_t) xdr_blockCreate;
+    local = (gbSvcProc) block_create_1_svc;
+    break;
+
+  case BLOCK_DELETE:
+    xdr_argument = (xdrproc_t) xdr_blockDelete;
+    local = (gbSvcProc) block_delete_1_svc;
+    break;
+
+  case BLOCK_MODIFY:
+    xdr_argument = (xdrproc_t) xdr_blockModify;
+    local = (gbSvcProc) block_modify_1_svc;
+    break;
+
+  case BLOCK_VERSION:
+    xdr_argument = (xdrproc_t) xdr_void;
+    local = (gbSvcProc) block_version_1_svc;
+    break;
+
+  case BLOCK_REPLACE:
+    xdr_argument = (xdrproc_t) xdr_blockReplace;
+    local = (gbSvcProc) block_replace_1_svc;
+    break;
+
+  case BLOCK_CREATE_BATCH:
+    xdr_argument = (xdrproc_t) xdr_blockCreateBatch;
+    xdr_result = (xdrproc_t) xdr_blockBatchResponse;
+    local = (gbSvcProc) block_create_batch_1_svc;
+    break;
+
+  case BLOCK_DELETE_BATCH:
+    xdr_argument = (xdrproc_t) xdr_blockDeleteBatch;
+    xdr_result = (xdrproc_t) xdr_blockBatchResponse;
+    local = (gbSvcProc) block_delete_batch_1_svc;
+    break;
+
+  default:
+    svcerr_noproc(transp);
+    return;
+  }
+
+  glusterBlockSvcQueue(serverPool, rqstp, transp, xdr_argument, xdr_result,
+                       local, gluster_block_1_freeresult, NULL);
+}
+
+
+void
+gluster_block_cli_1_mt(struct svc_req *rqstp, register SVCXPRT *transp)
+{
+  xdrproc_t xdr_argument;
+  gbSvcProc local;
+
+
+  switch (rqstp->rq_proc) {
+  case NULLPROC:
+    (void) svc_sendreply(transp, (xdrproc_t) xdr_void, (char *)NULL);
+    return;
+
+  case BLOCK_CREATE_CLI:
+    xdr_argument = (xdrproc_t) xdr_blockCreateCli;
+    local = (gbSvcProc) block_create_cli_1_svc;
+    break;
+
+  case BLOCK_LIST_CLI:
+    xdr_argument = (xdrproc_t) xdr_blockListCli;
+    local = (gbSvcProc) block_list_cli_1_svc;
+    break;
+
+  case BLOCK_INFO_CLI:
+    xdr_argument = (xdrproc_t) xdr_blockInfoCli;
+    local = (gbSvcProc) block_info_cli_1_svc;
+    break;
+
+  case BLOCK_DELETE_CLI:
+    xdr_argument = (xdrproc_t) xdr_blockDeleteCli;
+    local = (gbSvcProc) block_delete_cli_1_svc;
+    break;
+
+  case BLOCK_MODIFY_CLI:
+    xdr_argument = (xdrproc_t) xdr_blockModifyCli;
+    local = (gbSvcProc) block_modify_cli_1_svc;
+    break;
+
+  case BLOCK_REPLACE_CLI:
+    xdr_argument = (xdrproc_t) xdr_blockReplaceCli;
+    local = (gbSvcProc) block_replace_cli_1_svc;
+    break;
+
+  default:
+    svcerr_noproc(transp);
+    return;
+  }
+
+  glusterBlockSvcQueue(cliPool, rqstp, transp, xdr_argument,
+                       (xdrproc_t) xdr_blockResponse, local,
+                       gluster_block_cli_1_freeresult,
+                       glusterBlockCliCallVolume);
+}
+
+
+int
+glusterBlockSvcDispatchInit(void)
+{
+  size_t nfanout;
+
+
+  if (pipe2(wakeFds, O_NONBLOCK | O_CLOEXEC)) {
+    LOG("mgmt", GB_LOG_ERROR, "pipe2() for rpc listener failed (%s)",
+        strerror(errno));
+    return -1;
+  }
+
+  cliPool = gbWorkerPoolCreate("cli", gbRpcWorkerCount, gbVolumeWorkerCount);
+  if (!cliPool) {
+    LOG("mgmt", GB_LOG_ERROR, "%s", "failed to create cli rpc workers");
+    return -1;
+  }
+
+  serverPool = gbWorkerPoolCreate("server", gbRpcWorkerCount,
+                                  gbRpcWorkerCount);
+  if (!serverPool) {
+    LOG("mgmt", GB_LOG_ERROR, "%s", "failed to create server rpc workers");
+    return -1;
+  }
+
+  /* a cli request talks to a handful of nodes at once */
+  nfanout = gbRpcWorkerCount * GB_FANOUT_PER_WORKER;
+  if (nfanout > GB_WORKERS_MAX) {
+    nfanout = GB_WORKERS_MAX;
+  }
+  gbFanoutPool = gbWorkerPoolCreate("fanout", nfanout, 1);
+  if (!gbFanoutPool) {
+    LOG("mgmt", GB_LOG_ERROR, "%s", "failed to create remote fan-out workers");
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/* svc_run() equivalent, all transports are read and decoded from here */
+void
+glusterBlockSvcRun(void)
+{
+  fd_set readfds;
+  char buf[64];
+  int fd;
+
+
+  while (1) {
+    LOCK(busyLock);
+    readfds = svc_fdset;
+    for (fd = 0; fd < FD_SETSIZE; fd++) {
+      if (FD_ISSET(fd, &busyFds)) {
+        FD_CLR(fd, &readfds);
+      }
+    }
+    UNLOCK(busyLock);
+    FD_SET(wakeFds[0], &readfds);
+
+    if (select(FD_SETSIZE, &readfds, NULL, NULL, NULL) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG("mgmt", GB_LOG_ERROR, "select() in rpc listener failed (%s)",
+          strerror(errno));
+      return;
+    }
+
+    if (FD_ISSET(wakeFds[0], &readfds)) {
+      while (read(wakeFds[0], buf, sizeof(buf)) > 0)
+        ;
+      FD_CLR(wakeFds[0], &readfds);
+    }
+
+    svc_getreqset(&readfds);
+  }
+}
@@ -11,7 +11,13 @@
 
 # include  "common.h"
 # include  "capabilities.h"
+# include  "locktable.h"
+# include  "clnt-pool.h"
+# include  "workers.h"
 # include  "glfs-operations.h"
+# include  "lio-operations.h"
+# include  "tgcli-pool.h"
+# include  "runner.h"
 
 # include  <pthread.h>
 # include  <netdb.h>
@@ -27,20 +33,15 @@
 # define   GB_MSERVER_DELIMITER ","
 
 # define   GB_TGCLI_GLFS_PATH   "/backstores/user:glfs"
-# define   GB_TGCLI_GLFS        "targetcli " GB_TGCLI_GLFS_PATH
-# define   GB_TGCLI_CHECK       GB_TGCLI_GLFS " ls | grep ' %s ' | grep '/%s ' > " DEVNULLPATH
 # define   GB_TGCLI_ISCSI_PATH  "/iscsi"
 # define   GB_TGCLI_SAVE        "/ saveconfig"
 # define   GB_TGCLI_ATTRIBUTES  "generate_node_acls=1 demo_mode_write_protect=0"
 # define   GB_TGCLI_IQN_PREFIX  "iqn.2016-12.org.gluster-block:"
+# define   GB_SAVE_WINDOW_MS    5
 
 # define   GB_JSON_OBJ_TO_STR(x) json_object_new_string(x?x:"")
 # define   GB_DEFAULT_ERRMSG    "Operation failed, please check the log "\
                                 "file to find the reason."
-# define   GB_GET_PORTAL_TPG    "targetcli /iscsi/" GB_TGCLI_IQN_PREFIX \
-                                "'%s' ls | grep -e tpg -e '%s' | grep -B1 '%s' | grep -o 'tpg\\w'"
-# define   GB_CHECK_PORTAL      "targetcli /iscsi/" GB_TGCLI_IQN_PREFIX \
-                                "'%s' ls | grep '%s' > " DEVNULLPATH
 
 # define   GB_OLD_CAP_MAX       9
 
@@ -48,7 +49,17 @@
 # define   GB_NODE_NOT_EXIST    223
 # define   GB_NODE_IN_USE       224
 
-pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+# define   GB_BATCH_MAX         32   /* blocks per BLOCK_*_BATCH call */
+
+extern gbWorkerPool *gbFanoutPool;
+
+/* saveconfig group commit, see blockSaveConfig() */
+static pthread_mutex_t saveLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t saveCond = PTHREAD_COND_INITIALIZER;
+static unsigned long saveQueued;   /* changes waiting for a save */
+static unsigned long saveDone;     /* of them, covered by a finished save */
+static bool saveRunning;
+static unsigned long saveOkUpto;   /* changes covered by a save that worked */
 
 typedef enum operations {
   CREATE_SRV = 1,
@@ -56,7 +67,6 @@ typedef enum operations {
   MODIFY_SRV,
   MODIFY_TPGC_SRV,
   REPLACE_SRV,
-  REPLACE_GET_PORTAL_TPG_SRV,
   LIST_SRV,
   INFO_SRV,
   VERSION_SRV
@@ -148,6 +158,7 @@ removeDuplicateSubstr(char **line)
   char *temp = *line;
   char *out;
   char *element;
+  char *sptr = NULL;
 
 
   if (!temp) {
@@ -160,13 +171,13 @@ removeDuplicateSubstr(char **line)
   }
 
   /* Split string into tokens */
-  element = strtok(temp, " ");
+  element = strtok_r(temp, " ", &sptr);
   while (element) {
     if (!strstr(out, element)) {
       strncat(out, element, strlen(element));
       strncat(out, " ", 1);
     }
-    element = strtok(NULL, " ");
+    element = strtok_r(NULL, " ", &sptr);
   }
 
   GB_FREE(*line);
@@ -230,17 +241,18 @@ blockStr2arrayAddToJsonObj(json_object *json_obj, char *string, char *label,
                            json_object **json_array)
 {
   char *tmp = NULL;
+  char *sptr = NULL;
   json_object *json_array1 = NULL;
 
   if (!string)
     return;
 
   json_array1 = json_object_new_array();
-  tmp = strtok (string, " ");
+  tmp = strtok_r (string, " ", &sptr);
   while (tmp != NULL)
   {
     json_object_array_add(json_array1, GB_JSON_OBJ_TO_STR(tmp));
-    tmp = strtok (NULL, " ");
+    tmp = strtok_r (NULL, " ", &sptr);
   }
   json_object_object_add(json_obj, label, json_array1);
   *json_array = json_array1;
@@ -280,6 +292,7 @@ static int
 blockRemoteCreateRespParse(char *output, blockRemoteCreateResp **savereply)
 {
   char *line;
+  char *sptr = NULL;
   blockRemoteCreateResp *local = *savereply;
   char *portal = NULL;
   char *errMsg = NULL;
@@ -298,7 +311,7 @@ blockRemoteCreateRespParse(char *output, blockRemoteCreateResp **savereply)
   }
 
   /* get the first line */
-  line = strtok(output, "\n");
+  line = strtok_r(output, "\n", &sptr);
   while (line)
   {
     switch (blockRemoteCreateRespEnumParse(line)) {
@@ -363,7 +376,7 @@ blockRemoteCreateRespParse(char *output, blockRemoteCreateResp **savereply)
       break;
     }
 
-    line = strtok(NULL, "\n");
+    line = strtok_r(NULL, "\n", &sptr);
   }
 
   *savereply = local;
@@ -377,30 +390,6 @@ blockRemoteCreateRespParse(char *output, blockRemoteCreateResp **savereply)
 }
 
 
-struct addrinfo *
-glusterBlockGetSockaddr(char *host)
-{
-  int ret;
-  struct addrinfo hints, *res;
-
-  memset(&hints, 0, sizeof hints);
-  hints.ai_family = AF_INET;
-  hints.ai_socktype = SOCK_STREAM;
-
-  ret = getaddrinfo(host, GB_TCP_PORT_STR, &hints, &res);
-  if (ret) {
-    LOG("mgmt", GB_LOG_ERROR, "getaddrinfo(%s) failed (%s)",
-        host, gai_strerror(ret));
-    goto out;
-  }
-
-  return res;
-
- out:
-  return NULL;
-}
-
-
 static int glusterBlockHostConnect(char *host)
 {
   int sockfd = -1;
@@ -457,76 +446,66 @@ glusterBlockCallRPC_1(char *host, void *cobj,
 {
   CLIENT *clnt = NULL;
   int ret = -1;
-  int sockfd = -1;
-  int errsv = 0;
   size_t i;
+  bool fresh;
+  bool retried = false;
+  enum clnt_stat stat = RPC_FAILED;
+  char *errStr = NULL;
   blockResponse reply = {0,};
-  struct addrinfo *res = NULL;
   gbCapResp *obj = NULL;
 
 
   *rpc_sent = FALSE;
 
-  if (!(res = glusterBlockGetSockaddr(host))) {
-    goto out;
-  }
-
-  clnt = clnttcp_create ((struct sockaddr_in *)res->ai_addr, GLUSTER_BLOCK, GLUSTER_BLOCK_VERS, &sockfd, 0, 0);
+ retry:
+  clnt = glusterBlockClntGet(host, &fresh);
   if (!clnt) {
-    LOG("mgmt", GB_LOG_ERROR, "%son inet host %s",
-        clnt_spcreateerror("client create failed"), host);
     goto out;
   }
 
   switch(opt) {
   case CREATE_SRV:
     GB_STRCPYSTATIC(((blockCreate *)cobj)->ipaddr, host);
-    *rpc_sent = TRUE;
-
-    if (block_create_1((blockCreate *)cobj, &reply, clnt) != RPC_SUCCESS) {
-      LOG("mgmt", GB_LOG_ERROR, "%son host %s",
-          clnt_sperror(clnt, "block remote create failed"), host);
-      goto out;
-    }
+    stat = block_create_1((blockCreate *)cobj, &reply, clnt);
+    errStr = "block remote create failed";
     break;
   case VERSION_SRV:
-    *rpc_sent = TRUE;
-    ret = block_version_1((void*)cobj, &reply, clnt);
-    if (ret != RPC_SUCCESS) {
-      LOG("mgmt", GB_LOG_ERROR, "%son host %s",
-          clnt_sperror(clnt, "block remote version failed"), host);
-      goto out;
-    }
+    stat = block_version_1((void*)cobj, &reply, clnt);
+    errStr = "block remote version failed";
     break;
   case DELETE_SRV:
-    *rpc_sent = TRUE;
-    if (block_delete_1((blockDelete *)cobj, &reply, clnt) != RPC_SUCCESS) {
-      LOG("mgmt", GB_LOG_ERROR, "%son host %s",
-          clnt_sperror(clnt, "block remote delete failed"), host);
-      goto out;
-    }
+    stat = block_delete_1((blockDelete *)cobj, &reply, clnt);
+    errStr = "block remote delete failed";
     break;
   case MODIFY_SRV:
-    *rpc_sent = TRUE;
-    if (block_modify_1((blockModify *)cobj, &reply, clnt) != RPC_SUCCESS) {
-      LOG("mgmt", GB_LOG_ERROR, "%son host %s",
-          clnt_sperror(clnt, "block remote modify failed"), host);
-      goto out;
-    }
+    stat = block_modify_1((blockModify *)cobj, &reply, clnt);
+    errStr = "block remote modify failed";
     break;
   case MODIFY_TPGC_SRV:
   case LIST_SRV:
   case INFO_SRV:
       goto out;
   case REPLACE_SRV:
-      *rpc_sent = TRUE;
-      if (block_replace_1((blockReplace *)cobj, &reply, clnt) != RPC_SUCCESS) {
-        LOG("mgmt", GB_LOG_ERROR, "%son host %s",
-            clnt_sperror(clnt, "block remote replace failed"), host);
-        goto out;
-      }
+      stat = block_replace_1((blockReplace *)cobj, &reply, clnt);
+      errStr = "block remote replace failed";
       break;
   }
+  *rpc_sent = TRUE;
+
+  if (stat != RPC_SUCCESS) {
+    /* nothing reached the peer, safe to try again on a new connection */
+    if (stat == RPC_CANTSEND && !fresh && !retried) {
+      LOG("mgmt", GB_LOG_DEBUG, "%son host %s, reconnecting",
+          clnt_sperror(clnt, errStr), host);
+      glusterBlockClntPut(host, clnt, true);
+      clnt = NULL;
+      retried = true;
+      goto retry;
+    }
+    LOG("mgmt", GB_LOG_ERROR, "%son host %s",
+        clnt_sperror(clnt, errStr), host);
+    goto out;
+  }
 
   ret = reply.exit;
   if (opt != VERSION_SRV) {
@@ -535,12 +514,16 @@ glusterBlockCallRPC_1(char *host, void *cobj,
     }
   } else {
     if (GB_ALLOC(obj) < 0) {
-      return -1;
+      ret = -1;
+      goto out;
     }
     obj->capMax = reply.xdata.xdata_len/sizeof(gbCapObj);
+    obj->bootId = reply.offset;
     gbCapObj *caps = (gbCapObj *)reply.xdata.xdata_val;
     if (GB_ALLOC_N(obj->response, obj->capMax) < 0) {
-      return -1;
+      GB_FREE(obj);
+      ret = -1;
+      goto out;
     }
     for (i = 0; i < obj->capMax; i++) {
       GB_STRCPYSTATIC(obj->response[i].cap, caps[i].cap);
@@ -551,28 +534,238 @@ glusterBlockCallRPC_1(char *host, void *cobj,
 
  out:
   if (clnt) {
-    if (reply.out && !clnt_freeres(clnt, (xdrproc_t)xdr_blockResponse,
-                                   (char *)&reply)) {
+    if (stat == RPC_SUCCESS &&
+        !clnt_freeres(clnt, (xdrproc_t)xdr_blockResponse, (char *)&reply)) {
       LOG("mgmt", GB_LOG_ERROR, "%s",
           clnt_sperror(clnt, "clnt_freeres failed"));
 
     }
-    clnt_destroy (clnt);
+    glusterBlockClntPut(host, clnt, stat != RPC_SUCCESS);
   }
 
-  if (res) {
-    freeaddrinfo(res);
+  return ret;
+}
+
+
+/* Remote creates (or deletes) to the same peer which queue up while one is
+ * in flight go out together, in a single BLOCK_*_BATCH call. */
+typedef struct gbBatchCall {
+  void *obj;
+  int exit;
+  int errsv;
+  char *out;
+  bool rpc_sent;
+  bool done;
+
+  struct list_head list;
+} gbBatchCall;
+
+typedef struct gbBatchQueue {
+  char host[255];
+  operations opt;
+  bool busy;                 /* a call to host is in flight */
+  struct list_head calls;    /* waiting for the next one */
+
+  struct list_head list;
+} gbBatchQueue;
+
+static LIST_HEAD(batchQueues);
+static pthread_mutex_t batchLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batchCond = PTHREAD_COND_INITIALIZER;
+
+
+static void
+glusterBlockCallBatchRPC_1(char *host, operations opt,
+                           gbBatchCall **calls, size_t count)
+{
+  CLIENT *clnt = NULL;
+  bool fresh;
+  bool retried = false;
+  bool sent = false;
+  enum clnt_stat stat = RPC_FAILED;
+  char *errStr = NULL;
+  blockCreateBatch cbatch = {{0, }, };
+  blockDeleteBatch dbatch = {{0, }, };
+  blockBatchResponse reply = {{0, }, };
+  int errsv = 0;
+  size_t i;
+
+
+  if (opt == CREATE_SRV) {
+    if (GB_ALLOC_N(cbatch.blocks.blocks_val, count) < 0) {
+      goto out;
+    }
+    cbatch.blocks.blocks_len = count;
+    for (i = 0; i < count; i++) {
+      cbatch.blocks.blocks_val[i] = *(blockCreate *)calls[i]->obj;
+      GB_STRCPYSTATIC(cbatch.blocks.blocks_val[i].ipaddr, host);
+    }
+  } else {
+    if (GB_ALLOC_N(dbatch.blocks.blocks_val, count) < 0) {
+      goto out;
+    }
+    dbatch.blocks.blocks_len = count;
+    for (i = 0; i < count; i++) {
+      dbatch.blocks.blocks_val[i] = *(blockDelete *)calls[i]->obj;
+    }
   }
 
-  if (sockfd != -1) {
-    close(sockfd);
+ retry:
+  clnt = glusterBlockClntGet(host, &fresh);
+  if (!clnt) {
+    errsv = errno;
+    goto out;
   }
 
-  if (errsv) {
-    errno = errsv;
+  if (opt == CREATE_SRV) {
+    stat = block_create_batch_1(&cbatch, &reply, clnt);
+    errStr = "block remote create batch failed";
+  } else {
+    stat = block_delete_batch_1(&dbatch, &reply, clnt);
+    errStr = "block remote delete batch failed";
+  }
+  sent = true;
+
+  if (stat != RPC_SUCCESS) {
+    if (stat == RPC_CANTSEND && !fresh && !retried) {
+      LOG("mgmt", GB_LOG_DEBUG, "%son host %s, reconnecting",
+          clnt_sperror(clnt, errStr), host);
+      glusterBlockClntPut(host, clnt, true);
+      clnt = NULL;
+      retried = true;
+      goto retry;
+    }
+    LOG("mgmt", GB_LOG_ERROR, "%son host %s",
+        clnt_sperror(clnt, errStr), host);
+    goto out;
   }
 
-  return ret;
+  if (reply.results.results_len != count) {
+    LOG("mgmt", GB_LOG_ERROR, "%s on host %s: %u results for %zu blocks",
+        errStr, host, reply.results.results_len, count);
+    goto out;
+  }
+
+  for (i = 0; i < count; i++) {
+    calls[i]->exit = reply.results.results_val[i].exit;
+    GB_STRDUP(calls[i]->out, reply.results.results_val[i].out);
+  }
+
+ out:
+  for (i = 0; i < count; i++) {
+    calls[i]->rpc_sent = sent;
+    calls[i]->errsv = errsv;
+  }
+
+  if (clnt) {
+    if (stat == RPC_SUCCESS &&
+        !clnt_freeres(clnt, (xdrproc_t)xdr_blockBatchResponse, (char *)&reply)) {
+      LOG("mgmt", GB_LOG_ERROR, "%s",
+          clnt_sperror(clnt, "clnt_freeres failed"));
+    }
+    glusterBlockClntPut(host, clnt, stat != RPC_SUCCESS);
+  }
+
+  GB_FREE(cbatch.blocks.blocks_val);
+  GB_FREE(dbatch.blocks.blocks_val);
+}
+
+
+static gbBatchQueue *
+glusterBlockBatchQueueGet(char *host, operations opt)
+{
+  gbBatchQueue *queue;
+
+
+  list_for_each_entry(queue, &batchQueues, list) {
+    if (queue->opt == opt && !strcmp(queue->host, host)) {
+      return queue;
+    }
+  }
+
+  if (GB_ALLOC(queue) < 0) {
+    return NULL;
+  }
+  GB_STRCPYSTATIC(queue->host, host);
+  queue->opt = opt;
+  INIT_LIST_HEAD(&queue->calls);
+  list_add(&queue->list, &batchQueues);
+
+  return queue;
+}
+
+
+/* glusterBlockCallRPC_1() for CREATE_SRV and DELETE_SRV, batched with the
+ * concurrent calls to the same host when it knows how to take them */
+static int
+glusterBlockCallBatchedRPC_1(char *host, void *cobj, operations opt,
+                             bool *rpc_sent, char **out)
+{
+  gbBatchQueue *queue;
+  gbBatchCall call = {0, };
+  gbBatchCall *calls[GB_BATCH_MAX];
+  gbBatchCall *c, *tmp;
+  size_t count, i;
+
+
+  if (!glusterBlockPeerCapsHas(host, (opt == CREATE_SRV) ?
+                               GB_CREATE_BATCH_CAP : GB_DELETE_BATCH_CAP)) {
+    return glusterBlockCallRPC_1(host, cobj, opt, rpc_sent, out);
+  }
+
+  call.obj = cobj;
+  call.exit = -1;
+
+  LOCK(batchLock);
+  if (!(queue = glusterBlockBatchQueueGet(host, opt))) {
+    UNLOCK(batchLock);
+    return glusterBlockCallRPC_1(host, cobj, opt, rpc_sent, out);
+  }
+  list_add_tail(&call.list, &queue->calls);
+
+  while (!call.done) {
+    if (queue->busy) {
+      pthread_cond_wait(&batchCond, &batchLock);
+      continue;
+    }
+
+    /* lead the next call, with whatever has queued up by now */
+    queue->busy = true;
+    count = 0;
+    list_for_each_entry_safe(c, tmp, &queue->calls, list) {
+      if (count == GB_BATCH_MAX) {
+        break;
+      }
+      list_del(&c->list);
+      calls[count++] = c;
+    }
+    UNLOCK(batchLock);
+
+    if (count == 1) {
+      calls[0]->exit = glusterBlockCallRPC_1(host, calls[0]->obj, opt,
+                                             &calls[0]->rpc_sent,
+                                             &calls[0]->out);
+      calls[0]->errsv = errno;
+    } else {
+      LOG("mgmt", GB_LOG_DEBUG, "sending %zu %s requests to %s in one batch",
+          count, (opt == CREATE_SRV) ? GB_CREATE : GB_DELETE, host);
+      glusterBlockCallBatchRPC_1(host, opt, calls, count);
+    }
+
+    LOCK(batchLock);
+    for (i = 0; i < count; i++) {
+      calls[i]->done = true;
+    }
+    queue->busy = false;
+    pthread_cond_broadcast(&batchCond);
+  }
+  UNLOCK(batchLock);
+
+  *rpc_sent = call.rpc_sent;
+  *out = call.out;
+  errno = call.errsv;
+
+  return call.exit;
 }
 
 
@@ -628,7 +821,7 @@ blockServerParse(char *blkServers)
 }
 
 
-void *
+void
 glusterBlockCapabilitiesRemote(void *data)
 {
   int ret;
@@ -636,10 +829,19 @@ glusterBlockCapabilitiesRemote(void *data)
   bool rpc_sent = FALSE;
 
 
+  /* cached until the connection to the peer breaks or the ttl is over */
+  args->reply = (char *)glusterBlockPeerCapsGet(args->addr);
+  if (args->reply) {
+    args->exit = 0;
+    return;
+  }
+
   /* Get peers capabilities */
   ret = glusterBlockCallRPC_1(args->addr, NULL, VERSION_SRV, &rpc_sent,
                               &args->reply);
-  if (ret && ret != RPC_PROCUNAVAIL) {
+  if (!ret && args->reply) {
+    glusterBlockPeerCapsSet(args->addr, (gbCapResp *)args->reply);
+  } else if (ret && ret != RPC_PROCUNAVAIL) {
     if (!rpc_sent) {
       LOG("mgmt", GB_LOG_ERROR, "%s hence %s on host %s",
           strerror(errno), FAILED_REMOTE_CAPS, args->addr);
@@ -652,8 +854,6 @@ glusterBlockCapabilitiesRemote(void *data)
   }
 
   args->exit = ret;
-
-  return NULL;
 }
 
 
@@ -766,8 +966,8 @@ static int
 glusterBlockCapabilityRemoteAsync(blockServerDef *servers, bool *minCaps,
                                   char **errMsg)
 {
-  static blockRemoteObj *args = NULL;
-  pthread_t  *tid = NULL;
+  blockRemoteObj *args = NULL;
+  gbWorkBatch batch = GB_WORK_BATCH_INITIALIZER;
   int ret = -1;
   size_t i;
 
@@ -777,10 +977,6 @@ glusterBlockCapabilityRemoteAsync(blockServerDef *servers, bool *minCaps,
     return 0;
   }
 
-  if (GB_ALLOC_N(tid, servers->nhosts) < 0) {
-    goto out;
-  }
-
   if (GB_ALLOC_N(args, servers->nhosts) < 0) {
     goto out;
   }
@@ -790,26 +986,21 @@ glusterBlockCapabilityRemoteAsync(blockServerDef *servers, bool *minCaps,
   }
 
   for (i = 0; i < servers->nhosts; i++) {
-    pthread_create(&tid[i], NULL, glusterBlockCapabilitiesRemote, &args[i]);
-  }
-
-  for (i = 0; i < servers->nhosts; i++) {
-    /* collect exit code */
-    pthread_join(tid[i], NULL);
+    gbWorkBatchSubmit(gbFanoutPool, &batch, glusterBlockCapabilitiesRemote, &args[i]);
   }
+  gbWorkBatchWait(&batch);
 
   /* Verify the capabilities */
   ret = blockRemoteCapabilitiesRespParse(servers->nhosts, args, minCaps, errMsg);
 
  out:
   GB_FREE(args);
-  GB_FREE(tid);
 
   return ret;
 }
 
 
-void *
+void
 glusterBlockCreateRemote(void *data)
 {
   int ret;
@@ -820,11 +1011,11 @@ glusterBlockCreateRemote(void *data)
   bool rpc_sent = FALSE;
 
 
-  GB_METAUPDATE_OR_GOTO(lock, args->glfs, cobj.block_name, cobj.volume,
+  GB_METAUPDATE_OR_GOTO(args->glfs, cobj.block_name, cobj.volume,
                         ret, errMsg, out, "%s: CONFIGINPROGRESS\n", args->addr);
 
-  ret = glusterBlockCallRPC_1(args->addr, &cobj, CREATE_SRV, &rpc_sent,
-                              &args->reply);
+  ret = glusterBlockCallBatchedRPC_1(args->addr, &cobj, CREATE_SRV, &rpc_sent,
+                                     &args->reply);
   if (ret) {
     saveret = ret;
     if (!rpc_sent) {
@@ -838,7 +1029,7 @@ glusterBlockCreateRemote(void *data)
       args->reply = NULL;
     }
 
-    GB_METAUPDATE_OR_GOTO(lock, args->glfs, cobj.block_name, cobj.volume,
+    GB_METAUPDATE_OR_GOTO(args->glfs, cobj.block_name, cobj.volume,
                           ret, errMsg, out, "%s: CONFIGFAIL\n", args->addr);
     LOG("mgmt", GB_LOG_ERROR, "%s for block %s on host %s volume %s",
         FAILED_REMOTE_CREATE, cobj.block_name, args->addr, args->volume);
@@ -847,10 +1038,10 @@ glusterBlockCreateRemote(void *data)
     goto out;
   }
 
-  GB_METAUPDATE_OR_GOTO(lock, args->glfs, cobj.block_name, cobj.volume,
+  GB_METAUPDATE_OR_GOTO(args->glfs, cobj.block_name, cobj.volume,
                         ret, errMsg, out, "%s: CONFIGSUCCESS\n", args->addr);
   if (cobj.auth_mode) {
-    GB_METAUPDATE_OR_GOTO(lock, args->glfs, cobj.block_name, cobj.volume,
+    GB_METAUPDATE_OR_GOTO(args->glfs, cobj.block_name, cobj.volume,
                           ret, errMsg, out, "%s: AUTHENFORCED\n", args->addr);
   }
 
@@ -864,7 +1055,6 @@ glusterBlockCreateRemote(void *data)
   args->exit = ret;
 
   GB_FREE (errMsg);
-  return NULL;
 }
 
 
@@ -875,16 +1065,12 @@ glusterBlockCreateRemoteAsync(blockServerDefPtr list,
                             blockCreate *cobj,
                             blockRemoteCreateResp **savereply)
 {
-  pthread_t  *tid = NULL;
-  static blockRemoteObj *args = NULL;
+  gbWorkBatch batch = GB_WORK_BATCH_INITIALIZER;
+  blockRemoteObj *args = NULL;
   int ret = -1;
   size_t i;
 
 
-  if (GB_ALLOC_N(tid, mpath) < 0) {
-    goto out;
-  }
-
   if (GB_ALLOC_N(args, mpath) < 0) {
     goto out;
  }
@@ -897,13 +1083,9 @@ glusterBlockCreateRemoteAsync(blockServerDefPtr list,
   }
 
   for (i = 0; i < mpath; i++) {
-    pthread_create(&tid[i], NULL, glusterBlockCreateRemote, &args[i]);
-  }
-
-  for (i = 0; i < mpath; i++) {
-    /* collect exit code */
-    pthread_join(tid[i], NULL);
+    gbWorkBatchSubmit(gbFanoutPool, &batch, glusterBlockCreateRemote, &args[i]);
   }
+  gbWorkBatchWait(&batch);
 
   for (i = 0; i < mpath; i++) {
     /* TODO: use glusterBlockCollectAttemptSuccess */
@@ -923,13 +1105,12 @@ glusterBlockCreateRemoteAsync(blockServerDefPtr list,
 
  out:
   GB_FREE(args);
-  GB_FREE(tid);
 
   return ret;
 }
 
 
-void *
+void
 glusterBlockDeleteRemote(void *data)
 {
   int ret;
@@ -940,11 +1121,11 @@ glusterBlockDeleteRemote(void *data)
   bool rpc_sent = FALSE;
 
 
-  GB_METAUPDATE_OR_GOTO(lock, args->glfs, dobj.block_name, args->volume,
+  GB_METAUPDATE_OR_GOTO(args->glfs, dobj.block_name, args->volume,
                         ret, errMsg, out, "%s: CLEANUPINPROGRESS\n", args->addr);
 
-  ret = glusterBlockCallRPC_1(args->addr, &dobj, DELETE_SRV, &rpc_sent,
-                              &args->reply);
+  ret = glusterBlockCallBatchedRPC_1(args->addr, &dobj, DELETE_SRV, &rpc_sent,
+                                     &args->reply);
   if (ret) {
     saveret = ret;
     if (!rpc_sent) {
@@ -958,7 +1139,7 @@ glusterBlockDeleteRemote(void *data)
       args->reply = NULL;
     }
 
-    GB_METAUPDATE_OR_GOTO(lock, args->glfs, dobj.block_name, args->volume,
+    GB_METAUPDATE_OR_GOTO(args->glfs, dobj.block_name, args->volume,
                           ret, errMsg, out, "%s: CLEANUPFAIL\n", args->addr);
     LOG("mgmt", GB_LOG_ERROR, "%s for block %s on host %s volume %s",
         FAILED_REMOTE_DELETE, dobj.block_name, args->addr, args->volume);
@@ -966,7 +1147,7 @@ glusterBlockDeleteRemote(void *data)
     ret = saveret;;
     goto out;
   }
-  GB_METAUPDATE_OR_GOTO(lock, args->glfs, dobj.block_name, args->volume,
+  GB_METAUPDATE_OR_GOTO(args->glfs, dobj.block_name, args->volume,
                         ret, errMsg, out, "%s: CLEANUPSUCCESS\n", args->addr);
 
  out:
@@ -978,8 +1159,6 @@ glusterBlockDeleteRemote(void *data)
   }
   GB_FREE(errMsg);
   args->exit = ret;
-
-  return NULL;
 }
 
 
@@ -1059,7 +1238,7 @@ glusterBlockCollectAttemptSuccess(blockRemoteObj *args, size_t count,
 }
 
 
-void *
+void
 glusterBlockDeleteHostConnect(void *data)
 {
   int ret;
@@ -1067,8 +1246,6 @@ glusterBlockDeleteHostConnect(void *data)
 
 
   args->exit = ret = glusterBlockHostConnect(args->addr);
-
-  return NULL;
 }
 
 
@@ -1076,7 +1253,7 @@ static int
 glusterBlockConnectAsync(char *blockname, MetaInfo *info,
                          int count, char **errMsg)
 {
-  pthread_t  *tid = NULL;
+  gbWorkBatch batch = GB_WORK_BATCH_INITIALIZER;
   blockRemoteObj *args = NULL;
   char *notreachable = NULL;
   char *reachable = NULL;
@@ -1086,10 +1263,6 @@ glusterBlockConnectAsync(char *blockname, MetaInfo *info,
   size_t i;
 
 
-  if (GB_ALLOC_N(tid, count) < 0) {
-    goto out;
-  }
-
   if (GB_ALLOC_N(args, count) < 0) {
     goto out;
   }
@@ -1097,12 +1270,9 @@ glusterBlockConnectAsync(char *blockname, MetaInfo *info,
   count = glusterBlockDeleteFillArgs(info, true, args, NULL, NULL);
 
   for (i = 0; i < count; i++) {
-    pthread_create(&tid[i], NULL, glusterBlockDeleteHostConnect, &args[i]);
-  }
-
-  for (i = 0; i < count; i++) {
-    pthread_join(tid[i], NULL);
+    gbWorkBatchSubmit(gbFanoutPool, &batch, glusterBlockDeleteHostConnect, &args[i]);
   }
+  gbWorkBatchWait(&batch);
 
   ret = 0;
   for (i = 0; i < count; i++) {
@@ -1137,7 +1307,6 @@ glusterBlockConnectAsync(char *blockname, MetaInfo *info,
 
  out:
   GB_FREE(args);
-  GB_FREE(tid);
 
   return ret;
 }
@@ -1151,7 +1320,7 @@ glusterBlockDeleteRemoteAsync(MetaInfo *info,
                               bool deleteall,
                               blockRemoteDeleteResp **savereply)
 {
-  pthread_t  *tid = NULL;
+  gbWorkBatch batch = GB_WORK_BATCH_INITIALIZER;
   blockRemoteDeleteResp *local = *savereply;
   blockRemoteObj *args = NULL;
   char *d_attempt = NULL;
@@ -1162,10 +1331,6 @@ glusterBlockDeleteRemoteAsync(MetaInfo *info,
   size_t i;
 
 
-  if (GB_ALLOC_N(tid, count) < 0) {
-    goto out;
-  }
-
   if (GB_ALLOC_N(args, count) < 0) {
     goto out;
   }
@@ -1173,12 +1338,9 @@ glusterBlockDeleteRemoteAsync(MetaInfo *info,
   count = glusterBlockDeleteFillArgs(info, deleteall, args, glfs, dobj);
 
   for (i = 0; i < count; i++) {
-    pthread_create(&tid[i], NULL, glusterBlockDeleteRemote, &args[i]);
-  }
-
-  for (i = 0; i < count; i++) {
-    pthread_join(tid[i], NULL);
+    gbWorkBatchSubmit(gbFanoutPool, &batch, glusterBlockDeleteRemote, &args[i]);
   }
+  gbWorkBatchWait(&batch);
 
   ret = glusterBlockCollectAttemptSuccess(args, count, &d_attempt, &d_success);
   if (ret) {
@@ -1219,13 +1381,12 @@ glusterBlockDeleteRemoteAsync(MetaInfo *info,
   GB_FREE(d_attempt);
   GB_FREE(d_success);
   GB_FREE(args);
-  GB_FREE(tid);
 
   return ret;
 }
 
 
-void *
+void
 glusterBlockModifyRemote(void *data)
 {
   int ret;
@@ -1236,7 +1397,7 @@ glusterBlockModifyRemote(void *data)
   bool rpc_sent = FALSE;
 
 
-  GB_METAUPDATE_OR_GOTO(lock, args->glfs, cobj.block_name, cobj.volume,
+  GB_METAUPDATE_OR_GOTO(args->glfs, cobj.block_name, cobj.volume,
                         ret, errMsg, out, "%s: AUTH%sENFORCEING\n", args->addr,
                         cobj.auth_mode?"":"CLEAR");
 
@@ -1255,7 +1416,7 @@ glusterBlockModifyRemote(void *data)
       args->reply = NULL;
     }
 
-    GB_METAUPDATE_OR_GOTO(lock, args->glfs, cobj.block_name, cobj.volume,
+    GB_METAUPDATE_OR_GOTO(args->glfs, cobj.block_name, cobj.volume,
                           ret, errMsg, out, "%s: AUTH%sENFORCEFAIL\n",
                           args->addr, cobj.auth_mode?"":"CLEAR");
     LOG("mgmt", GB_LOG_ERROR, "%s for block %s on host %s volume %s",
@@ -1265,7 +1426,7 @@ glusterBlockModifyRemote(void *data)
     goto out;
   }
 
-  GB_METAUPDATE_OR_GOTO(lock, args->glfs, cobj.block_name, cobj.volume,
+  GB_METAUPDATE_OR_GOTO(args->glfs, cobj.block_name, cobj.volume,
                         ret, errMsg, out, "%s: AUTH%sENFORCED\n", args->addr,
                         cobj.auth_mode?"":"CLEAR");
 
@@ -1278,8 +1439,6 @@ glusterBlockModifyRemote(void *data)
   }
   GB_FREE(errMsg);
   args->exit = ret;
-
-  return NULL;
 }
 
 static size_t
@@ -1335,7 +1494,7 @@ glusterBlockModifyRemoteAsync(MetaInfo *info,
                               blockRemoteModifyResp **savereply,
                               bool rollback)
 {
-  pthread_t  *tid = NULL;
+  gbWorkBatch batch = GB_WORK_BATCH_INITIALIZER;
   blockRemoteModifyResp *local = *savereply;
   blockRemoteObj *args = NULL;
   int ret = -1;
@@ -1346,10 +1505,6 @@ glusterBlockModifyRemoteAsync(MetaInfo *info,
   /* get all (configured - already auth enforced) node count */
   count = glusterBlockModifyArgsFill(mobj, info, NULL, glfs);
 
-  if (GB_ALLOC_N(tid, count) < 0) {
-    goto out;
-  }
-
   if (GB_ALLOC_N(args, count) < 0) {
     goto out;
   }
@@ -1357,13 +1512,9 @@ glusterBlockModifyRemoteAsync(MetaInfo *info,
   count = glusterBlockModifyArgsFill(mobj, info, args, glfs);
 
   for (i = 0; i < count; i++) {
-    pthread_create(&tid[i], NULL, glusterBlockModifyRemote, &args[i]);
-  }
-
-  for (i = 0; i < count; i++) {
-    /* collect exit code */
-    pthread_join(tid[i], NULL);
+    gbWorkBatchSubmit(gbFanoutPool, &batch, glusterBlockModifyRemote, &args[i]);
   }
+  gbWorkBatchWait(&batch);
 
   if (!rollback) {
     /* collect return */
@@ -1389,7 +1540,6 @@ glusterBlockModifyRemoteAsync(MetaInfo *info,
 
  out:
   GB_FREE(args);
-  GB_FREE(tid);
 
   return ret;
 }
@@ -1540,7 +1690,7 @@ glusterBlockGetListFromInfo(MetaInfo *info)
 }
 
 
-void *
+void
 glusterBlockReplacePortalRemote(void *data)
 {
   int ret;
@@ -1551,7 +1701,7 @@ glusterBlockReplacePortalRemote(void *data)
   bool rpc_sent = FALSE;
 
 
-  GB_METAUPDATE_OR_GOTO(lock, args->glfs, robj.block_name, robj.volume,
+  GB_METAUPDATE_OR_GOTO(args->glfs, robj.block_name, robj.volume,
                         ret, errMsg, out, "%s: RPINPROGRESS\n", args->addr);
 
   ret = glusterBlockCallRPC_1(args->addr, &robj, REPLACE_SRV, &rpc_sent,
@@ -1569,7 +1719,7 @@ glusterBlockReplacePortalRemote(void *data)
       args->reply = NULL;
     }
 
-    GB_METAUPDATE_OR_GOTO(lock, args->glfs, robj.block_name, robj.volume,
+    GB_METAUPDATE_OR_GOTO(args->glfs, robj.block_name, robj.volume,
                           ret, errMsg, out, "%s: RPFAIL\n", args->addr);
     LOG("mgmt", GB_LOG_ERROR, "%s for block %s on host %s volume %s",
         FAILED_REMOTE_CREATE, robj.block_name, args->addr, args->volume);
@@ -1578,7 +1728,7 @@ glusterBlockReplacePortalRemote(void *data)
     goto out;
   }
 
-  GB_METAUPDATE_OR_GOTO(lock, args->glfs, robj.block_name, robj.volume,
+  GB_METAUPDATE_OR_GOTO(args->glfs, robj.block_name, robj.volume,
                         ret, errMsg, out, "%s: RPSUCCESS\n", args->addr);
 
 out:
@@ -1591,7 +1741,6 @@ out:
   args->exit = ret;
 
   GB_FREE (errMsg);
-  return NULL;
 }
 
 
@@ -1647,7 +1796,7 @@ glusterBlockReplaceNodeRemoteAsync(struct glfs *glfs, blockReplaceCli *blk,
                                    char *block, blockRemoteReplaceResp **savereply)
 {
   blockRemoteReplaceResp *reply = NULL;
-  pthread_t  *tid = NULL;
+  gbWorkBatch batch = GB_WORK_BATCH_INITIALIZER;
   blockRemoteObj *args = NULL;
   MetaInfo *info = NULL;
   blockCreate *cobj = NULL;
@@ -1803,13 +1952,9 @@ glusterBlockReplaceNodeRemoteAsync(struct glfs *glfs, blockReplaceCli *blk,
     }
   }
 
-  if (GB_ALLOC_N(tid, info->mpath + 1) < 0) {
-    goto out;
-  }
-
   /* Create */
   if (!cCheck) {
-    pthread_create(&tid[0], NULL, glusterBlockCreateRemote, &args[0]);
+    gbWorkBatchSubmit(gbFanoutPool, &batch, glusterBlockCreateRemote, &args[0]);
   } else {
     reply->cop->status = GB_OP_SKIPPED; /* skip */
     if (GB_STRDUP(reply->cop->skipped, args[0].addr) < 0) {
@@ -1820,7 +1965,8 @@ glusterBlockReplaceNodeRemoteAsync(struct glfs *glfs, blockReplaceCli *blk,
   /* Replace Portal */
   if (rCheck) {
     for (i = 1; i < info->mpath; i++) {
-      pthread_create(&tid[i], NULL, glusterBlockReplacePortalRemote, &args[i]);
+      gbWorkBatchSubmit(gbFanoutPool, &batch, glusterBlockReplacePortalRemote,
+                        &args[i]);
     }
   } else {
     reply->rop->status = GB_OP_SKIPPED; /* skip */
@@ -1837,7 +1983,8 @@ glusterBlockReplaceNodeRemoteAsync(struct glfs *glfs, blockReplaceCli *blk,
 
   /* Delete */
   if (!dCheck) {
-    pthread_create(&tid[info->mpath], NULL, glusterBlockDeleteRemote, &args[info->mpath]);
+    gbWorkBatchSubmit(gbFanoutPool, &batch, glusterBlockDeleteRemote,
+                      &args[info->mpath]);
   } else {
     reply->dop->status = GB_OP_SKIPPED; /* skip */
     if (GB_STRDUP(reply->dop->skipped, args[info->mpath].addr) < 0) {
@@ -1845,17 +1992,7 @@ glusterBlockReplaceNodeRemoteAsync(struct glfs *glfs, blockReplaceCli *blk,
     }
   }
 
-  if (!cCheck) {
-    pthread_join(tid[0], NULL);
-  }
-  if (rCheck) {
-    for (i = 1; i < info->mpath; i++) {
-      pthread_join(tid[i], NULL);
-    }
-  }
-  if (!dCheck) {
-    pthread_join(tid[info->mpath], NULL);
-  }
+  gbWorkBatchWait(&batch);
 
   /* Collect results */
   if (!cCheck) {
@@ -1913,11 +2050,13 @@ glusterBlockReplaceNodeRemoteAsync(struct glfs *glfs, blockReplaceCli *blk,
   ret = 0;
 
  out:
+  /* error paths may leave remote calls in flight, they still use args */
+  gbWorkBatchWait(&batch);
+
   if (!ret) {
     *savereply = reply;
     reply = NULL;
   }
-  GB_FREE(tid);
   GB_FREE(cobj);
   GB_FREE(dobj);
   GB_FREE(robj);
@@ -2166,8 +2305,9 @@ block_replace_cli_1_svc_st(blockReplaceCli *blk, struct svc_req *rqstp)
 {
   blockRemoteReplaceResp *savereply = NULL;
   blockResponse *reply = NULL;
-  struct glfs *glfs;
+  struct glfs *glfs = NULL;
   struct glfs_fd *lkfd = NULL;
+  gbMetaTxn *txn = NULL;
   int errCode = 0;
   char *errMsg = NULL;
   int ret;
@@ -2196,9 +2336,10 @@ block_replace_cli_1_svc_st(blockReplaceCli *blk, struct svc_req *rqstp)
     goto optfail;
   }
 
-  GB_METALOCK_OR_GOTO(lkfd, blk->volume, errCode, errMsg, optfail);
+  GB_BLOCKLOCK_OR_GOTO(lkfd, blk->volume, blk->block_name,
+                       errCode, errMsg, optfail);
 
-  if (glfs_access(glfs, blk->block_name, F_OK)) {
+  if (blockMetaAccess(glfs, blk->block_name)) {
     errCode = errno;
     if (errCode == ENOENT) {
       GB_ASPRINTF(&errMsg, "block %s/%s doesn't exist",
@@ -2215,6 +2356,8 @@ block_replace_cli_1_svc_st(blockReplaceCli *blk, struct svc_req *rqstp)
     goto out;
   }
 
+  txn = blockMetaTxnBegin(glfs, blk->volume, blk->block_name);
+
   ret = blockParseValidServers(glfs, blk->block_name, &errCode, &list,
                                blk->force?blk->old_node:NULL);
   if (ret) {
@@ -2249,21 +2392,28 @@ block_replace_cli_1_svc_st(blockReplaceCli *blk, struct svc_req *rqstp)
     }
   }
   if (savereply && savereply->force && savereply->dop->status) {
-    GB_METAUPDATE_OR_GOTO(lock, glfs,  blk->block_name,  blk->volume,
+    GB_METAUPDATE_OR_GOTO(glfs,  blk->block_name,  blk->volume,
                           errCode, errMsg, out, "%s: CLEANUPSUCCESS\n", blk->old_node);
   }
 
+  /* writes go around the open meta file */
+  blockMetaTxnEnd(txn);
+  txn = NULL;
+  blockMetaCompact(glfs, blk->volume, blk->block_name);
   errCode = 0;
 
   LOG("mgmt", GB_LOG_DEBUG, "replace cli success, volume=%s", blk->volume);
 
  out:
-  GB_METAUNLOCK(lkfd, blk->volume, errCode, errMsg);
+  blockMetaTxnEnd(txn);
+  GB_BLOCKUNLOCK(lkfd, blk->volume, blk->block_name, errCode, errMsg);
   blockReplaceNodeCliFormatResponse(blk, errCode, errMsg, savereply, reply);
   blockServerDefFree(list);
   blockRemoteReplaceRespFree(savereply);
 
 optfail:
+  glusterBlockVolumeRelease(glfs);
+
   return reply;
 }
 
@@ -2274,7 +2424,7 @@ glusterBlockCleanUp(struct glfs *glfs, char *blockname,
 {
   int ret = -1;
   size_t i;
-  static blockDelete dobj;
+  blockDelete dobj = {0};
   size_t cleanupsuccess = 0;
   size_t count = 0;
   MetaInfo *info = NULL;
@@ -2326,17 +2476,17 @@ glusterBlockCleanUp(struct glfs *glfs, char *blockname,
     }
 
     if (forcedel || cleanupsuccess == info->nhosts) {
-      GB_METAUPDATE_OR_GOTO(lock, glfs, blockname, info->volume,
+      GB_METAUPDATE_OR_GOTO(glfs, blockname, info->volume,
                             ret, errMsg, out, "ENTRYDELETE: INPROGRESS\n");
       if (unlink && glusterBlockDeleteEntry(glfs, info->volume, info->gbid)) {
-        GB_METAUPDATE_OR_GOTO(lock, glfs, blockname, info->volume,
+        GB_METAUPDATE_OR_GOTO(glfs, blockname, info->volume,
                               ret, errMsg, out, "ENTRYDELETE: FAIL\n");
         LOG("mgmt", GB_LOG_ERROR, "%s %s for block %s", FAILED_DELETING_FILE,
             info->volume, blockname);
         ret = -1;
         goto out;
       }
-      GB_METAUPDATE_OR_GOTO(lock, glfs, blockname, info->volume,
+      GB_METAUPDATE_OR_GOTO(glfs, blockname, info->volume,
                             ret, errMsg, out, "ENTRYDELETE: SUCCESS\n");
       ret = glusterBlockDeleteMetaFile(glfs, info->volume, blockname);
       if (ret) {
@@ -2365,7 +2515,8 @@ glusterBlockAuditRequest(struct glfs *glfs,
                          blockCreateCli *blk,
                          blockCreate *cobj,
                          blockServerDefPtr list,
-                         blockRemoteCreateResp **reply)
+                         blockRemoteCreateResp **reply,
+                         bool *needcleanup)
 {
   int ret = -1;
   size_t i;
@@ -2375,7 +2526,6 @@ glusterBlockAuditRequest(struct glfs *glfs,
   size_t spare;
   size_t morereq;
   MetaInfo *info;
-  static bool needcleanup = FALSE;   /* partial failure on subset of nodes */
 
 
   if (GB_ALLOC(info) < 0) {
@@ -2416,7 +2566,7 @@ glusterBlockAuditRequest(struct glfs *glfs,
           " on volume %s with given hosts %s",
           blk->block_name, blk->volume, blk->block_hosts);
       glusterBlockCleanUp(glfs, blk->block_name, TRUE, FALSE, TRUE, (*reply)->obj);
-      needcleanup = FALSE;   /* already clean attempted */
+      *needcleanup = FALSE;   /* already clean attempted */
       ret = -1;
       goto out;
     } else if (spare < morereq) {
@@ -2425,7 +2575,7 @@ glusterBlockAuditRequest(struct glfs *glfs,
           " on volume %s with given hosts %s",
           blk->block_name, blk->volume, blk->block_hosts);
       glusterBlockCleanUp(glfs, blk->block_name, TRUE, FALSE, TRUE, (*reply)->obj);
-      needcleanup = FALSE;   /* already clean attempted */
+      *needcleanup = FALSE;   /* already clean attempted */
       ret = -1;
       goto out;
     } else {
@@ -2442,11 +2592,11 @@ glusterBlockAuditRequest(struct glfs *glfs,
             blk->volume, blk->block_hosts);
       }
       /* we could ideally moved this into #CreateRemoteAsync fail {} */
-      needcleanup = TRUE;
+      *needcleanup = TRUE;
     }
   }
 
-  ret = glusterBlockAuditRequest(glfs, blk, cobj, list, reply);
+  ret = glusterBlockAuditRequest(glfs, blk, cobj, list, reply, needcleanup);
   if (ret) {
     LOG("mgmt", GB_LOG_ERROR, "glusterBlockAuditRequest: return %d"
         "volume: %s hosts: %s blockname %s", ret,
@@ -2454,7 +2604,7 @@ glusterBlockAuditRequest(struct glfs *glfs,
   }
 
  out:
-  if (needcleanup) {
+  if (*needcleanup) {
       glusterBlockCleanUp(glfs, blk->block_name, FALSE, FALSE, TRUE, (*reply)->obj);
   }
 
@@ -2590,11 +2740,12 @@ blockResponse *
 block_modify_cli_1_svc_st(blockModifyCli *blk, struct svc_req *rqstp)
 {
   int ret = -1;
-  static blockModify mobj = {0};
-  static blockRemoteModifyResp *savereply = NULL;
-  static blockResponse *reply = NULL;
-  struct glfs *glfs;
+  blockModify mobj = {0};
+  blockRemoteModifyResp *savereply = NULL;
+  blockResponse *reply = NULL;
+  struct glfs *glfs = NULL;
   struct glfs_fd *lkfd = NULL;
+  gbMetaTxn *txn = NULL;
   MetaInfo *info = NULL;
   uuid_t uuid;
   char passwd[UUID_BUF_SIZE];
@@ -2633,9 +2784,10 @@ block_modify_cli_1_svc_st(blockModifyCli *blk, struct svc_req *rqstp)
     goto nolock;
   }
 
-  GB_METALOCK_OR_GOTO(lkfd, blk->volume, ret, errMsg, nolock);
+  GB_BLOCKLOCK_OR_GOTO(lkfd, blk->volume, blk->block_name,
+                       ret, errMsg, nolock);
 
-  if (glfs_access(glfs, blk->block_name, F_OK)) {
+  if (blockMetaAccess(glfs, blk->block_name)) {
     errCode = errno;
     if (errCode == ENOENT) {
       GB_ASPRINTF(&errMsg, "block %s/%s doesn't exist",
@@ -2652,6 +2804,8 @@ block_modify_cli_1_svc_st(blockModifyCli *blk, struct svc_req *rqstp)
     goto out;
   }
 
+  txn = blockMetaTxnBegin(glfs, blk->volume, blk->block_name);
+
   ret = blockGetMetaInfo(glfs, blk->block_name, info, NULL);
   if (ret) {
     goto out;
@@ -2679,7 +2833,7 @@ block_modify_cli_1_svc_st(blockModifyCli *blk, struct svc_req *rqstp)
     if(info->passwd[0] == '\0') {
       uuid_generate(uuid);
       uuid_unparse(uuid, passwd);
-      GB_METAUPDATE_OR_GOTO(lock, glfs, blk->block_name, blk->volume,
+      GB_METAUPDATE_OR_GOTO(glfs, blk->block_name, blk->volume,
                             ret, errMsg, out, "PASSWORD: %s\n", passwd);
       GB_STRCPYSTATIC(mobj.passwd, passwd);
     } else {
@@ -2687,7 +2841,7 @@ block_modify_cli_1_svc_st(blockModifyCli *blk, struct svc_req *rqstp)
     }
     mobj.auth_mode = 1;
   } else {
-    GB_METAUPDATE_OR_GOTO(lock, glfs, blk->block_name, blk->volume,
+    GB_METAUPDATE_OR_GOTO(glfs, blk->block_name, blk->volume,
                           ret, errMsg, out, "PASSWORD: \n");
     mobj.auth_mode = 0;
   }
@@ -2702,7 +2856,7 @@ block_modify_cli_1_svc_st(blockModifyCli *blk, struct svc_req *rqstp)
 
     /* Unwind by removing authentication */
     if (blk->auth_mode) {
-      GB_METAUPDATE_OR_GOTO(lock, glfs, blk->block_name, blk->volume,
+      GB_METAUPDATE_OR_GOTO(glfs, blk->block_name, blk->volume,
                           ret, errMsg, out, "PASSWORD: \n");
     }
 
@@ -2733,18 +2887,19 @@ block_modify_cli_1_svc_st(blockModifyCli *blk, struct svc_req *rqstp)
     }
   }
 
+  /* writes go around the open meta file */
+  blockMetaTxnEnd(txn);
+  txn = NULL;
+  blockMetaCompact(glfs, blk->volume, blk->block_name);
   ret = 0;
 
  out:
-  GB_METAUNLOCK(lkfd, blk->volume, ret, errMsg);
+  blockMetaTxnEnd(txn);
+  GB_BLOCKUNLOCK(lkfd, blk->volume, blk->block_name, ret, errMsg);
   blockServerDefFree(list);
 
  nolock:
-  if (lkfd && glfs_close(lkfd) != 0) {
-    LOG("mgmt", GB_LOG_ERROR,
-        "glfs_close(%s): for block %s on volume %s failed[%s]",
-        GB_TXLOCKFILE, blk->block_name, blk->volume, strerror(errno));
-  }
+  glusterBlockVolumeRelease(glfs);
 
  initfail:
   blockModifyCliFormatResponse (blk, &mobj, asyncret?asyncret:errCode,
@@ -2774,6 +2929,7 @@ blockCreateCliFormatResponse(struct glfs *glfs, blockCreateCli *blk,
   json_object *json_array2 = NULL;
   char         *tmp      = NULL;
   char         *tmp2     = NULL;
+  char         *sptr     = NULL;
   char         *portals  = NULL;
   int          i         = 0;
   int          infoErrCode = 0;
@@ -2849,19 +3005,19 @@ blockCreateCliFormatResponse(struct glfs *glfs, blockCreateCli *blk,
       json_array2 = json_object_new_array();
 
       if (savereply->obj->d_attempt) {
-        tmp = strtok (savereply->obj->d_attempt, " ");
+        tmp = strtok_r (savereply->obj->d_attempt, " ", &sptr);
         while (tmp!= NULL)
         {
           json_object_array_add(json_array2, GB_JSON_OBJ_TO_STR(tmp));
-          tmp = strtok (NULL, " ");
+          tmp = strtok_r (NULL, " ", &sptr);
         }
       }
 
       if (savereply->obj->d_success) {
-        tmp = strtok (savereply->obj->d_success, " ");
+        tmp = strtok_r (savereply->obj->d_success, " ", &sptr);
         while (tmp!= NULL) {
           json_object_array_add(json_array2, GB_JSON_OBJ_TO_STR(tmp));
-          tmp = strtok (NULL, " ");
+          tmp = strtok_r (NULL, " ", &sptr);
         }
       }
       tmp = NULL;
@@ -2937,8 +3093,12 @@ block_create_cli_1_svc_st(blockCreateCli *blk, struct svc_req *rqstp)
   struct blockResponse *reply;
   struct glfs *glfs = NULL;
   struct glfs_fd *lkfd = NULL;
+  gbMetaTxn *txn = NULL;
   blockServerDefPtr list = NULL;
   char *errMsg = NULL;
+  bool needcleanup = FALSE;   /* partial failure on subset of nodes */
+  bool nslocked = FALSE;
+  bool blocklocked = FALSE;
 
 
   LOG("mgmt", GB_LOG_INFO,
@@ -2989,9 +3149,10 @@ block_create_cli_1_svc_st(blockCreateCli *blk, struct svc_req *rqstp)
     goto optfail;
   }
 
-  GB_METALOCK_OR_GOTO(lkfd, blk->volume, errCode, errMsg, out);
+  GB_METALOCK_OR_GOTO(lkfd, blk->volume, errCode, errMsg, optfail);
+  nslocked = TRUE;
 
-  if (!glfs_access(glfs, blk->block_name, F_OK)) {
+  if (!blockMetaAccess(glfs, blk->block_name)) {
     LOG("mgmt", GB_LOG_ERROR,
         "block with name %s already exist in the volume %s",
         blk->block_name, blk->volume);
@@ -3004,22 +3165,32 @@ block_create_cli_1_svc_st(blockCreateCli *blk, struct svc_req *rqstp)
     goto exist;
   }
 
+  GB_BLOCKLOCK_OR_GOTO(lkfd, blk->volume, blk->block_name,
+                       errCode, errMsg, exist);
+  blocklocked = TRUE;
+
+  txn = blockMetaTxnBegin(glfs, blk->volume, blk->block_name);
+
   uuid_generate(uuid);
   uuid_unparse(uuid, gbid);
 
-  GB_METAUPDATE_OR_GOTO(lock, glfs, blk->block_name, blk->volume,
+  GB_METAUPDATE_OR_GOTO(glfs, blk->block_name, blk->volume,
                         errCode, errMsg, exist,
                         "VOLUME: %s\nGBID: %s\n"
                         "HA: %d\nENTRYCREATE: INPROGRESS\n",
                         blk->volume, gbid, blk->mpath);
 
+  /* the name is taken, the rest only concerns this block */
+  GB_METAUNLOCK(lkfd, blk->volume, errCode, errMsg);
+  nslocked = FALSE;
+
   if (glusterBlockCreateEntry(glfs, blk, gbid, &errCode, &errMsg)) {
     LOG("mgmt", GB_LOG_ERROR, "%s volume: %s host: %s",
         FAILED_CREATING_FILE, blk->volume, blk->block_hosts);
     goto exist;
   }
 
-  GB_METAUPDATE_OR_GOTO(lock, glfs, blk->block_name, blk->volume,
+  GB_METAUPDATE_OR_GOTO(glfs, blk->block_name, blk->volume,
                         errCode, errMsg, exist, "SIZE: %zu\nENTRYCREATE: SUCCESS\n", blk->size);
 
   GB_STRCPYSTATIC(cobj.volume, blk->volume);
@@ -3038,7 +3209,7 @@ block_create_cli_1_svc_st(blockCreateCli *blk, struct svc_req *rqstp)
     GB_STRCPYSTATIC(cobj.passwd, passwd);
     cobj.auth_mode = 1;
 
-    GB_METAUPDATE_OR_GOTO(lock, glfs, blk->block_name, blk->volume,
+    GB_METAUPDATE_OR_GOTO(glfs, blk->block_name, blk->volume,
                           errCode, errMsg, exist, "PASSWORD: %s\n", passwd);
   }
 
@@ -3052,7 +3223,8 @@ block_create_cli_1_svc_st(blockCreateCli *blk, struct svc_req *rqstp)
   }
 
   /* Check Point */
-  errCode = glusterBlockAuditRequest(glfs, blk, &cobj, list, &savereply);
+  errCode = glusterBlockAuditRequest(glfs, blk, &cobj, list, &savereply,
+                                     &needcleanup);
   if (errCode) {
     LOG("mgmt", GB_LOG_ERROR, "glusterBlockAuditRequest: return %d"
         "volume: %s hosts: %s blockname %s", errCode,
@@ -3061,18 +3233,17 @@ block_create_cli_1_svc_st(blockCreateCli *blk, struct svc_req *rqstp)
   }
 
  exist:
-  GB_METAUNLOCK(lkfd, blk->volume, errCode, errMsg);
-
- out:
-
-  if (lkfd && glfs_close(lkfd) != 0) {
-    LOG("mgmt", GB_LOG_ERROR, "glfs_close(%s): on volume %s for "
-        "block %s failed[%s]", GB_TXLOCKFILE, blk->volume,
-        blk->block_name, strerror(errno));
+  blockMetaTxnEnd(txn);
+  if (blocklocked) {
+    GB_BLOCKUNLOCK(lkfd, blk->volume, blk->block_name, errCode, errMsg);
+  }
+  if (nslocked) {
+    GB_METAUNLOCK(lkfd, blk->volume, errCode, errMsg);
   }
 
  optfail:
   blockCreateCliFormatResponse(glfs, blk, &cobj, errCode, errMsg, savereply, reply);
+  glusterBlockVolumeRelease(glfs);
   GB_FREE(errMsg);
   blockServerDefFree(list);
   blockCreateParsedRespFree(savereply);
@@ -3207,13 +3378,6 @@ blockValidateCommandOutput(const char *out, int opt, void *data)
                             rblk->ipaddr);
     ret = 0;
     break;
-
-  case REPLACE_GET_PORTAL_TPG_SRV:
-    /* get tpg of the portal */
-    GB_OUT_VALIDATE_OR_GOTO(out, out, "failed to get tpg number for portal : %s",
-                            rblk, rblk->ripaddr, "tpg");
-    ret = 0;
-    break;
   }
 
 out:
@@ -3221,67 +3385,425 @@ out:
 }
 
 
-blockResponse *
-block_replace_1_svc_st(blockReplace *blk, struct svc_req *rqstp)
+/* Runs a targetcli script, on a pooled targetcli when possible, returns all
+ * it printed or NULL */
+static char *
+blockTgcliExec(const char *script)
 {
-  blockResponse *reply = NULL;
-  char *path = NULL;
-  char *exec = NULL;
-  char *tpg;
-
+  char *argv[] = {"targetcli", NULL};
+  char *input = NULL;
+  char *out = NULL;
+  gbRunResult res;
 
-  LOG("mgmt", GB_LOG_INFO,
-      "replace portal request, volume=%s blockname=%s iqn=%s old_portal=%s "
-      "new_portal=%s", blk->volume, blk->block_name, blk->gbid, blk->ripaddr, blk->ipaddr);
 
-  if (GB_ALLOC(reply) < 0) {
-    goto out;
+  if (!glusterBlockTgcliRun(script, &out)) {
+    return out;
   }
-  reply->exit = -1;
 
-  if (GB_ALLOC_N(reply->out, 8192) < 0) {
-    GB_FREE(reply);
-    goto out;
+  if (GB_ASPRINTF(&input, "%s\n", script) == -1) {
+    return NULL;
   }
 
-  if (GB_ASPRINTF(&exec, GB_CHECK_PORTAL, blk->gbid, blk->ipaddr) == -1) {
-    goto out;
+  LOG("mgmt", GB_LOG_DEBUG, "command, %s", script);
+  if (!gbRun(argv, input, GB_RUN_TIMEOUT, &res)) {
+    out = res.out;
+    res.out = NULL;
   }
+  gbRunResultFree(&res);
+  GB_FREE(input);
 
-  if (!gbRunner(exec)) {
-    reply->exit = GB_OP_SKIPPED;
-    snprintf(reply->out, 8192, "remote portal %s already exist", blk->ipaddr);
-    goto out;
-  }
-  GB_FREE(exec);
+  return out;
+}
 
-  if (GB_ASPRINTF(&exec, GB_GET_PORTAL_TPG, blk->gbid,
-        blk->ripaddr, blk->ripaddr) == -1) {
-    goto out;
-  }
 
-  /* get number of tpg's for this target */
-  GB_CMD_EXEC_AND_VALIDATE(exec, reply, blk, blk->volume, REPLACE_GET_PORTAL_TPG_SRV);
-  if (reply->exit) {
-    snprintf(reply->out, 8192, "failed to get portal tpg");
-    goto out;
-  }
+/* Brings the LIO index in line with a change of opt that exited with ret */
+static void
+blockIndexUpdate(operations opt, void *blk, int ret)
+{
+  blockCreate *cblk = blk;
+  blockDelete *dblk = blk;
+  blockReplace *rblk = blk;
+  blockServerDefPtr list;
+
+
+  switch (opt) {
+  case CREATE_SRV:
+  case DELETE_SRV:
+  case REPLACE_SRV:
+    break;
+  default:
+    return;
+  }
+
+  /* don't know how far it got */
+  if (ret) {
+    glusterBlockLioIndexInvalidate();
+    return;
+  }
+
+  switch (opt) {
+  case CREATE_SRV:
+    list = blockServerParse(cblk->block_hosts);
+    if (!list) {
+      glusterBlockLioIndexInvalidate();
+      return;
+    }
+    glusterBlockLioIndexAdd(cblk, list);
+    blockServerDefFree(list);
+    break;
+  case DELETE_SRV:
+    glusterBlockLioIndexDel(dblk->gbid);
+    break;
+  case REPLACE_SRV:
+    glusterBlockLioIndexMovePortal(rblk->gbid, rblk->ripaddr, rblk->ipaddr);
+    break;
+  default:
+    break;
+  }
+}
+
+
+/* Copies out to reply->out, which has to hold 8192 bytes and grows to
+ * take all of out */
+static void
+blockOutputCopy(blockResponse *reply, const char *out)
+{
+  size_t len = out ? strlen(out) : 0;
+
+
+  if (len >= 8192 && GB_REALLOC_N(reply->out, len + 1) < 0) {
+    len = 8191;
+  }
+  snprintf(reply->out, len + 1, "%s", out?out:"");
+  LOG("mgmt", GB_LOG_DEBUG, "raw output, %s", reply->out);
+}
+
+
+/* blockOutputCopy(), validating out as the output of opt */
+static void
+blockOutputValidate(blockResponse *reply, const char *out, operations opt,
+                    void *blk)
+{
+  blockOutputCopy(reply, out);
+
+  reply->exit = blockValidateCommandOutput(reply->out, opt, blk);
+  LOG("mgmt", GB_LOG_INFO, "command exit code, %d", reply->exit);
+
+  blockIndexUpdate(opt, blk, reply->exit);
+}
+
+
+static int
+blockSaveConfigRun(void)
+{
+  char *out;
+  int ret = -1;
+
+
+  out = blockTgcliExec(GB_TGCLI_SAVE);
+  if (out && strstr(out, "Configuration saved")) {
+    ret = 0;
+  } else {
+    LOG("mgmt", GB_LOG_ERROR, "targetcli %s failed: %s",
+        GB_TGCLI_SAVE, out?out:"");
+  }
+  GB_FREE(out);
+
+  return ret;
+}
+
+
+/* Persists the running LIO config, with every change made before the call.
+ * saveconfig rewrites the whole saveconfig.json, so changes done within
+ * GB_SAVE_WINDOW_MS of each other, or while a save runs, share one. */
+static int
+blockSaveConfig(void)
+{
+  struct timespec window = {0, GB_SAVE_WINDOW_MS * 1000000};
+  unsigned long mine;
+  unsigned long upto;
+  int ret;
+
+
+  LOCK(saveLock);
+  mine = ++saveQueued;
+  while (saveDone < mine) {
+    if (saveRunning) {
+      pthread_cond_wait(&saveCond, &saveLock);
+      continue;
+    }
+
+    /* lead the next save */
+    saveRunning = true;
+    UNLOCK(saveLock);
+
+    nanosleep(&window, NULL);
+
+    LOCK(saveLock);
+    upto = saveQueued;
+    UNLOCK(saveLock);
+
+    ret = blockSaveConfigRun();
+
+    LOCK(saveLock);
+    saveDone = upto;
+    if (!ret) {
+      saveOkUpto = upto;
+    }
+    saveRunning = false;
+    pthread_cond_broadcast(&saveCond);
+  }
+
+  /* every save writes out all of the running config, so a change is
+   * saved once any save from the one covering it on went through, no
+   * matter how the saves after that one did */
+  ret = (saveOkUpto >= mine) ? 0 : -1;
+  UNLOCK(saveLock);
+
+  return ret;
+}
+
+
+/* blockOutputValidate() for a change, which is saved once it validates */
+static void
+blockValidateAndSave(blockResponse *reply, const char *out, operations opt,
+                     void *blk)
+{
+  blockOutputValidate(reply, out, opt, blk);
+  if (!reply->exit && blockSaveConfig()) {
+    reply->exit = -1;
+  }
+}
+
+
+/* configfs counterpart of blockValidateAndSave(), ret of the backend
+ * call tells how it went and out is only passed on */
+static void
+blockLioFinish(blockResponse *reply, int ret, const char *out,
+               operations opt, void *blk)
+{
+  blockOutputCopy(reply, out);
+
+  reply->exit = ret ? -1 : 0;
+  LOG("mgmt", GB_LOG_INFO, "configfs exit code, %d", reply->exit);
+
+  blockIndexUpdate(opt, blk, reply->exit);
+  if (!reply->exit && blockSaveConfig()) {
+    reply->exit = -1;
+  }
+}
+
+
+static void
+blockTgcliValidate(blockResponse *reply, const char *script, operations opt,
+                   void *blk)
+{
+  char *out = blockTgcliExec(script);
+
+
+  blockValidateAndSave(reply, out, opt, blk);
+  GB_FREE(out);
+}
+
+
+/* Whether the user:glfs ls lists block name backed by file gbid */
+static bool
+blockTgcliLsHas(const char *ls, const char *block_name, const char *gbid)
+{
+  char name[512];
+  char file[512];
+  char *copy = NULL;
+  char *line;
+  char *sptr = NULL;
+  bool found = false;
+
+
+  snprintf(name, sizeof(name), " %s ", block_name);
+  snprintf(file, sizeof(file), "/%s ", gbid);
+
+  if (GB_STRDUP(copy, ls) < 0) {
+    /* let the delete itself tell */
+    return true;
+  }
+
+  line = strtok_r(copy, "\n", &sptr);
+  while (line) {
+    if (strstr(line, name) && strstr(line, file)) {
+      found = true;
+      break;
+    }
+    line = strtok_r(NULL, "\n", &sptr);
+  }
+
+  GB_FREE(copy);
+  return found;
+}
+
+
+/* 1 if block name with file gbid is configured on this node, 0 if it
+ * isn't, -1 if that can't be told */
+static int
+blockTargetExists(const char *name, const char *gbid)
+{
+  char *ls;
+  int ret;
+
+
+  ret = glusterBlockLioIndexHas(name, gbid);
+  if (ret != -1 || gbLioBackendType == GB_LIO_CONFIGFS) {
+    return ret;
+  }
+
+  ls = blockTgcliExec(GB_TGCLI_GLFS_PATH " ls");
+  if (ls) {
+    ret = blockTgcliLsHas(ls, name, gbid);
+  }
+  GB_FREE(ls);
+
+  return ret;
+}
+
+
+/* Whether the ls of a target has a portal on addr, and if so, the name of
+ * the tpg it is on */
+static bool
+blockTgcliLsPortal(const char *ls, const char *addr, char *tpg, size_t len)
+{
+  char portal[256];
+  char name[32] = {0, };
+  char entry[32];
+  char *copy = NULL;
+  char *line;
+  char *sptr = NULL;
+  bool found = false;
+
+
+  snprintf(portal, sizeof(portal), " %s:3260 ", addr);
+
+  if (GB_STRDUP(copy, ls) < 0) {
+    return false;
+  }
+
+  /* o- tpg1 ... the portals of which are listed below it */
+  line = strtok_r(copy, "\n", &sptr);
+  while (line) {
+    if (sscanf(line, " o- %31s", entry) == 1 && !strncmp(entry, "tpg", 3)) {
+      GB_STRCPYSTATIC(name, entry);
+    }
+    if (strstr(line, portal)) {
+      found = true;
+      break;
+    }
+    line = strtok_r(NULL, "\n", &sptr);
+  }
+
+  if (found && tpg) {
+    snprintf(tpg, len, "%s", name);
+  }
+
+  GB_FREE(copy);
+  return found;
+}
+
+
+/* 1 if the target of gbid has a portal on addr, with the name of the tpg
+ * it is on in tpg, 0 if it hasn't, -1 if that can't be told */
+static int
+blockPortalTpg(const char *gbid, const char *addr, char *tpg, size_t len)
+{
+  char *exec = NULL;
+  char *ls;
+  size_t tpgt;
+  int ret;
+
+
+  ret = glusterBlockLioIndexPortal(gbid, addr, &tpgt);
+  if (ret == 1 && tpg) {
+    snprintf(tpg, len, "tpg%zu", tpgt);
+  }
+  if (ret != -1 || gbLioBackendType == GB_LIO_CONFIGFS) {
+    return ret;
+  }
+
+  if (GB_ASPRINTF(&exec, "%s/%s%s ls", GB_TGCLI_ISCSI_PATH,
+                  GB_TGCLI_IQN_PREFIX, gbid) == -1) {
+    return -1;
+  }
+  ls = blockTgcliExec(exec);
   GB_FREE(exec);
-  tpg = strtok(reply->out, "\n");
+  if (!ls) {
+    return -1;
+  }
+
+  ret = blockTgcliLsPortal(ls, addr, tpg, len);
+  GB_FREE(ls);
+
+  return ret;
+}
+
+
+blockResponse *
+block_replace_1_svc_st(blockReplace *blk, struct svc_req *rqstp)
+{
+  blockResponse *reply = NULL;
+  char *path = NULL;
+  char *exec = NULL;
+  char tpg[32];
+  char *out = NULL;
+  int ret;
+
+
+  LOG("mgmt", GB_LOG_INFO,
+      "replace portal request, volume=%s blockname=%s iqn=%s old_portal=%s "
+      "new_portal=%s", blk->volume, blk->block_name, blk->gbid, blk->ripaddr, blk->ipaddr);
+
+  if (GB_ALLOC(reply) < 0) {
+    goto out;
+  }
+  reply->exit = -1;
+
+  if (GB_ALLOC_N(reply->out, 8192) < 0) {
+    GB_FREE(reply);
+    goto out;
+  }
+
+  if (blockPortalTpg(blk->gbid, blk->ipaddr, NULL, 0) == 1) {
+    reply->exit = GB_OP_SKIPPED;
+    snprintf(reply->out, 8192, "remote portal %s already exist", blk->ipaddr);
+    goto out;
+  }
+
+  if (gbLioBackendType == GB_LIO_CONFIGFS) {
+    ret = glusterBlockLioReplacePortal(blk, &out);
+    blockLioFinish(reply, ret, out, REPLACE_SRV, blk);
+    if (reply->exit) {
+      snprintf(reply->out, 8192, "replace portal failed");
+    }
+    goto out;
+  }
+
+  /* the tpg the old portal is on */
+  tpg[0] = '\0';
+  if (blockPortalTpg(blk->gbid, blk->ripaddr, tpg, sizeof(tpg)) != 1 ||
+      !tpg[0]) {
+    LOG("mgmt", GB_LOG_ERROR, "failed to get tpg number for portal : %s",
+        blk->ripaddr);
+    snprintf(reply->out, 8192, "failed to get portal tpg");
+    goto out;
+  }
 
   if (GB_ASPRINTF(&path, "%s/%s%s/%s/portals", GB_TGCLI_ISCSI_PATH,
                   GB_TGCLI_IQN_PREFIX, blk->gbid, tpg) == -1) {
     goto out;
   }
 
-  if (GB_ASPRINTF(&exec,
-                  "targetcli <<EOF\n%s delete %s ip_port=3260\n%s create %s\n%s\nEOF",
-                  path, blk->ripaddr, path, blk->ipaddr, GB_TGCLI_SAVE) == -1) {
+  if (GB_ASPRINTF(&exec, "%s delete %s ip_port=3260\n%s create %s",
+                  path, blk->ripaddr, path, blk->ipaddr) == -1) {
     goto out;
   }
   GB_FREE(path);
 
-  GB_CMD_EXEC_AND_VALIDATE(exec, reply, blk, blk->volume, REPLACE_SRV);
+  blockTgcliValidate(reply, exec, REPLACE_SRV, blk);
   if (reply->exit) {
     snprintf(reply->out, 8192, "replace portal failed");
     goto out;
@@ -3291,12 +3813,14 @@ block_replace_1_svc_st(blockReplace *blk, struct svc_req *rqstp)
 out:
   GB_FREE(path);
   GB_FREE(exec);
+  GB_FREE(out);
   return reply;
 }
 
 
-blockResponse *
-block_create_1_svc_st(blockCreate *blk, struct svc_req *rqstp)
+/* targetcli commands configuring blk on this node, without saveconfig */
+static char *
+blockCreateTgcliCmds(blockCreate *blk)
 {
   char *tmp = NULL;
   char *backstore = NULL;
@@ -3308,21 +3832,11 @@ block_create_1_svc_st(blockCreate *blk, struct svc_req *rqstp)
   char *attr = NULL;
   char *authcred = NULL;
   char *exec = NULL;
-  blockResponse *reply = NULL;
+  char *cmds = NULL;
   blockServerDefPtr list = NULL;
   size_t i;
 
 
-  LOG("mgmt", GB_LOG_INFO,
-      "create request, volume=%s blockname=%s blockhosts=%s filename=%s authmode=%d "
-      "passwd=%s size=%lu", blk->volume, blk->block_name, blk->block_hosts,
-      blk->gbid, blk->auth_mode, blk->auth_mode?blk->passwd:"", blk->size);
-
-  if (GB_ALLOC(reply) < 0) {
-    goto out;
-  }
-  reply->exit = -1;
-
   if (GB_ASPRINTF(&backstore, "%s %s %s %zu %s@%s%s/%s %s", GB_TGCLI_GLFS_PATH,
                   GB_CREATE, blk->block_name, blk->size, blk->volume,
                   blk->ipaddr, GB_STOREDIR, blk->gbid, blk->gbid) == -1) {
@@ -3422,23 +3936,11 @@ block_create_1_svc_st(blockCreate *blk, struct svc_req *rqstp)
     GB_FREE(lun);
   }
 
-  if (GB_ASPRINTF(&exec, "targetcli <<EOF\n%s\n%s\nEOF", tmp, GB_TGCLI_SAVE) == -1) {
-    goto out;
-  }
-  GB_FREE(tmp);
-
-  if (GB_ALLOC_N(reply->out, 8192) < 0) {
-    GB_FREE(reply);
-    goto out;
-  }
-
-  GB_CMD_EXEC_AND_VALIDATE(exec, reply, blk, blk->volume, CREATE_SRV);
-  if (reply->exit) {
-    snprintf(reply->out, 8192, "configure failed");
-  }
+  cmds = tmp;
+  tmp = NULL;
 
  out:
-  GB_FREE(exec);
+  GB_FREE(tmp);
   GB_FREE(authcred);
   GB_FREE(attr);
   GB_FREE(portal);
@@ -3449,33 +3951,108 @@ block_create_1_svc_st(blockCreate *blk, struct svc_req *rqstp)
   GB_FREE(backstore_attr);
   blockServerDefFree(list);
 
-  return reply;
+  return cmds;
 }
 
-void
-blockDeleteCliFormatResponse(blockDeleteCli *blk, int errCode, char *errMsg,
-                             blockRemoteDeleteResp *savereply,
-                             struct blockResponse *reply)
+
+/* configfs counterpart of blockCreateTgcliCmds(), without saveconfig too */
+static int
+blockLioCreate(blockCreate *blk, char **out)
 {
-  json_object *json_obj = NULL;
-  json_object *json_array1 = NULL;
-  json_object *json_array2 = NULL;
-  char *tmp = NULL;
+  blockServerDefPtr list = NULL;
+  int ret;
 
-  if (!reply) {
-    return;
-  }
 
-  if (errCode < 0) {
-    errCode = GB_DEFAULT_ERRCODE;
+  list = blockServerParse(blk->block_hosts);
+  if (!list) {
+    return -1;
   }
 
-  reply->exit = errCode;
+  ret = glusterBlockLioCreate(blk, list, out);
+  blockServerDefFree(list);
 
-  if (errMsg) {
-    blockFormatErrorResponse(DELETE_SRV, blk->json_resp, errCode,
-                             errMsg, reply);
-    return;
+  return ret;
+}
+
+
+blockResponse *
+block_create_1_svc_st(blockCreate *blk, struct svc_req *rqstp)
+{
+  char *cmds = NULL;
+  char *exec = NULL;
+  blockResponse *reply = NULL;
+  int ret;
+
+
+  LOG("mgmt", GB_LOG_INFO,
+      "create request, volume=%s blockname=%s blockhosts=%s filename=%s authmode=%d "
+      "passwd=%s size=%lu", blk->volume, blk->block_name, blk->block_hosts,
+      blk->gbid, blk->auth_mode, blk->auth_mode?blk->passwd:"", blk->size);
+
+  if (GB_ALLOC(reply) < 0) {
+    goto out;
+  }
+  reply->exit = -1;
+
+  if (gbLioBackendType == GB_LIO_CONFIGFS) {
+    if (GB_ALLOC_N(reply->out, 8192) < 0) {
+      GB_FREE(reply);
+      goto out;
+    }
+
+    ret = blockLioCreate(blk, &cmds);
+    blockLioFinish(reply, ret, cmds, CREATE_SRV, blk);
+    if (reply->exit) {
+      snprintf(reply->out, 8192, "configure failed");
+    }
+    goto out;
+  }
+
+  if (!(cmds = blockCreateTgcliCmds(blk))) {
+    goto out;
+  }
+
+  if (GB_ALLOC_N(reply->out, 8192) < 0) {
+    GB_FREE(reply);
+    goto out;
+  }
+
+  blockTgcliValidate(reply, cmds, CREATE_SRV, blk);
+  if (reply->exit) {
+    snprintf(reply->out, 8192, "configure failed");
+  }
+
+ out:
+  GB_FREE(exec);
+  GB_FREE(cmds);
+
+  return reply;
+}
+
+void
+blockDeleteCliFormatResponse(blockDeleteCli *blk, int errCode, char *errMsg,
+                             blockRemoteDeleteResp *savereply,
+                             struct blockResponse *reply)
+{
+  json_object *json_obj = NULL;
+  json_object *json_array1 = NULL;
+  json_object *json_array2 = NULL;
+  char *tmp = NULL;
+
+  if (!reply) {
+    return;
+  }
+
+  if (errCode < 0) {
+    errCode = GB_DEFAULT_ERRCODE;
+  }
+
+  reply->exit = errCode;
+
+  if (errMsg) {
+    blockFormatErrorResponse(DELETE_SRV, blk->json_resp, errCode,
+                             errMsg, reply);
+    return;
   }
 
   if (blk->json_resp) {
@@ -3518,201 +4095,583 @@ blockDeleteCliFormatResponse(blockDeleteCli *blk, int errCode, char *errMsg,
     blockFormatErrorResponse(DELETE_SRV, blk->json_resp, errCode,
                              GB_DEFAULT_ERRMSG, reply);
   }
-
-  GB_FREE (tmp);
-  return;
+
+  GB_FREE (tmp);
+  return;
+}
+
+blockResponse *
+block_delete_cli_1_svc_st(blockDeleteCli *blk, struct svc_req *rqstp)
+{
+  blockRemoteDeleteResp *savereply = NULL;
+  MetaInfo *info = NULL;
+  blockResponse *reply = NULL;
+  struct glfs *glfs = NULL;
+  struct glfs_fd *lkfd = NULL;
+  gbMetaTxn *txn = NULL;
+  char *errMsg = NULL;
+  int errCode = 0;
+  int ret;
+  blockServerDefPtr list = NULL;
+  size_t i;
+
+
+  LOG("mgmt", GB_LOG_INFO, "delete cli request, volume=%s blockname=%s",
+                           blk->volume, blk->block_name);
+
+  if (GB_ALLOC(reply) < 0) {
+    return NULL;
+  }
+
+  if (GB_ALLOC(savereply) < 0) {
+    GB_FREE(reply);
+    return NULL;
+  }
+
+  glfs = glusterBlockVolumeInit(blk->volume, &errCode, &errMsg);
+  if (!glfs) {
+    LOG("mgmt", GB_LOG_ERROR,
+        "glusterBlockVolumeInit(%s) for block %s failed",
+        blk->volume, blk->block_name);
+    goto optfail;
+  }
+
+  lkfd = glusterBlockCreateMetaLockFile(glfs, blk->volume, &errCode, &errMsg);
+  if (!lkfd) {
+    LOG("mgmt", GB_LOG_ERROR, "%s %s for block %s",
+        FAILED_CREATING_META, blk->volume, blk->block_name);
+    goto optfail;
+  }
+
+  GB_BLOCKLOCK_OR_GOTO(lkfd, blk->volume, blk->block_name,
+                       errCode, errMsg, optfail);
+
+  if (blockMetaAccess(glfs, blk->block_name)) {
+    errCode = errno;
+    if (errCode == ENOENT) {
+      GB_ASPRINTF(&errMsg, "block %s/%s doesn't exist",
+                  blk->volume, blk->block_name);
+      LOG("mgmt", GB_LOG_ERROR,
+          "block with name %s doesn't exist in the volume %s",
+          blk->block_name, blk->volume);
+    } else {
+      GB_ASPRINTF(&errMsg, "block %s/%s is not accessible (%s)",
+                  blk->volume, blk->block_name, strerror(errCode));
+      LOG("mgmt", GB_LOG_ERROR, "block %s/%s is not accessible (%s)",
+          blk->volume, blk->block_name, strerror(errCode));
+    }
+    goto out;
+  }
+
+  txn = blockMetaTxnBegin(glfs, blk->volume, blk->block_name);
+
+  if (!blk->force) {
+    if (GB_ALLOC(info) < 0) {
+      goto out;
+    }
+
+    ret = blockGetMetaInfo(glfs, blk->block_name, info, NULL);
+    if (ret) {
+      goto out;
+    }
+
+    ret = glusterBlockConnectAsync(blk->block_name, info,
+                                   glusterBlockDeleteFillArgs(info, true, NULL, NULL, NULL),
+                                   &errMsg);
+    if (ret) {
+      goto out;
+    }
+  }
+
+  list = glusterBlockGetListFromInfo(info);
+  if (!list) {
+    errCode = ENOMEM;
+    goto out;
+  }
+
+  errCode = glusterBlockCheckCapabilities((void *)blk, DELETE_SRV, list, &errMsg);
+  if (errCode) {
+    LOG("mgmt", GB_LOG_ERROR,
+        "glusterBlockCheckCapabilities() for block %s on volume %s failed",
+        blk->block_name, blk->volume);
+    goto out;
+  }
+
+  errCode = glusterBlockCleanUp(glfs, blk->block_name, TRUE, TRUE, blk->unlink, savereply);
+  if (errCode) {
+    LOG("mgmt", GB_LOG_WARNING, "glusterBlockCleanUp: return %d "
+        "on block %s for volume %s", errCode, blk->block_name, blk->volume);
+  }
+
+ out:
+  blockMetaTxnEnd(txn);
+  GB_BLOCKUNLOCK(lkfd, blk->volume, blk->block_name, errCode, errMsg);
+  blockServerDefFree(list);
+  GB_FREE(info);
+
+ optfail:
+  glusterBlockVolumeRelease(glfs);
+
+  blockDeleteCliFormatResponse(blk, errCode, errMsg, savereply, reply);
+
+  if (savereply) {
+    GB_FREE(savereply->d_attempt);
+    GB_FREE(savereply->d_success);
+    GB_FREE(savereply);
+  }
+
+  return reply;
+}
+
+
+blockResponse *
+block_delete_1_svc_st(blockDelete *blk, struct svc_req *rqstp)
+{
+  int ret;
+  char *iqn = NULL;
+  char *backstore = NULL;
+  char *exec = NULL;
+  blockResponse *reply = NULL;
+
+
+  LOG("mgmt", GB_LOG_INFO,
+      "delete request, blockname=%s filename=%s", blk->block_name, blk->gbid);
+
+  if (GB_ALLOC(reply) < 0) {
+    goto out;
+  }
+  reply->exit = -1;
+
+  /* Check if block exist on this node ? */
+  ret = blockTargetExists(blk->block_name, blk->gbid);
+  if (ret == -1) {
+    GB_ASPRINTF(&reply->out, "command exit abnormally for %s", blk->block_name);
+    goto out;
+  } else if (!ret) {
+    LOG("mgmt", GB_LOG_WARNING,
+        "block backend with name '%s' doesn't exist with matching gbid %s",
+        blk->block_name, blk->gbid);
+    reply->exit = 0;
+    GB_ASPRINTF(&reply->out, "No %s.", blk->block_name);
+    goto out;
+  }
+
+  if (gbLioBackendType == GB_LIO_CONFIGFS) {
+    if (GB_ALLOC_N(reply->out, 8192) < 0) {
+      GB_FREE(reply);
+      goto out;
+    }
+
+    ret = glusterBlockLioDelete(blk, &exec);
+    blockLioFinish(reply, ret, exec, DELETE_SRV, blk);
+    if (reply->exit) {
+      snprintf(reply->out, 8192, "delete failed");
+    }
+    goto out;
+  }
+
+  if (GB_ASPRINTF(&iqn, "%s %s %s%s", GB_TGCLI_ISCSI_PATH, GB_DELETE,
+                  GB_TGCLI_IQN_PREFIX, blk->gbid) == -1) {
+    goto out;
+  }
+
+  if (GB_ASPRINTF(&backstore, "%s %s %s", GB_TGCLI_GLFS_PATH,
+                  GB_DELETE, blk->block_name) == -1) {
+    goto out;
+  }
+
+  if (GB_ASPRINTF(&exec, "%s\n%s", backstore, iqn) == -1) {
+    goto out;
+  }
+
+  if (GB_ALLOC_N(reply->out, 8192) < 0) {
+    GB_FREE(reply);
+    goto out;
+  }
+
+  blockTgcliValidate(reply, exec, DELETE_SRV, blk);
+  if (reply->exit) {
+    snprintf(reply->out, 8192, "delete failed");
+  }
+
+ out:
+  GB_FREE(exec);
+  GB_FREE(backstore);
+  GB_FREE(iqn);
+
+  return reply;
+}
+
+
+/* One targetcli pass covers all blocks of a batch, so its output is split
+ * at the first line each block prints (marks[i], NULL for blocks left out
+ * of the pass) and each part is validated on its own. */
+static void
+blockBatchCollect(char *out, operations opt, void **blks, char **marks,
+                  size_t count, blockResponse *results, const char *errStr)
+{
+  char **start = NULL;
+  char *end;
+  size_t i, j;
+
+
+  if (GB_ALLOC_N(start, count) < 0) {
+    return;
+  }
+
+  for (i = 0; i < count; i++) {
+    if (marks[i]) {
+      start[i] = strstr(out, marks[i]);
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    if (!marks[i]) {
+      continue;
+    }
+
+    if (start[i]) {
+      end = out + strlen(out);
+      for (j = 0; j < count; j++) {
+        if (start[j] > start[i] && start[j] < end) {
+          end = start[j];
+        }
+      }
+      if (GB_ALLOC_N(results[i].out, end - start[i] + 1) < 0) {
+        continue;
+      }
+      memcpy(results[i].out, start[i], end - start[i]);
+      results[i].exit = blockValidateCommandOutput(results[i].out, opt,
+                                                   blks[i]);
+    }
+    LOG("mgmt", GB_LOG_INFO, "command exit code, %d (batch entry %zu)",
+        results[i].exit, i);
+    blockIndexUpdate(opt, blks[i], results[i].exit);
+
+    if (results[i].exit) {
+      GB_FREE(results[i].out);
+      GB_STRDUP(results[i].out, errStr);
+    }
+  }
+
+  GB_FREE(start);
+}
+
+
+static void
+blockBatchMarksFree(char **marks, size_t count)
+{
+  size_t i;
+
+
+  for (i = 0; marks && i < count; i++) {
+    GB_FREE(marks[i]);
+  }
+  GB_FREE(marks);
+}
+
+
+static blockBatchResponse *
+blockBatchResponseAlloc(size_t count, void ***blks, char ***marks)
+{
+  blockBatchResponse *reply = NULL;
+  size_t i;
+
+
+  *blks = NULL;
+  *marks = NULL;
+
+  if (GB_ALLOC(reply) < 0) {
+    return NULL;
+  }
+
+  if (GB_ALLOC_N(reply->results.results_val, count) < 0 ||
+      GB_ALLOC_N(*blks, count) < 0 || GB_ALLOC_N(*marks, count) < 0) {
+    blockBatchMarksFree(*marks, count);
+    *marks = NULL;
+    GB_FREE(*blks);
+    GB_FREE(reply->results.results_val);
+    GB_FREE(reply);
+    return NULL;
+  }
+  reply->results.results_len = count;
+
+  for (i = 0; i < count; i++) {
+    reply->results.results_val[i].exit = -1;
+  }
+
+  return reply;
+}
+
+
+/* every result needs an out string to be sent */
+static int
+blockBatchResponseFinish(blockBatchResponse **reply, const char *errStr)
+{
+  blockResponse *results = (*reply)->results.results_val;
+  size_t i;
+
+
+  for (i = 0; i < (*reply)->results.results_len; i++) {
+    if (!results[i].out && GB_STRDUP(results[i].out, errStr) < 0) {
+      xdr_free((xdrproc_t)xdr_blockBatchResponse, (char *)*reply);
+      GB_FREE(*reply);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+/* One save covers all blocks of a batch that went through */
+static void
+blockBatchSave(char **marks, size_t count, blockResponse *results,
+               const char *errStr)
+{
+  bool save = false;
+  size_t i;
+
+
+  for (i = 0; i < count; i++) {
+    if (marks[i] && !results[i].exit) {
+      save = true;
+    }
+  }
+
+  if (!save || !blockSaveConfig()) {
+    return;
+  }
+
+  for (i = 0; i < count; i++) {
+    if (marks[i] && !results[i].exit) {
+      results[i].exit = -1;
+      GB_FREE(results[i].out);
+      GB_STRDUP(results[i].out, errStr);
+    }
+  }
+}
+
+
+/* Runs the blocks of a batch picked by marks through configfs, one by one */
+static void
+blockLioBatch(operations opt, void **blks, char **marks, size_t count,
+              blockResponse *results, const char *errStr)
+{
+  char *out = NULL;
+  size_t i;
+  int ret;
+
+
+  for (i = 0; i < count; i++) {
+    if (!marks[i]) {
+      continue;
+    }
+
+    switch (opt) {
+    case CREATE_SRV:
+      ret = blockLioCreate(blks[i], &out);
+      break;
+    case DELETE_SRV:
+      ret = glusterBlockLioDelete(blks[i], &out);
+      break;
+    default:
+      ret = -1;
+      break;
+    }
+    LOG("mgmt", GB_LOG_DEBUG, "raw output, %s", out);
+
+    results[i].exit = ret ? -1 : 0;
+    LOG("mgmt", GB_LOG_INFO, "command exit code, %d (batch entry %zu)",
+        results[i].exit, i);
+    blockIndexUpdate(opt, blks[i], results[i].exit);
+    if (!results[i].exit) {
+      results[i].out = out;
+    } else {
+      GB_FREE(out);
+      GB_STRDUP(results[i].out, errStr);
+    }
+    out = NULL;
+  }
 }
 
-blockResponse *
-block_delete_cli_1_svc_st(blockDeleteCli *blk, struct svc_req *rqstp)
+
+blockBatchResponse *
+block_create_batch_1_svc_st(blockCreateBatch *batch, struct svc_req *rqstp)
 {
-  blockRemoteDeleteResp *savereply = NULL;
-  MetaInfo *info = NULL;
-  static blockResponse *reply = NULL;
-  struct glfs *glfs;
-  struct glfs_fd *lkfd = NULL;
-  char *errMsg = NULL;
-  int errCode = 0;
-  int ret;
-  blockServerDefPtr list = NULL;
+  blockBatchResponse *reply = NULL;
+  blockCreate *blk;
+  size_t count = batch->blocks.blocks_len;
+  void **blks = NULL;
+  char **marks = NULL;
+  char *script = NULL;
+  char *cmds = NULL;
+  char *exec = NULL;
+  char *out = NULL;
+  char *tmp;
   size_t i;
 
 
-  LOG("mgmt", GB_LOG_INFO, "delete cli request, volume=%s blockname=%s",
-                           blk->volume, blk->block_name);
-
-  if (GB_ALLOC(reply) < 0) {
-    return NULL;
-  }
+  LOG("mgmt", GB_LOG_INFO, "create batch request, %zu blocks", count);
 
-  if (GB_ALLOC(savereply) < 0) {
-    GB_FREE(reply);
+  reply = blockBatchResponseAlloc(count, &blks, &marks);
+  if (!reply) {
     return NULL;
   }
 
-  glfs = glusterBlockVolumeInit(blk->volume, &errCode, &errMsg);
-  if (!glfs) {
-    LOG("mgmt", GB_LOG_ERROR,
-        "glusterBlockVolumeInit(%s) for block %s failed",
-        blk->volume, blk->block_name);
-    goto optfail;
-  }
-
-  lkfd = glusterBlockCreateMetaLockFile(glfs, blk->volume, &errCode, &errMsg);
-  if (!lkfd) {
-    LOG("mgmt", GB_LOG_ERROR, "%s %s for block %s",
-        FAILED_CREATING_META, blk->volume, blk->block_name);
-    goto optfail;
-  }
+  for (i = 0; i < count; i++) {
+    blk = &batch->blocks.blocks_val[i];
+    blks[i] = blk;
 
-  GB_METALOCK_OR_GOTO(lkfd, blk->volume, errCode, errMsg, optfail);
+    LOG("mgmt", GB_LOG_INFO,
+        "create request, volume=%s blockname=%s blockhosts=%s filename=%s authmode=%d "
+        "passwd=%s size=%lu", blk->volume, blk->block_name, blk->block_hosts,
+        blk->gbid, blk->auth_mode, blk->auth_mode?blk->passwd:"", blk->size);
 
-  if (glfs_access(glfs, blk->block_name, F_OK)) {
-    errCode = errno;
-    if (errCode == ENOENT) {
-      GB_ASPRINTF(&errMsg, "block %s/%s doesn't exist",
-                  blk->volume, blk->block_name);
-      LOG("mgmt", GB_LOG_ERROR,
-          "block with name %s doesn't exist in the volume %s",
-          blk->block_name, blk->volume);
-    } else {
-      GB_ASPRINTF(&errMsg, "block %s/%s is not accessible (%s)",
-                  blk->volume, blk->block_name, strerror(errCode));
-      LOG("mgmt", GB_LOG_ERROR, "block %s/%s is not accessible (%s)",
-          blk->volume, blk->block_name, strerror(errCode));
+    /* the backend create is the first thing configured for a block */
+    if (GB_ASPRINTF(&marks[i], "Created user-backed storage object %s size %zu.",
+                    blk->block_name, blk->size) == -1) {
+      goto out;
     }
-    goto out;
-  }
 
-  if (!blk->force) {
-    if (GB_ALLOC(info) < 0) {
-      goto out;
+    if (gbLioBackendType == GB_LIO_CONFIGFS) {
+      continue;
     }
 
-    ret = blockGetMetaInfo(glfs, blk->block_name, info, NULL);
-    if (ret) {
+    if (!(cmds = blockCreateTgcliCmds(blk))) {
       goto out;
     }
-
-    ret = glusterBlockConnectAsync(blk->block_name, info,
-                                   glusterBlockDeleteFillArgs(info, true, NULL, NULL, NULL),
-                                   &errMsg);
-    if (ret) {
+    tmp = script;
+    if (GB_ASPRINTF(&script, "%s%s\n", tmp?tmp:"", cmds) == -1) {
+      script = tmp;
       goto out;
     }
+    GB_FREE(tmp);
+    GB_FREE(cmds);
   }
 
-  list = glusterBlockGetListFromInfo(info);
-  if (!list) {
-    errCode = ENOMEM;
-    goto out;
-  }
-
-  errCode = glusterBlockCheckCapabilities((void *)blk, DELETE_SRV, list, &errMsg);
-  if (errCode) {
-    LOG("mgmt", GB_LOG_ERROR,
-        "glusterBlockCheckCapabilities() for block %s on volume %s failed",
-        blk->block_name, blk->volume);
-    goto out;
+  if (gbLioBackendType == GB_LIO_CONFIGFS) {
+    blockLioBatch(CREATE_SRV, blks, marks, count, reply->results.results_val,
+                  "configure failed");
+  } else {
+    out = blockTgcliExec(script);
+    if (out) {
+      blockBatchCollect(out, CREATE_SRV, blks, marks, count,
+                        reply->results.results_val, "configure failed");
+    }
   }
 
-  errCode = glusterBlockCleanUp(glfs, blk->block_name, TRUE, TRUE, blk->unlink, savereply);
-  if (errCode) {
-    LOG("mgmt", GB_LOG_WARNING, "glusterBlockCleanUp: return %d "
-        "on block %s for volume %s", errCode, blk->block_name, blk->volume);
-  }
+  blockBatchSave(marks, count, reply->results.results_val, "configure failed");
 
  out:
-  GB_METAUNLOCK(lkfd, blk->volume, errCode, errMsg);
-  blockServerDefFree(list);
-  GB_FREE(info);
-
- optfail:
-  if (lkfd && glfs_close(lkfd) != 0) {
-    LOG("mgmt", GB_LOG_ERROR,
-        "glfs_close(%s): for block %s on volume %s failed[%s]",
-        GB_TXLOCKFILE, blk->block_name, blk->volume, strerror(errno));
-  }
-
-
-  blockDeleteCliFormatResponse(blk, errCode, errMsg, savereply, reply);
+  blockBatchResponseFinish(&reply, "configure failed");
 
-  if (savereply) {
-    GB_FREE(savereply->d_attempt);
-    GB_FREE(savereply->d_success);
-    GB_FREE(savereply);
-  }
+  blockBatchMarksFree(marks, count);
+  GB_FREE(blks);
+  GB_FREE(script);
+  GB_FREE(cmds);
+  GB_FREE(exec);
+  GB_FREE(out);
 
   return reply;
 }
 
 
-blockResponse *
-block_delete_1_svc_st(blockDelete *blk, struct svc_req *rqstp)
+blockBatchResponse *
+block_delete_batch_1_svc_st(blockDeleteBatch *batch, struct svc_req *rqstp)
 {
-  int ret;
-  char *iqn = NULL;
-  char *backstore = NULL;
+  blockBatchResponse *reply = NULL;
+  blockResponse *results;
+  blockDelete *blk;
+  size_t count = batch->blocks.blocks_len;
+  void **blks = NULL;
+  char **marks = NULL;
+  char *script = NULL;
   char *exec = NULL;
-  blockResponse *reply = NULL;
+  char *out = NULL;
+  char *ls = NULL;
+  char *tmp;
+  int ret;
+  size_t i;
 
 
-  LOG("mgmt", GB_LOG_INFO,
-      "delete request, blockname=%s filename=%s", blk->block_name, blk->gbid);
+  LOG("mgmt", GB_LOG_INFO, "delete batch request, %zu blocks", count);
 
-  if (GB_ALLOC(reply) < 0) {
-    goto out;
+  reply = blockBatchResponseAlloc(count, &blks, &marks);
+  if (!reply) {
+    return NULL;
   }
-  reply->exit = -1;
+  results = reply->results.results_val;
 
-  if (GB_ASPRINTF(&exec, GB_TGCLI_CHECK, blk->block_name, blk->gbid) == -1) {
-    LOG("mgmt", GB_LOG_WARNING,
-        "block backend with name '%s' doesn't exist with matching gbid %s",
-        blk->block_name, blk->gbid);
-    goto out;
-  }
+  for (i = 0; i < count; i++) {
+    blk = &batch->blocks.blocks_val[i];
+    blks[i] = blk;
 
-  /* Check if block exist on this node ? */
-  ret = gbRunner(exec);
-  if (ret == -1) {
-    GB_ASPRINTF(&reply->out, "command exit abnormally for %s", blk->block_name);
-    goto out;
-  } else if (ret == 1) {
-    reply->exit = 0;
-    GB_ASPRINTF(&reply->out, "No %s.", blk->block_name);
-    goto out;
-  }
-  GB_FREE(exec);
+    LOG("mgmt", GB_LOG_INFO,
+        "delete request, blockname=%s filename=%s", blk->block_name, blk->gbid);
 
-  if (GB_ASPRINTF(&iqn, "%s %s %s%s", GB_TGCLI_ISCSI_PATH, GB_DELETE,
-                  GB_TGCLI_IQN_PREFIX, blk->gbid) == -1) {
-    goto out;
-  }
+    ret = glusterBlockLioIndexHas(blk->block_name, blk->gbid);
+    if (ret == -1 && gbLioBackendType != GB_LIO_CONFIGFS) {
+      /* one listing for all blocks, if it comes to that */
+      if (!ls) {
+        ls = blockTgcliExec(GB_TGCLI_GLFS_PATH " ls");
+      }
+      ret = ls ? blockTgcliLsHas(ls, blk->block_name, blk->gbid) : -1;
+    }
 
-  if (GB_ASPRINTF(&backstore, "%s %s %s", GB_TGCLI_GLFS_PATH,
-                  GB_DELETE, blk->block_name) == -1) {
-    goto out;
-  }
+    if (ret == -1) {
+      GB_ASPRINTF(&results[i].out, "command exit abnormally for %s",
+                  blk->block_name);
+      continue;
+    }
 
-  if (GB_ASPRINTF(&exec, "targetcli <<EOF\n%s\n%s\n%s\nEOF", backstore, iqn,
-                  GB_TGCLI_SAVE) == -1) {
-    goto out;
-  }
+    if (!ret) {
+      results[i].exit = 0;
+      GB_ASPRINTF(&results[i].out, "No %s.", blk->block_name);
+      continue;
+    }
 
-  if (GB_ALLOC_N(reply->out, 8192) < 0) {
-    GB_FREE(reply);
-    goto out;
+    if (GB_ASPRINTF(&marks[i], "Deleted storage object %s.",
+                    blk->block_name) == -1) {
+      goto out;
+    }
+
+    if (gbLioBackendType == GB_LIO_CONFIGFS) {
+      continue;
+    }
+
+    tmp = script;
+    if (GB_ASPRINTF(&script, "%s%s %s %s\n%s %s %s%s\n", tmp?tmp:"",
+                    GB_TGCLI_GLFS_PATH, GB_DELETE, blk->block_name,
+                    GB_TGCLI_ISCSI_PATH, GB_DELETE, GB_TGCLI_IQN_PREFIX,
+                    blk->gbid) == -1) {
+      script = tmp;
+      goto out;
+    }
+    GB_FREE(tmp);
   }
 
-  GB_CMD_EXEC_AND_VALIDATE(exec, reply, blk, NULL, DELETE_SRV);
-  if (reply->exit) {
-    snprintf(reply->out, 8192, "delete failed");
+  if (gbLioBackendType == GB_LIO_CONFIGFS) {
+    blockLioBatch(DELETE_SRV, blks, marks, count, results, "delete failed");
+  } else if (script) {
+    out = blockTgcliExec(script);
+    if (out) {
+      blockBatchCollect(out, DELETE_SRV, blks, marks, count, results,
+                        "delete failed");
+    }
   }
 
+  blockBatchSave(marks, count, results, "delete failed");
+
  out:
+  blockBatchResponseFinish(&reply, "delete failed");
+
+  blockBatchMarksFree(marks, count);
+  GB_FREE(blks);
+  GB_FREE(script);
   GB_FREE(exec);
-  GB_FREE(backstore);
-  GB_FREE(iqn);
+  GB_FREE(out);
+  GB_FREE(ls);
 
   return reply;
 }
@@ -3757,27 +4716,31 @@ block_modify_1_svc_st(blockModify *blk, struct svc_req *rqstp)
   }
   reply->exit = -1;
 
-  if (GB_ASPRINTF(&exec, GB_TGCLI_CHECK, blk->block_name, blk->gbid) == -1) {
-    LOG("mgmt", GB_LOG_WARNING,
-        "block backend with name '%s' doesn't exist with matching gbid %s, volume '%s'",
-        blk->block_name, blk->gbid, blk->volume);
-    goto out;
-  }
-
   /* Check if block exist on this node ? */
-  ret = gbRunner(exec);
+  ret = blockTargetExists(blk->block_name, blk->gbid);
   if (ret == -1) {
     GB_ASPRINTF(&reply->out, "command exit abnormally for %s", blk->block_name);
     goto out;
-  } else if (ret == 1) {
+  } else if (!ret) {
+    LOG("mgmt", GB_LOG_WARNING,
+        "block backend with name '%s' doesn't exist with matching gbid %s, volume '%s'",
+        blk->block_name, blk->gbid, blk->volume);
     reply->exit = 0;
     GB_ASPRINTF(&reply->out, "No %s.", blk->block_name);
     goto out;
   }
-  GB_FREE(exec);
 
-  if (GB_ASPRINTF(&exec, "targetcli %s/%s%s status", GB_TGCLI_ISCSI_PATH,
-                  GB_TGCLI_IQN_PREFIX, blk->gbid) == -1) {
+  if (gbLioBackendType == GB_LIO_CONFIGFS) {
+    if (GB_ALLOC_N(reply->out, 8192) < 0) {
+      GB_FREE(reply);
+      goto out;
+    }
+
+    ret = glusterBlockLioModifyAuth(blk, &tmp);
+    blockLioFinish(reply, ret, tmp, MODIFY_SRV, blk);
+    if (reply->exit) {
+      snprintf(reply->out, 8192, "modify failed");
+    }
     goto out;
   }
 
@@ -3787,17 +4750,30 @@ block_modify_1_svc_st(blockModify *blk, struct svc_req *rqstp)
   }
 
   /* get number of tpg's for this target */
-  GB_CMD_EXEC_AND_VALIDATE(exec, reply, blk, blk->volume, MODIFY_TPGC_SRV);
-  if (reply->exit) {
-    snprintf(reply->out, 8192, "modify failed");
-    goto out;
-  }
+  ret = glusterBlockLioIndexTpgs(blk->gbid);
+  if (ret > 0) {
+    tpgs = ret;
+  } else {
+    if (GB_ASPRINTF(&exec, "%s/%s%s status", GB_TGCLI_ISCSI_PATH,
+                    GB_TGCLI_IQN_PREFIX, blk->gbid) == -1) {
+      goto out;
+    }
 
-  /* out looks like, "Status for /iscsi/iqn.abc:xyz: TPGs: 2" */
-  tmp = strrchr(reply->out, ':');
-  if (tmp) {
-    sscanf(tmp+1, "%zu", &tpgs);
-    tmp = NULL;
+    tmp = blockTgcliExec(exec);
+    blockOutputValidate(reply, tmp, MODIFY_TPGC_SRV, blk);
+    GB_FREE(tmp);
+    if (reply->exit) {
+      snprintf(reply->out, 8192, "modify failed");
+      goto out;
+    }
+    GB_FREE(exec);
+
+    /* out looks like, "Status for /iscsi/iqn.abc:xyz: TPGs: 2" */
+    tmp = strrchr(reply->out, ':');
+    if (tmp) {
+      sscanf(tmp+1, "%zu", &tpgs);
+      tmp = NULL;
+    }
   }
 
   for (i = 1; i <= tpgs; i++) {
@@ -3843,11 +4819,7 @@ block_modify_1_svc_st(blockModify *blk, struct svc_req *rqstp)
     }
   }
 
-  if (GB_ASPRINTF(&exec, "targetcli <<EOF\n%s\n%s\nEOF", tmp, GB_TGCLI_SAVE) == -1) {
-    goto out;
-  }
-
-  GB_CMD_EXEC_AND_VALIDATE(exec, reply, blk, blk->volume, MODIFY_SRV);
+  blockTgcliValidate(reply, tmp, MODIFY_SRV, blk);
   if (reply->exit) {
     snprintf(reply->out, 8192, "modify failed");
   }
@@ -3866,19 +4838,23 @@ blockResponse *
 block_list_cli_1_svc_st(blockListCli *blk, struct svc_req *rqstp)
 {
   blockResponse *reply;
-  struct glfs *glfs;
-  struct glfs_fd *lkfd = NULL;
-  struct glfs_fd *tgmdfd = NULL;
-  struct dirent *entry;
-  char *tmp = NULL;
+  struct glfs *glfs = NULL;
+  gbMetaDir *tgmdfd = NULL;
+  const char *name;
   char *filelist = NULL;
+  size_t size = 0;
+  size_t len = 0;
+  size_t nlen;
+  size_t count = 0;
+  unsigned long long pos;
   json_object *json_obj = NULL;
   json_object *json_array = NULL;
   int errCode = 0;
   char *errMsg = NULL;
 
 
-  LOG("mgmt", GB_LOG_DEBUG, "list cli request, volume=%s", blk->volume);
+  LOG("mgmt", GB_LOG_DEBUG, "list cli request, volume=%s offset=%llu "
+      "limit=%u", blk->volume, (unsigned long long)blk->offset, blk->limit);
 
   if (GB_ALLOC(reply) < 0) {
     return NULL;
@@ -3896,15 +4872,10 @@ block_list_cli_1_svc_st(blockListCli *blk, struct svc_req *rqstp)
     goto optfail;
   }
 
-  lkfd = glusterBlockCreateMetaLockFile(glfs, blk->volume, &errCode, &errMsg);
-  if (!lkfd) {
-    LOG("mgmt", GB_LOG_ERROR, "%s %s", FAILED_CREATING_META, blk->volume);
-    goto optfail;
-  }
-
-  GB_METALOCK_OR_GOTO(lkfd, blk->volume, errCode, errMsg, optfail);
+  GB_METARDLOCK_OR_GOTO(glfs, blk->volume, errCode, errMsg, optfail);
 
-  tgmdfd = glfs_opendir (glfs, GB_METADIR);
+  /* offset is a cookie from the reply to the previous page */
+  tgmdfd = blockMetaOpendir(glfs, blk->offset);
   if (!tgmdfd) {
     errCode = errno;
     GB_ASPRINTF (&errMsg, "Not able to open metadata directory for volume "
@@ -3914,24 +4885,29 @@ block_list_cli_1_svc_st(blockListCli *blk, struct svc_req *rqstp)
     goto out;
   }
 
-  while ((entry = glfs_readdir (tgmdfd))) {
-    if (strcmp(entry->d_name, ".") &&
-        strcmp(entry->d_name, "..") &&
-        strcmp(entry->d_name, "meta.lock")) {
-      if (blk->json_resp) {
-        json_object_array_add(json_array,
-                              GB_JSON_OBJ_TO_STR(entry->d_name));
-      } else {
-        if (GB_ASPRINTF(&filelist, "%s%s\n", (tmp==NULL?"":tmp),
-                        entry->d_name)  == -1) {
-          filelist = NULL;
-          GB_FREE(tmp);
+  while ((name = blockMetaReaddir(tgmdfd, &pos))) {
+    if (blk->limit && count == blk->limit) {
+      /* the next page starts with this one */
+      reply->offset = pos;
+      break;
+    }
+    count++;
+
+    if (blk->json_resp) {
+      json_object_array_add(json_array, GB_JSON_OBJ_TO_STR(name));
+    } else {
+      nlen = strlen(name);
+      if (len + nlen + 2 > size) {
+        size = (len + nlen + 2) * 2;
+        if (GB_REALLOC_N(filelist, size) < 0) {
           errCode = ENOMEM;
           goto out;
         }
-        GB_FREE(tmp);
-        tmp = filelist;
       }
+      memcpy(filelist + len, name, nlen);
+      len += nlen;
+      filelist[len++] = '\n';
+      filelist[len] = '\0';
     }
   }
 
@@ -3941,13 +4917,17 @@ block_list_cli_1_svc_st(blockListCli *blk, struct svc_req *rqstp)
 
   if (blk->json_resp) {
     json_object_object_add(json_obj, "blocks", json_array);
+    if (reply->offset) {
+      json_object_object_add(json_obj, "offset",
+                             json_object_new_int64(reply->offset));
+    }
   }
 
  out:
-  GB_METAUNLOCK(lkfd, blk->volume, errCode, errMsg);
+  GB_METARDUNLOCK(blk->volume, errCode, errMsg);
 
  optfail:
-  if (tgmdfd && glfs_closedir (tgmdfd) != 0) {
+  if (tgmdfd && blockMetaClosedir (tgmdfd) != 0) {
     LOG("mgmt", GB_LOG_ERROR, "glfs_closedir(%s): on volume %s failed[%s]",
         GB_METADIR, blk->volume, strerror(errno));
   }
@@ -3984,14 +4964,14 @@ block_list_cli_1_svc_st(blockListCli *blk, struct svc_req *rqstp)
                      "successfully\n");
       }
     } else {
-      reply->out = filelist? filelist:strdup("*Nil*\n");
+      /* later pages of a listing can come out empty, if blocks went away */
+      reply->out = filelist? filelist:strdup(blk->offset?"":"*Nil*\n");
+      filelist = NULL;
     }
   }
 
-  if (lkfd && glfs_close(lkfd) != 0) {
-    LOG("mgmt", GB_LOG_ERROR, "glfs_close(%s): on volume %s failed[%s]",
-        GB_TXLOCKFILE, blk->volume, strerror(errno));
-  }
+  glusterBlockVolumeRelease(glfs);
+  GB_FREE(filelist);
 
   return reply;
 }
@@ -4094,8 +5074,7 @@ blockResponse *
 block_info_cli_1_svc_st(blockInfoCli *blk, struct svc_req *rqstp)
 {
   blockResponse *reply;
-  struct glfs *glfs;
-  struct glfs_fd *lkfd = NULL;
+  struct glfs *glfs = NULL;
   MetaInfo *info = NULL;
   int ret = -1;
   int errCode = 0;
@@ -4119,14 +5098,8 @@ block_info_cli_1_svc_st(blockInfoCli *blk, struct svc_req *rqstp)
     goto optfail;
   }
 
-  lkfd = glusterBlockCreateMetaLockFile(glfs, blk->volume, &errCode, &errMsg);
-  if (!lkfd) {
-    LOG("mgmt", GB_LOG_ERROR, "%s %s for block %s",
-        FAILED_CREATING_META, blk->volume, blk->block_name);
-    goto optfail;
-  }
-
-  GB_METALOCK_OR_GOTO(lkfd, blk->volume, errCode, errMsg, optfail);
+  GB_BLOCKRDLOCK_OR_GOTO(glfs, blk->volume, blk->block_name,
+                         errCode, errMsg, optfail);
 
   ret = blockGetMetaInfo(glfs, blk->block_name, info, &errCode);
   if (ret) {
@@ -4144,15 +5117,10 @@ block_info_cli_1_svc_st(blockInfoCli *blk, struct svc_req *rqstp)
       "info cli success, volume=%s blockname=%s", blk->volume, blk->block_name);
 
  out:
-  GB_METAUNLOCK(lkfd, blk->volume, ret, errMsg);
+  GB_BLOCKRDUNLOCK(blk->volume, blk->block_name, ret, errMsg);
 
  optfail:
-  if (lkfd && glfs_close(lkfd) != 0) {
-    LOG("mgmt", GB_LOG_ERROR,
-        "glfs_close(%s): on volume %s for block %s failed[%s]",
-        GB_TXLOCKFILE, blk->volume, blk->block_name, strerror(errno));
-  }
-
+  glusterBlockVolumeRelease(glfs);
 
   blockInfoCliFormatResponse(blk, errCode, errMsg, info, reply);
   GB_FREE(errMsg);
@@ -4212,6 +5180,40 @@ block_replace_1_svc(blockReplace *blk, blockResponse *reply, struct svc_req *rqs
 }
 
 
+bool_t
+block_create_batch_1_svc(blockCreateBatch *batch, blockBatchResponse *reply,
+                         struct svc_req *rqstp)
+{
+  blockBatchResponse *resp = block_create_batch_1_svc_st(batch, rqstp);
+
+
+  if (!resp) {
+    return false;
+  }
+  memcpy(reply, resp, sizeof(*reply));
+  GB_FREE(resp);
+
+  return true;
+}
+
+
+bool_t
+block_delete_batch_1_svc(blockDeleteBatch *batch, blockBatchResponse *reply,
+                         struct svc_req *rqstp)
+{
+  blockBatchResponse *resp = block_delete_batch_1_svc_st(batch, rqstp);
+
+
+  if (!resp) {
+    return false;
+  }
+  memcpy(reply, resp, sizeof(*reply));
+  GB_FREE(resp);
+
+  return true;
+}
+
+
 bool_t
 block_create_cli_1_svc(blockCreateCli *blk, blockResponse *reply,
                        struct svc_req *rqstp)
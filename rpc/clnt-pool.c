@@ -0,0 +1,370 @@
+/*
+  Copyright (c) 2018 Red Hat, Inc. <http://www.redhat.com>
+  This file is part of gluster-block.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+
+# include  <poll.h>
+# include  <pthread.h>
+# include  <netinet/tcp.h>
+
+# include  "clnt-pool.h"
+# include  "capabilities.h"
+# include  "list.h"
+
+# define   GB_KEEPALIVE_IDLE    60  /* secs */
+# define   GB_KEEPALIVE_INTVL   10  /* secs */
+# define   GB_KEEPALIVE_CNT     3
+
+
+/* Idle CLIENT handles to one peer's gluster-blockd, most recent last,
+ * and what we know about that daemon while the connections last */
+typedef struct gbPeer {
+  char host[255];
+  CLIENT *idle[GB_CLNT_IDLE_MAX];
+  size_t nidle;
+
+  gbCapResp *caps;
+  time_t capsExpiry;
+  u_quad_t bootId;     /* last seen, survives dropping caps */
+
+  struct list_head list;
+} gbPeer;
+
+static LIST_HEAD(peers);
+static pthread_mutex_t peersLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+struct addrinfo *
+glusterBlockGetSockaddr(char *host)
+{
+  int ret;
+  struct addrinfo hints, *res;
+
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  ret = getaddrinfo(host, GB_TCP_PORT_STR, &hints, &res);
+  if (ret) {
+    LOG("mgmt", GB_LOG_ERROR, "getaddrinfo(%s) failed (%s)",
+        host, gai_strerror(ret));
+    goto out;
+  }
+
+  return res;
+
+ out:
+  return NULL;
+}
+
+
+static void
+glusterBlockSetSockOpt(int sockfd, int level, int name, int value,
+                       const char *desc, char *host)
+{
+  if (setsockopt(sockfd, level, name, &value, sizeof(value)) < 0) {
+    LOG("mgmt", GB_LOG_WARNING, "setting %s on connection to %s failed (%s)",
+        desc, host, strerror(errno));
+  }
+}
+
+
+static CLIENT *
+glusterBlockClntCreate(char *host)
+{
+  CLIENT *clnt = NULL;
+  struct addrinfo *res = NULL;
+  int sockfd = -1;
+  int errsv = 0;
+
+
+  if (!(res = glusterBlockGetSockaddr(host))) {
+    goto out;
+  }
+
+  if ((sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) < 0) {
+    errsv = errno;
+    LOG("mgmt", GB_LOG_ERROR, "socket creation failed (%s)",
+        strerror (errno));
+    goto out;
+  }
+
+  /* requests are small and answered one at a time */
+  glusterBlockSetSockOpt(sockfd, IPPROTO_TCP, TCP_NODELAY, 1,
+                         "TCP_NODELAY", host);
+
+  /* notice peers which went away while the connection sat idle */
+  glusterBlockSetSockOpt(sockfd, SOL_SOCKET, SO_KEEPALIVE, 1,
+                         "SO_KEEPALIVE", host);
+  glusterBlockSetSockOpt(sockfd, IPPROTO_TCP, TCP_KEEPIDLE, GB_KEEPALIVE_IDLE,
+                         "TCP_KEEPIDLE", host);
+  glusterBlockSetSockOpt(sockfd, IPPROTO_TCP, TCP_KEEPINTVL, GB_KEEPALIVE_INTVL,
+                         "TCP_KEEPINTVL", host);
+  glusterBlockSetSockOpt(sockfd, IPPROTO_TCP, TCP_KEEPCNT, GB_KEEPALIVE_CNT,
+                         "TCP_KEEPCNT", host);
+
+  if (connect(sockfd, res->ai_addr, res->ai_addrlen) < 0) {
+    errsv = errno;
+    LOG("mgmt", GB_LOG_ERROR, "connect on %s failed (%s)", host,
+        strerror (errno));
+    goto out;
+  }
+
+  clnt = clnttcp_create ((struct sockaddr_in *)res->ai_addr, GLUSTER_BLOCK,
+                         GLUSTER_BLOCK_VERS, &sockfd, 0, 0);
+  if (!clnt) {
+    errsv = errno;
+    LOG("mgmt", GB_LOG_ERROR, "%son inet host %s",
+        clnt_spcreateerror("client create failed"), host);
+    goto out;
+  }
+
+  /* socket is ours, hand it over so clnt_destroy() closes it */
+  clnt_control(clnt, CLSET_FD_CLOSE, NULL);
+  sockfd = -1;
+
+ out:
+  if (sockfd != -1) {
+    close(sockfd);
+  }
+
+  if (res) {
+    freeaddrinfo(res);
+  }
+
+  if (errsv) {
+    errno = errsv;
+  }
+
+  return clnt;
+}
+
+
+/* An idle connection has nothing to read, unless the peer closed it. */
+static bool
+glusterBlockClntIsStale(CLIENT *clnt)
+{
+  struct pollfd pfd = {0, };
+
+
+  if (!clnt_control(clnt, CLGET_FD, (char *)&pfd.fd)) {
+    return true;
+  }
+  pfd.events = POLLIN;
+
+  return poll(&pfd, 1, 0) != 0;
+}
+
+
+static time_t
+glusterBlockNow(void)
+{
+  struct timespec now;
+
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec;
+}
+
+
+static gbPeer *
+glusterBlockPeerLookup(char *host, bool create)
+{
+  gbPeer *peer;
+
+
+  list_for_each_entry(peer, &peers, list) {
+    if (!strcmp(peer->host, host)) {
+      return peer;
+    }
+  }
+
+  if (!create || GB_ALLOC(peer) < 0) {
+    return NULL;
+  }
+  GB_STRCPYSTATIC(peer->host, host);
+  list_add(&peer->list, &peers);
+
+  return peer;
+}
+
+
+/* The daemon may have restarted (possibly upgraded) behind a lost connection */
+static void
+glusterBlockPeerCapsDrop(gbPeer *peer)
+{
+  if (peer && peer->caps) {
+    GB_FREE(peer->caps->response);
+    GB_FREE(peer->caps);
+  }
+}
+
+
+/* Destroys the idle handles the peer has closed, which also tells us
+ * its daemon went away. Called with peersLock held. */
+static void
+glusterBlockPeerPrune(gbPeer *peer)
+{
+  size_t i, n = 0;
+
+
+  for (i = 0; i < peer->nidle; i++) {
+    if (glusterBlockClntIsStale(peer->idle[i])) {
+      clnt_destroy(peer->idle[i]);
+      glusterBlockPeerCapsDrop(peer);
+      continue;
+    }
+    peer->idle[n++] = peer->idle[i];
+  }
+  peer->nidle = n;
+}
+
+
+/* Checkout a handle to host, either a pooled one or, when none is left
+ * in a usable state, a newly connected one (*fresh is set then). */
+CLIENT *
+glusterBlockClntGet(char *host, bool *fresh)
+{
+  gbPeer *peer;
+  CLIENT *clnt = NULL;
+
+
+  LOCK(peersLock);
+  peer = glusterBlockPeerLookup(host, false);
+  while (peer && peer->nidle) {
+    clnt = peer->idle[--peer->nidle];
+    if (!glusterBlockClntIsStale(clnt)) {
+      break;
+    }
+    LOG("mgmt", GB_LOG_DEBUG, "dropping stale connection to %s", host);
+    glusterBlockPeerCapsDrop(peer);
+    clnt_destroy(clnt);
+    clnt = NULL;
+  }
+  UNLOCK(peersLock);
+
+  if (clnt) {
+    *fresh = false;
+    return clnt;
+  }
+
+  *fresh = true;
+  return glusterBlockClntCreate(host);
+}
+
+
+/* Return a handle after use, broken ones (failed rpc) are destroyed. */
+void
+glusterBlockClntPut(char *host, CLIENT *clnt, bool broken)
+{
+  gbPeer *peer;
+
+
+  if (!clnt) {
+    return;
+  }
+
+  LOCK(peersLock);
+  peer = glusterBlockPeerLookup(host, !broken);
+  if (broken) {
+    glusterBlockPeerCapsDrop(peer);
+  } else if (peer && peer->nidle < GB_CLNT_IDLE_MAX) {
+    peer->idle[peer->nidle++] = clnt;
+    clnt = NULL;
+  }
+  UNLOCK(peersLock);
+
+  if (clnt) {
+    clnt_destroy(clnt);
+  }
+}
+
+
+/* Returns a copy of the cached capabilities of host, NULL if there are
+ * none or they have expired. */
+gbCapResp *
+glusterBlockPeerCapsGet(char *host)
+{
+  gbPeer *peer;
+  gbCapResp *caps = NULL;
+
+
+  LOCK(peersLock);
+  peer = glusterBlockPeerLookup(host, false);
+  if (peer && peer->caps) {
+    glusterBlockPeerPrune(peer);
+  }
+  if (peer && peer->caps) {
+    if (glusterBlockNow() < peer->capsExpiry) {
+      caps = gbCapRespDup(peer->caps);
+    } else {
+      glusterBlockPeerCapsDrop(peer);
+    }
+  }
+  UNLOCK(peersLock);
+
+  return caps;
+}
+
+
+void
+glusterBlockPeerCapsSet(char *host, gbCapResp *caps)
+{
+  gbPeer *peer;
+  gbCapResp *dup;
+
+
+  if (!(dup = gbCapRespDup(caps))) {
+    return;
+  }
+
+  LOCK(peersLock);
+  peer = glusterBlockPeerLookup(host, true);
+  if (!peer) {
+    UNLOCK(peersLock);
+    GB_FREE(dup->response);
+    GB_FREE(dup);
+    return;
+  }
+
+  if (peer->bootId && peer->bootId != dup->bootId) {
+    LOG("mgmt", GB_LOG_INFO, "gluster-blockd on %s was restarted", host);
+  }
+  glusterBlockPeerCapsDrop(peer);
+  peer->caps = dup;
+  peer->bootId = dup->bootId;
+  peer->capsExpiry = glusterBlockNow() + GB_PEER_CAPS_TTL;
+  UNLOCK(peersLock);
+}
+
+
+/* Whether host is known to support cap, without asking it */
+bool
+glusterBlockPeerCapsHas(char *host, int cap)
+{
+  gbPeer *peer;
+  bool has = false;
+  int i;
+
+
+  LOCK(peersLock);
+  peer = glusterBlockPeerLookup(host, false);
+  if (peer && peer->caps) {
+    for (i = 0; i < peer->caps->capMax; i++) {
+      if (!strcmp(peer->caps->response[i].cap, gbCapabilitiesLookup[cap])) {
+        has = peer->caps->response[i].status;
+        break;
+      }
+    }
+  }
+  UNLOCK(peersLock);
+
+  return has;
+}
@@ -0,0 +1,45 @@
+/*
+  Copyright (c) 2018 Red Hat, Inc. <http://www.redhat.com>
+  This file is part of gluster-block.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+
+# ifndef   _CLNT_POOL_H
+# define   _CLNT_POOL_H   1
+
+# include  <netdb.h>
+
+# include  "common.h"
+# include  "block.h"
+
+# define   GB_CLNT_IDLE_MAX   8   /* idle connections kept per peer */
+# define   GB_PEER_CAPS_TTL   300 /* secs */
+
+struct gbCapResp;
+
+
+struct addrinfo *
+glusterBlockGetSockaddr(char *host);
+
+CLIENT *
+glusterBlockClntGet(char *host, bool *fresh);
+
+void
+glusterBlockClntPut(char *host, CLIENT *clnt, bool broken);
+
+struct gbCapResp *
+glusterBlockPeerCapsGet(char *host);
+
+void
+glusterBlockPeerCapsSet(char *host, struct gbCapResp *caps);
+
+bool
+glusterBlockPeerCapsHas(char *host, int cap);
+
+
+# endif /* _CLNT_POOL_H */
@@ -11,20 +11,198 @@
 
 # include "common.h"
 # include "glfs-operations.h"
+# include "locktable.h"
+# include "list.h"
 
 
+/* Meta file of a block an operation holds the metadata lock for, open for
+ * all its updates. Lines queued while one write runs go out together with
+ * the next one. */
+struct gbMetaTxn {
+  struct glfs *glfs;
+  char volume[255];
+  char name[255];
+  struct glfs_fd *fd;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char *pending;           /* lines for the next write */
+  size_t npending;
+  unsigned long queued;    /* lines queued so far */
+  unsigned long written;   /* of them, written (or failed) */
+  unsigned long failedAt;  /* first line of the batch that failed, 0 */
+  int error;
+  bool writing;
+
+  struct list_head list;
+};
+
+static LIST_HEAD(metaTxns);
+static pthread_mutex_t metaTxnsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Keeps appends to the same meta file apart outside of a transaction,
+ * appends to other blocks mostly get a lock of their own */
+# define   GB_META_LOCK_STRIPES   64
+
+static pthread_mutex_t metaLocks[GB_META_LOCK_STRIPES] = {
+  [0 ... GB_META_LOCK_STRIPES - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+
+int gbMetaLayoutType = GB_META_LAYOUT_FLAT;
+
+/* Bucket b of a hashed GB_METADIR; dot names, which no block can have */
+# define   GB_META_BUCKETFMT   ".%02x"
+
+/* Walks the block names of a volume: GB_METADIR itself, then the buckets
+ * of a hashed layout. Past a flat one, a position is idx + 1 in the upper
+ * half and the count of names before it in idx in the lower. */
+struct gbMetaDir {
+  struct glfs *glfs;
+  int layout;
+  int idx;               /* 0 is GB_METADIR, bucket idx - 1 after it */
+  unsigned long count;   /* names of idx passed so far */
+  unsigned long skip;    /* of them, yet to pass over */
+  struct glfs_fd *fd;
+};
+
+typedef struct gbMetaMigration {
+  char volume[255];
+
+  struct list_head list;
+} gbMetaMigration;
+
+static LIST_HEAD(metaMigrations);
+static pthread_mutex_t metaMigrationsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* glfs_init() of a volume under way, others asking for it wait for its
+ * outcome instead of starting one of their own */
+typedef struct gbVolumeInit {
+  char volume[255];
+  bool done;
+  struct glfs *glfs;
+  int errCode;
+  char *errMsg;
+  size_t refs;            /* the initializer and its waiters */
+  pthread_cond_t cond;
 
-struct glfs *
-glusterBlockVolumeInit(char *volume, int *errCode, char **errMsg)
+  struct list_head list;
+} gbVolumeInit;
+
+static LIST_HEAD(volumeInits);
+static pthread_mutex_t volumeInitsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* glfs_init() calls running and started, so one measuring its footprint
+ * can tell whether another one grew the daemon alongside */
+static size_t volumeInitsRunning;
+static size_t volumeInitsStarted;
+
+static void
+blockMetaMigrateStart(char *volume);
+
+
+int
+gbMetaLayoutEnumParse(const char *opt)
 {
-  struct glfs *glfs;
-  int ret;
+  int i;
 
-  glfs = queryCache(volume);
-  if (glfs) {
-    return glfs;
+
+  if (!opt) {
+    return GB_META_LAYOUT_MAX;
+  }
+
+  for (i = 0; i < GB_META_LAYOUT_MAX; i++) {
+    if (!strcmp(opt, gbMetaLayoutLookup[i])) {
+      return i;
+    }
+  }
+
+  return i;
+}
+
+
+/* Layout named in GB_METALAYOUTFILE of the volume, -1 with EPROTO for
+ * one this version doesn't know */
+static int
+blockMetaLayoutRead(struct glfs *glfs)
+{
+  struct glfs_fd *fd;
+  char buf[32] = {0, };
+  ssize_t n;
+  int layout;
+  int errsv;
+
+
+  fd = glfs_open(glfs, GB_METADIR "/" GB_METALAYOUTFILE, O_RDONLY);
+  if (!fd) {
+    return (errno == ENOENT) ? GB_META_LAYOUT_FLAT : -1;
+  }
+
+  n = glfs_pread(fd, buf, sizeof(buf) - 1, 0, 0);
+  errsv = errno;
+  glfs_close(fd);
+  if (n < 0) {
+    errno = errsv;
+    return -1;
   }
 
+  buf[strcspn(buf, "\n")] = '\0';
+  layout = gbMetaLayoutEnumParse(buf);
+  if (layout == GB_META_LAYOUT_MAX) {
+    LOG("gfapi", GB_LOG_ERROR, "unknown metadata layout '%s' in %s/%s",
+        buf, GB_METADIR, GB_METALAYOUTFILE);
+    errno = EPROTO;
+    return -1;
+  }
+
+  return layout;
+}
+
+
+/* layout as cached, or as the volume says now if another node moved it
+ * on since */
+static int
+blockMetaLayoutRefresh(struct glfs *glfs, int layout)
+{
+  int now;
+
+
+  if (layout == GB_META_LAYOUT_HASHED) {
+    return layout;
+  }
+
+  now = blockMetaLayoutRead(glfs);
+  if (now > layout) {
+    storeCacheLayout(glfs, now);
+    return now;
+  }
+
+  return layout;
+}
+
+
+static int
+blockStartDetached(void *(*fn)(void *), void *data)
+{
+  pthread_attr_t attr;
+  pthread_t tid;
+  int ret;
+
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  ret = pthread_create(&tid, &attr, fn, data);
+  pthread_attr_destroy(&attr);
+
+  return ret;
+}
+
+
+static struct glfs *
+blockVolumeInitGlfs(char *volume, int *errCode, char **errMsg)
+{
+  struct glfs *glfs;
+  int ret;
+
   glfs = glfs_new(volume);
   if (!glfs) {
     *errCode = errno;
@@ -71,11 +249,88 @@ glusterBlockVolumeInit(char *volume, int *errCode, char **errMsg)
     goto out;
   }
 
-  if (appendNewEntry(volume, glfs)) {
+  return glfs;
+
+ out:
+  glfs_fini(glfs);
+
+  return NULL;
+}
+
+
+/* resident set size of the daemon in bytes, 0 if it can't be read */
+static size_t
+blockProcRss(void)
+{
+  FILE *fp;
+  unsigned long pages = 0;
+
+
+  fp = fopen("/proc/self/statm", "r");
+  if (!fp) {
+    return 0;
+  }
+  if (fscanf(fp, "%*u %lu", &pages) != 1) {
+    pages = 0;
+  }
+  fclose(fp);
+
+  return pages * sysconf(_SC_PAGESIZE);
+}
+
+
+static struct glfs *
+blockVolumeInitNew(char *volume, int *errCode, char **errMsg)
+{
+  struct glfs *glfs;
+  size_t rss, now;
+  size_t started;
+  bool alone;
+  int layout;
+
+  LOCK(volumeInitsLock);
+  alone = !volumeInitsRunning++;
+  started = ++volumeInitsStarted;
+  UNLOCK(volumeInitsLock);
+  rss = blockProcRss();
+
+  glfs = blockVolumeInitGlfs(volume, errCode, errMsg);
+  now = blockProcRss();
+
+  LOCK(volumeInitsLock);
+  alone = alone && (started == volumeInitsStarted);
+  volumeInitsRunning--;
+  UNLOCK(volumeInitsLock);
+  if (!glfs) {
+    return NULL;
+  }
+
+  /* growth that another init may share in is no measure, 0 has the
+   * cache estimate it */
+  rss = (alone && rss && now > rss) ? now - rss : 0;
+
+  layout = blockMetaLayoutRead(glfs);
+  if (layout < 0) {
+    *errCode = errno;
+    GB_ASPRINTF (errMsg, "Not able to read metadata layout of volume %s[%s]",
+                 volume, strerror(*errCode));
+    LOG("gfapi", GB_LOG_ERROR, "reading %s/%s on %s failed[%s]", GB_METADIR,
+        GB_METALAYOUTFILE, volume, strerror(*errCode));
+    goto out;
+  }
+
+  if (appendNewEntry(volume, glfs, rss)) {
     *errCode = ENOMEM;
+    GB_ASPRINTF (errMsg, "Not able to initialize volume %s[%s]", volume,
+                 strerror(*errCode));
     LOG("gfapi", GB_LOG_ERROR, "allocation failed in appendNewEntry(%s)", volume);
     goto out;
   }
+  storeCacheLayout(glfs, layout);
+
+  if (layout < gbMetaLayoutType) {
+    blockMetaMigrateStart(volume);
+  }
 
   return glfs;
 
@@ -86,488 +341,1981 @@ glusterBlockVolumeInit(char *volume, int *errCode, char **errMsg)
 }
 
 
-int
-glusterBlockCreateEntry(struct glfs *glfs, blockCreateCli *blk, char *gbid,
-                        int *errCode, char **errMsg)
+static gbVolumeInit *
+blockVolumeInitLookup(const char *volume)
 {
-  struct glfs_fd *tgfd;
-  struct stat st;
-  char *tmp;
-  int ret;
+  gbVolumeInit *init;
 
-  ret = glfs_mkdir (glfs, GB_STOREDIR, 0);
-  if (ret && errno != EEXIST) {
-    *errCode = errno;
-    LOG("gfapi", GB_LOG_ERROR,
-        "glfs_mkdir(%s) on volume %s for block %s failed[%s]",
-        GB_STOREDIR, blk->volume, blk->block_name, strerror(errno));
-    goto out;
+
+  list_for_each_entry(init, &volumeInits, list) {
+    if (!strcmp(init->volume, volume)) {
+      return init;
+    }
   }
 
-  ret = glfs_chdir (glfs, GB_STOREDIR);
-  if (ret) {
-    *errCode = errno;
-    LOG("gfapi", GB_LOG_ERROR,
-        "glfs_chdir(%s) on volume %s for block %s failed[%s]",
-        GB_STOREDIR, blk->volume, blk->block_name, strerror(errno));
-    goto out;
+  return NULL;
+}
+
+
+/* Call with volumeInitsLock held */
+static void
+blockVolumeInitPut(gbVolumeInit *init)
+{
+  if (--init->refs) {
+    return;
   }
 
-  if (strlen(blk->storage)) {
-    ret = glfs_stat(glfs, blk->storage, &st);
-    if (ret) {
-      *errCode = errno;
-      if (*errCode == ENOENT) {
-        LOG("mgmt", GB_LOG_ERROR,
-            "storage file '/block-store/%s' doesn't exist in volume %s",
-            blk->storage, blk->volume);
-        GB_ASPRINTF(errMsg,
-                    "storage file '/block-store/%s' doesn't exist in volume %s\n",
-                    blk->storage, blk->volume);
-      } else {
-        LOG("mgmt", GB_LOG_ERROR,
-            "glfs_stat failed on /block-store/%s in volume %s [%s]",
-            blk->storage, blk->volume, strerror(*errCode));
-        GB_ASPRINTF(errMsg,
-                    "glfs_stat failed on /block-store/%s in volume %s [%s]",
-                    blk->storage, blk->volume, strerror(*errCode));
-      }
-      goto out;
+  pthread_cond_destroy(&init->cond);
+  GB_FREE(init->errMsg);
+  GB_FREE(init);
+}
+
+
+/* The cached glfs of volume, initialized on a miss. Only the first of
+ * those asking for a volume at once initializes it, the others wait and
+ * get the same instance or error. */
+struct glfs *
+glusterBlockVolumeInit(char *volume, int *errCode, char **errMsg)
+{
+  gbVolumeInit *init;
+  struct glfs *glfs;
+
+
+  glfs = queryCache(volume);
+  if (glfs) {
+    return glfs;
+  }
+
+  LOCK(volumeInitsLock);
+  while ((init = blockVolumeInitLookup(volume))) {
+    init->refs++;
+    while (!init->done) {
+      pthread_cond_wait(&init->cond, &volumeInitsLock);
     }
-    blk->size = st.st_size;
 
-    if (st.st_nlink == 1) {
-      ret = glfs_link(glfs, blk->storage, gbid);
-      if (ret) {
-        *errCode=errno;
-        LOG("mgmt", GB_LOG_ERROR,
-            "glfs_link(%s, %s) on volume %s for block %s failed [%s]",
-            blk->storage, gbid, blk->volume, blk->block_name, strerror(errno));
-        GB_ASPRINTF(errMsg,
-                    "glfs_link(%s, %s) on volume %s for block %s failed [%s]",
-                    blk->storage, gbid, strerror(errno));
-        goto out;
+    if (!init->glfs) {
+      *errCode = init->errCode;
+      if (init->errMsg && !*errMsg) {
+        GB_STRDUP(*errMsg, init->errMsg);
       }
-    } else {
-      *errCode = EBUSY;
-      LOG("mgmt", GB_LOG_ERROR,
-          "storage file /block-store/%s is already in use in volume %s [%s]",
-          blk->storage, blk->volume, strerror(*errCode));
-      GB_ASPRINTF(errMsg,
-                  "storage file /block-store/%s is already in use in volume %s [%s]\n"
-                  "hint: delete the hardlink file, make sure file is not in use\n",
-                  blk->storage, blk->volume, strerror(*errCode));
-      ret = -1;
-      goto out;
+      blockVolumeInitPut(init);
+      UNLOCK(volumeInitsLock);
+      return NULL;
+    }
+    blockVolumeInitPut(init);
+  }
+
+  /* done before we got here, or while we waited */
+  glfs = queryCache(volume);
+  if (glfs) {
+    UNLOCK(volumeInitsLock);
+    return glfs;
+  }
+
+  if (GB_ALLOC(init) < 0) {
+    UNLOCK(volumeInitsLock);
+    *errCode = ENOMEM;
+    return NULL;
+  }
+  GB_STRCPYSTATIC(init->volume, volume);
+  init->refs = 1;
+  pthread_cond_init(&init->cond, NULL);
+  list_add(&init->list, &volumeInits);
+  UNLOCK(volumeInitsLock);
+
+  glfs = blockVolumeInitNew(volume, errCode, errMsg);
+
+  LOCK(volumeInitsLock);
+  list_del(&init->list);
+  init->done = true;
+  init->glfs = glfs;
+  if (!glfs) {
+    init->errCode = *errCode;
+    if (*errMsg) {
+      GB_STRDUP(init->errMsg, *errMsg);
     }
+  }
+  pthread_cond_broadcast(&init->cond);
+  blockVolumeInitPut(init);
+  UNLOCK(volumeInitsLock);
+
+  return glfs;
+}
+
+
+static void *
+blockVolumeInitProc(void *data)
+{
+  char *volume = data;
+  struct glfs *glfs;
+  int errCode = 0;
+  char *errMsg = NULL;
+
+
+  glfs = glusterBlockVolumeInit(volume, &errCode, &errMsg);
+  if (!glfs) {
+    LOG("gfapi", GB_LOG_ERROR, "initializing volume %s ahead failed[%s]",
+        volume, errMsg ? errMsg : strerror(errCode));
+  }
+  glusterBlockVolumeRelease(glfs);
+
+  GB_FREE(errMsg);
+  GB_FREE(volume);
+
+  return NULL;
+}
+
+
+/* Starts glusterBlockVolumeInit() of volume in the background, so a
+ * request coming for it later finds it ready or under way */
+int
+glusterBlockVolumeInitAsync(char *volume)
+{
+  struct glfs *glfs;
+  char *name;
+  bool busy;
+  int ret;
+
+
+  glfs = queryCache(volume);
+  if (glfs) {
+    glusterBlockVolumeRelease(glfs);
     return 0;
   }
 
-  tgfd = glfs_creat(glfs, gbid,
-                    O_WRONLY | O_CREAT | O_EXCL | O_SYNC,
-                    S_IRUSR | S_IWUSR);
-  if (!tgfd) {
-    *errCode = errno;
-    LOG("gfapi", GB_LOG_ERROR,
-        "glfs_creat(%s) on volume %s for block %s failed[%s]",
-        gbid, blk->volume, blk->block_name, strerror(errno));
-    ret = -1;
-    goto out;
-  } else {
-    ret = glfs_ftruncate(tgfd, blk->size);
-    if (ret) {
-      *errCode = errno;
-      LOG("gfapi", GB_LOG_ERROR,
-          "glfs_ftruncate(%s): on volume %s for block %s "
-          "of size %zu failed[%s]", gbid, blk->volume, blk->block_name,
-          blk->size, strerror(errno));
-      goto unlink;
+  LOCK(volumeInitsLock);
+  busy = !!blockVolumeInitLookup(volume);
+  UNLOCK(volumeInitsLock);
+  if (busy) {
+    return 0;
+  }
+
+  if (GB_STRDUP(name, volume) < 0) {
+    return -1;
+  }
+
+  ret = blockStartDetached(blockVolumeInitProc, name);
+  if (ret) {
+    LOG("gfapi", GB_LOG_ERROR, "starting to initialize volume %s failed[%s]",
+        volume, strerror(ret));
+    GB_FREE(name);
+    errno = ret;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/* Every glusterBlockVolumeInit() that didn't fail ends with one of these,
+ * once nothing of that glfs is in use any more */
+void
+glusterBlockVolumeRelease(struct glfs *glfs)
+{
+  releaseCache(glfs);
+}
+
+
+static const char *const blockDirPaths[] = {
+  [GB_CACHE_METADIR]    = GB_METADIR,
+  [GB_CACHE_STOREDIR]   = GB_STOREDIR,
+  [GB_CACHE_METATMPDIR] = GB_METATMPDIR,
+};
+
+
+/* Handle of GB_METADIR, GB_STOREDIR or GB_METATMPDIR, kept along with the
+ * cached glfs; the directory gets created on first use */
+static struct glfs_object *
+blockDirHandle(struct glfs *glfs, int dir)
+{
+  const char *path = blockDirPaths[dir];
+  struct glfs_object *root;
+  struct glfs_object *obj;
+  int errsv;
+
+
+  obj = queryCacheDir(glfs, dir);
+  if (obj) {
+    return obj;
+  }
+
+  obj = glfs_h_lookupat(glfs, NULL, path, NULL, 0);
+  if (!obj && errno == ENOENT) {
+    root = glfs_h_lookupat(glfs, NULL, "/", NULL, 0);
+    if (root) {
+      obj = glfs_h_mkdir(glfs, root, path + 1, 0, NULL);
+      if (!obj && errno == EEXIST) {
+        obj = glfs_h_lookupat(glfs, NULL, path, NULL, 0);
+      }
+      errsv = errno;
+      glfs_h_close(root);
+      errno = errsv;
     }
+  }
+  if (!obj) {
+    LOG("gfapi", GB_LOG_ERROR, "lookup of %s failed[%s]", path,
+        strerror(errno));
+    return NULL;
+  }
+
+  return storeCacheDir(glfs, dir, obj);
+}
+
+
+static unsigned long
+blockNameHash(const char *name)
+{
+  unsigned long hash = 5381;
+
+
+  while (*name) {
+    hash = hash * 33 + (unsigned char)*name++;
+  }
+
+  return hash;
+}
+
+
+/* Handle of bucket of a hashed GB_METADIR, created if missing and create */
+static struct glfs_object *
+blockBucketHandle(struct glfs *glfs, int bucket, bool create)
+{
+  struct glfs_object *meta;
+  struct glfs_object *obj;
+  char name[8];
+
+
+  obj = queryCacheDir(glfs, GB_CACHE_BUCKETS + bucket);
+  if (obj) {
+    return obj;
+  }
+
+  meta = blockDirHandle(glfs, GB_CACHE_METADIR);
+  if (!meta) {
+    return NULL;
+  }
+
+  snprintf(name, sizeof name, GB_META_BUCKETFMT, bucket);
+  obj = glfs_h_lookupat(glfs, meta, name, NULL, 0);
+  if (!obj && errno == ENOENT && create) {
+    obj = glfs_h_mkdir(glfs, meta, name, 0, NULL);
+    if (!obj && errno == EEXIST) {
+      obj = glfs_h_lookupat(glfs, meta, name, NULL, 0);
+    }
+  }
+  if (!obj) {
+    if (errno != ENOENT) {
+      LOG("gfapi", GB_LOG_ERROR, "lookup of %s/%s failed[%s]", GB_METADIR,
+          name, strerror(errno));
+    }
+    return NULL;
+  }
+
+  return storeCacheDir(glfs, GB_CACHE_BUCKETS + bucket, obj);
+}
+
+
+/* glfs_open() of name in parent, creating it first with O_CREAT in flags */
+static struct glfs_fd *
+blockOpenIn(struct glfs *glfs, struct glfs_object *parent, const char *name,
+            int flags)
+{
+  struct glfs_object *obj = NULL;
+  struct glfs_fd *fd;
+  int errsv;
+
+
+  if (!(flags & O_EXCL)) {
+    obj = glfs_h_lookupat(glfs, parent, name, NULL, 0);
+  }
+  if (!obj && (flags & O_CREAT) && ((flags & O_EXCL) || errno == ENOENT)) {
+    obj = glfs_h_creat(glfs, parent, name, flags, S_IRUSR | S_IWUSR, NULL);
+    /* raced with another creator */
+    if (!obj && errno == EEXIST && !(flags & O_EXCL)) {
+      obj = glfs_h_lookupat(glfs, parent, name, NULL, 0);
+    }
+  }
+  if (!obj) {
+    return NULL;
+  }
+
+  fd = glfs_h_open(glfs, obj, flags & ~(O_CREAT | O_EXCL));
+  errsv = errno;
+  glfs_h_close(obj);
+  errno = errsv;
+
+  return fd;
+}
+
+
+static struct glfs_fd *
+blockOpenAt(struct glfs *glfs, int dir, const char *name, int flags)
+{
+  struct glfs_object *parent;
+
+
+  parent = blockDirHandle(glfs, dir);
+  if (!parent) {
+    return NULL;
+  }
+
+  return blockOpenIn(glfs, parent, name, flags);
+}
+
+
+/* Looks up the meta file of block name, in its bucket or in GB_METADIR
+ * as the layout says. *parent is the directory it is in, or else the one
+ * it goes to; NULL on errors other than ENOENT. */
+static struct glfs_object *
+blockMetaLookup(struct glfs *glfs, const char *name,
+                struct glfs_object **parent)
+{
+  struct glfs_object *top;
+  struct glfs_object *obj;
+  bool reread = false;
+  int layout;
+  int now;
+
+
+  layout = queryCacheLayout(glfs);
+
+ again:
+  *parent = NULL;
+  top = blockDirHandle(glfs, GB_CACHE_METADIR);
+  if (!top) {
+    return NULL;
+  }
+
+  if (layout != GB_META_LAYOUT_FLAT) {
+    *parent = blockBucketHandle(glfs, blockNameHash(name) % GB_META_BUCKETS,
+                                true);
+    if (!*parent) {
+      return NULL;
+    }
+    obj = glfs_h_lookupat(glfs, *parent, name, NULL, 0);
+    if (obj || errno != ENOENT || layout == GB_META_LAYOUT_HASHED) {
+      return obj;
+    }
+  }
+
+  /* flat, or not moved yet */
+  obj = glfs_h_lookupat(glfs, top, name, NULL, 0);
+  if (obj) {
+    *parent = top;
+    return obj;
+  }
+  if (errno != ENOENT) {
+    *parent = NULL;
+    return NULL;
+  }
+  if (layout == GB_META_LAYOUT_FLAT) {
+    *parent = top;
+  }
+
+  /* another node may have moved it since the layout was read */
+  if (!reread) {
+    reread = true;
+    now = blockMetaLayoutRefresh(glfs, layout);
+    if (now != layout) {
+      layout = now;
+      goto again;
+    }
+  }
+
+  errno = ENOENT;
+  return NULL;
+}
+
+
+/* blockOpenAt() of the meta file of block name */
+static struct glfs_fd *
+blockMetaOpen(struct glfs *glfs, const char *name, int flags)
+{
+  struct glfs_object *parent;
+  struct glfs_object *obj;
+  struct glfs_fd *fd;
+  int errsv;
+
+
+  obj = blockMetaLookup(glfs, name, &parent);
+  if (!obj) {
+    if (!parent || errno != ENOENT || !(flags & O_CREAT)) {
+      return NULL;
+    }
+    return blockOpenIn(glfs, parent, name, flags);
+  }
+
+  if (flags & O_EXCL) {
+    glfs_h_close(obj);
+    errno = EEXIST;
+    return NULL;
+  }
+
+  fd = glfs_h_open(glfs, obj, flags & ~O_CREAT);
+  errsv = errno;
+  glfs_h_close(obj);
+  errno = errsv;
+
+  return fd;
+}
+
+
+static int
+blockMetaUnlink(struct glfs *glfs, const char *name)
+{
+  struct glfs_object *parent;
+  struct glfs_object *obj;
+
+
+  obj = blockMetaLookup(glfs, name, &parent);
+  if (!obj) {
+    return -1;
+  }
+  glfs_h_close(obj);
+
+  return glfs_h_unlink(glfs, parent, name);
+}
+
+
+static int
+blockUnlinkAt(struct glfs *glfs, int dir, const char *name)
+{
+  struct glfs_object *parent;
+
+
+  parent = blockDirHandle(glfs, dir);
+  if (!parent) {
+    return -1;
+  }
+
+  return glfs_h_unlink(glfs, parent, name);
+}
+
+
+int
+glusterBlockCreateEntry(struct glfs *glfs, blockCreateCli *blk, char *gbid,
+                        int *errCode, char **errMsg)
+{
+  struct glfs_object *store;
+  struct glfs_object *sobj;
+  struct glfs_fd *tgfd;
+  struct stat st;
+  int errsv;
+  int ret = -1;
+
+  store = blockDirHandle(glfs, GB_CACHE_STOREDIR);
+  if (!store) {
+    *errCode = errno;
+    LOG("gfapi", GB_LOG_ERROR,
+        "lookup of %s on volume %s for block %s failed[%s]",
+        GB_STOREDIR, blk->volume, blk->block_name, strerror(errno));
+    goto out;
+  }
+
+  if (strlen(blk->storage)) {
+    sobj = glfs_h_lookupat(glfs, store, blk->storage, &st, 0);
+    if (!sobj) {
+      *errCode = errno;
+      if (*errCode == ENOENT) {
+        LOG("mgmt", GB_LOG_ERROR,
+            "storage file '/block-store/%s' doesn't exist in volume %s",
+            blk->storage, blk->volume);
+        GB_ASPRINTF(errMsg,
+                    "storage file '/block-store/%s' doesn't exist in volume %s\n",
+                    blk->storage, blk->volume);
+      } else {
+        LOG("mgmt", GB_LOG_ERROR,
+            "glfs_stat failed on /block-store/%s in volume %s [%s]",
+            blk->storage, blk->volume, strerror(*errCode));
+        GB_ASPRINTF(errMsg,
+                    "glfs_stat failed on /block-store/%s in volume %s [%s]",
+                    blk->storage, blk->volume, strerror(*errCode));
+      }
+      goto out;
+    }
+    blk->size = st.st_size;
+
+    if (st.st_nlink == 1) {
+      ret = glfs_h_link(glfs, sobj, store, gbid);
+      errsv = errno;
+      glfs_h_close(sobj);
+      if (ret) {
+        *errCode = errsv;
+        LOG("mgmt", GB_LOG_ERROR,
+            "glfs_link(%s, %s) on volume %s for block %s failed [%s]",
+            blk->storage, gbid, blk->volume, blk->block_name,
+            strerror(*errCode));
+        GB_ASPRINTF(errMsg,
+                    "glfs_link(%s, %s) on volume %s for block %s failed [%s]",
+                    blk->storage, gbid, blk->volume, blk->block_name,
+                    strerror(*errCode));
+        goto out;
+      }
+    } else {
+      glfs_h_close(sobj);
+      *errCode = EBUSY;
+      LOG("mgmt", GB_LOG_ERROR,
+          "storage file /block-store/%s is already in use in volume %s [%s]",
+          blk->storage, blk->volume, strerror(*errCode));
+      GB_ASPRINTF(errMsg,
+                  "storage file /block-store/%s is already in use in volume %s [%s]\n"
+                  "hint: delete the hardlink file, make sure file is not in use\n",
+                  blk->storage, blk->volume, strerror(*errCode));
+      ret = -1;
+      goto out;
+    }
+    return 0;
+  }
+
+  tgfd = blockOpenAt(glfs, GB_CACHE_STOREDIR, gbid,
+                     O_WRONLY | O_CREAT | O_EXCL | O_SYNC);
+  if (!tgfd) {
+    *errCode = errno;
+    LOG("gfapi", GB_LOG_ERROR,
+        "glfs_creat(%s) on volume %s for block %s failed[%s]",
+        gbid, blk->volume, blk->block_name, strerror(errno));
+    ret = -1;
+    goto out;
+  } else {
+    ret = glfs_ftruncate(tgfd, blk->size);
+    if (ret) {
+      *errCode = errno;
+      LOG("gfapi", GB_LOG_ERROR,
+          "glfs_ftruncate(%s): on volume %s for block %s "
+          "of size %zu failed[%s]", gbid, blk->volume, blk->block_name,
+          blk->size, strerror(errno));
+      goto unlink;
+    }
+
+    if (blk->prealloc && glfs_zerofill(tgfd, 0, blk->size)) {
+      *errCode = errno;
+      LOG("gfapi", GB_LOG_ERROR,
+          "glfs_zerofill(%s): on volume %s for block %s "
+          "of size %zu failed[%s]", gbid, blk->volume, blk->block_name,
+          blk->size, strerror(errno));
+      ret = -1;
+      goto unlink;
+    }
+  }
+
+
+unlink:
+  if (tgfd && glfs_close(tgfd) != 0) {
+    *errCode = errno;
+    LOG("gfapi", GB_LOG_ERROR,
+        "glfs_close(%s): on volume %s for block %s failed[%s]",
+        gbid, blk->volume, blk->block_name, strerror(errno));
+    ret = -1;
+  }
+
+  if (ret && blockUnlinkAt(glfs, GB_CACHE_STOREDIR, gbid) && errno != ENOENT) {
+    *errCode = errno;
+    LOG("gfapi", GB_LOG_ERROR,
+        "glfs_unlink(%s) on volume %s for block %s failed[%s]",
+        gbid, blk->volume, blk->block_name, strerror(errno));
+  }
+
+ out:
+  if (ret) {
+    if (!errMsg) {
+      GB_ASPRINTF (errMsg, "Not able to create storage for %s/%s [%s]",
+                   blk->volume, blk->block_name, strerror(*errCode));
+    }
+
+    if (blockMetaUnlink(glfs, blk->block_name) && errno != ENOENT) {
+      LOG("gfapi", GB_LOG_ERROR,
+          "glfs_unlink(%s/%s) on volume %s for block %s failed[%s]",
+          GB_METADIR, blk->block_name, blk->volume, blk->block_name,
+          strerror(errno));
+    }
+  }
+
+  return ret;
+}
+
+
+int
+glusterBlockDeleteEntry(struct glfs *glfs, char *volume, char *gbid)
+{
+  int ret;
+
+
+  ret = blockUnlinkAt(glfs, GB_CACHE_STOREDIR, gbid);
+  if (ret && errno != ENOENT) {
+    LOG("gfapi", GB_LOG_ERROR, "glfs_unlink(%s) on volume %s failed[%s]",
+        gbid, volume, strerror(errno));
+  }
+
+  return ret;
+}
+
+
+/* The fd of meta.lock every lock of ours on the volume goes through,
+ * kept along with the cached glfs and not to be closed by the caller.
+ * gfapi gives all fds of a glfs one lock owner, so closing any fd of
+ * meta.lock would drop the locks of every request on the volume. */
+struct glfs_fd *
+glusterBlockCreateMetaLockFile(struct glfs *glfs, char *volume, int *errCode,
+                               char **errMsg)
+{
+  struct glfs_fd *lkfd;
+
+
+  lkfd = queryCacheLockFd(glfs);
+  if (lkfd) {
+    return lkfd;
+  }
+
+  lkfd = blockOpenAt(glfs, GB_CACHE_METADIR, GB_TXLOCKFILE, O_RDWR | O_CREAT);
+  if (lkfd) {
+    lkfd = storeCacheLockFd(glfs, lkfd);
+  }
+  if (!lkfd) {
+    *errCode = errno;
+    LOG("gfapi", GB_LOG_ERROR, "glfs_creat(%s) on volume %s failed[%s]",
+        GB_TXLOCKFILE, volume, strerror(*errCode));
+    goto out;
+  }
+
+  return lkfd;
+
+ out:
+  GB_ASPRINTF (errMsg, "Not able to create Metadata on volume %s[%s]", volume,
+               strerror (*errCode));
+  return NULL;
+}
+
+
+/* Byte 0 of meta.lock guards the namespace of the volume, every block
+ * name hashes to a byte of its own after it. Daemons locking all of the
+ * file still exclude everybody. */
+static off_t
+blockMetaLockSlot(const char *block)
+{
+  if (!block) {
+    return 0;
+  }
+
+  return 1 + blockNameHash(block) % GB_METALOCK_SLOTS;
+}
+
+
+/* The table key of the lock on block of volume: slots, not names, two
+ * names sharing a slot share the lock here too */
+static off_t
+blockMetaLockKey(char *volume, char *block, char *key, size_t len)
+{
+  off_t slot = blockMetaLockSlot(block);
+
+
+  snprintf(key, len, "%s#%lld", volume, (long long)slot);
+
+  return slot;
+}
+
+
+static int
+blockMetaPosixLock(struct glfs_fd *lkfd, short type, off_t slot, int cmd,
+                   char *volume, char *block)
+{
+  struct flock lock = {0, };
+  int ret;
+
+
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = slot;
+  lock.l_len = 1;
+
+  ret = glfs_posix_lock(lkfd, cmd, &lock);
+  if (ret) {
+    LOG("mgmt", GB_LOG_ERROR, "glfs_posix_lock() on volume %s for %s "
+        "failed[%s]", volume, block?block:"namespace", strerror(errno));
+  }
+
+  return ret;
+}
+
+
+/* Takes the lock on block, or on the volume namespace if block is NULL,
+ * exclusively and through lkfd from glusterBlockCreateMetaLockFile() */
+int
+glusterBlockMetaLock(struct glfs_fd *lkfd, char *volume, char *block,
+                     int *errCode, char **errMsg)
+{
+  char key[320];
+  off_t slot;
+
+
+  slot = blockMetaLockKey(volume, block, key, sizeof(key));
+  if (gbLockTableAcquire(&gbMetaLockTable, key)) {
+    *errCode = ENOMEM;
+    goto fail;
+  }
+
+  if (blockMetaPosixLock(lkfd, F_WRLCK, slot, F_SETLKW, volume, block)) {
+    *errCode = errno;
+    gbLockTableRelease(&gbMetaLockTable, key);
+    goto fail;
+  }
+
+  return 0;
+
+ fail:
+  if (!*errMsg) {
+    GB_ASPRINTF(errMsg, "Not able to acquire lock on %s%s%s[%s]", volume,
+                block?"/":"", block?block:"", strerror(*errCode));
+  }
+  return -1;
+}
+
+
+/* glusterBlockMetaLock() of block, if nobody holds it here or elsewhere;
+ * -1 with errno EBUSY if somebody does */
+static int
+blockMetaTryLock(struct glfs_fd *lkfd, char *volume, char *block)
+{
+  struct flock lock = {0, };
+  char key[320];
+  int errsv;
+
+
+  lock.l_start = blockMetaLockKey(volume, block, key, sizeof(key));
+  if (gbLockTableTryAcquire(&gbMetaLockTable, key)) {
+    return -1;
+  }
+
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_len = 1;
+  if (glfs_posix_lock(lkfd, F_SETLK, &lock)) {
+    errsv = (errno == EAGAIN || errno == EACCES) ? EBUSY : errno;
+    if (errsv != EBUSY) {
+      LOG("mgmt", GB_LOG_ERROR, "glfs_posix_lock() on volume %s for %s "
+          "failed[%s]", volume, block, strerror(errsv));
+    }
+    gbLockTableRelease(&gbMetaLockTable, key);
+    errno = errsv;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int
+glusterBlockMetaUnlock(struct glfs_fd *lkfd, char *volume, char *block,
+                       char **errMsg)
+{
+  char key[320];
+  off_t slot;
+  int ret = 0;
+
+
+  slot = blockMetaLockKey(volume, block, key, sizeof(key));
+  if (blockMetaPosixLock(lkfd, F_UNLCK, slot, F_SETLK, volume, block)) {
+    if (!*errMsg) {
+      GB_ASPRINTF(errMsg, "Not able to release lock on %s%s%s[%s]", volume,
+                  block?"/":"", block?block:"", strerror(errno));
+    }
+    ret = -1;
+  }
+
+  gbLockTableRelease(&gbMetaLockTable, key);
+
+  return ret;
+}
+
+
+/* Takes the lock on block, or on the volume namespace if block is NULL,
+ * shared with the other readers of it, in this process and elsewhere.
+ * The table entry keeps a reference to glfs, whose lock fd holds the
+ * F_RDLCK, until the last reader leaves. */
+int
+glusterBlockMetaLockShared(struct glfs *glfs, char *volume, char *block,
+                           int *errCode, char **errMsg)
+{
+  struct glfs_fd *lkfd;
+  bool first;
+  char key[320];
+  off_t slot;
+
+
+  slot = blockMetaLockKey(volume, block, key, sizeof(key));
+  if (gbLockTableAcquireShared(&gbMetaLockTable, key, &first)) {
+    *errCode = ENOMEM;
+    goto fail;
+  }
+
+  /* held by other readers here already */
+  if (!first) {
+    return 0;
+  }
+
+  lkfd = glusterBlockCreateMetaLockFile(glfs, volume, errCode, errMsg);
+  if (!lkfd) {
+    goto release;
+  }
+
+  if (blockMetaPosixLock(lkfd, F_RDLCK, slot, F_SETLKW, volume, block)) {
+    *errCode = errno;
+    goto release;
+  }
+
+  holdCache(glfs);
+  gbLockTableShare(&gbMetaLockTable, key, glfs);
+
+  return 0;
+
+ release:
+  gbLockTableRelease(&gbMetaLockTable, key);
+ fail:
+  if (!*errMsg) {
+    GB_ASPRINTF(errMsg, "Not able to acquire lock on %s%s%s[%s]", volume,
+                block?"/":"", block?block:"", strerror(*errCode));
+  }
+  return -1;
+}
+
+
+int
+glusterBlockMetaUnlockShared(char *volume, char *block, char **errMsg)
+{
+  struct glfs *glfs = NULL;
+  bool last;
+  char key[320];
+  off_t slot;
+  int ret = 0;
+
+
+  slot = blockMetaLockKey(volume, block, key, sizeof(key));
+  if (gbLockTableReleaseShared(&gbMetaLockTable, key, &last,
+                               (void **)&glfs)) {
+    return -1;
+  }
+  if (!last) {
+    return 0;
+  }
+
+  if (blockMetaPosixLock(queryCacheLockFd(glfs), F_UNLCK, slot, F_SETLK,
+                         volume, block)) {
+    if (!*errMsg) {
+      GB_ASPRINTF(errMsg, "Not able to release lock on %s%s%s[%s]", volume,
+                  block?"/":"", block?block:"", strerror(errno));
+    }
+    ret = -1;
+  }
+  glusterBlockVolumeRelease(glfs);
+
+  gbLockTableRelease(&gbMetaLockTable, key);
+
+  return ret;
+}
+
+
+/* glfs_access(F_OK) of the meta file of block name */
+int
+blockMetaAccess(struct glfs *glfs, char *name)
+{
+  struct glfs_object *parent;
+  struct glfs_object *obj;
+
+
+  obj = blockMetaLookup(glfs, name, &parent);
+  if (!obj) {
+    return -1;
+  }
+  glfs_h_close(obj);
+
+  return 0;
+}
+
+
+/* offset is a position blockMetaReaddir() gave, to resume at; 0 starts
+ * from the first name */
+gbMetaDir *
+blockMetaOpendir(struct glfs *glfs, unsigned long long offset)
+{
+  struct glfs_object *top;
+  gbMetaDir *dir;
+
+
+  if (GB_ALLOC(dir) < 0) {
+    return NULL;
+  }
+  dir->glfs = glfs;
+  dir->layout = blockMetaLayoutRefresh(glfs, queryCacheLayout(glfs));
+
+  if (dir->layout != GB_META_LAYOUT_FLAT) {
+    /* else a flat cookie, from before the volume moved: start over */
+    if ((offset >> 32) && (offset >> 32) <= GB_META_BUCKETS + 1) {
+      dir->idx = (offset >> 32) - 1;
+      dir->skip = offset & 0xffffffffUL;
+    }
+    return dir;
+  }
+
+  top = blockDirHandle(glfs, GB_CACHE_METADIR);
+  if (top) {
+    dir->fd = glfs_h_opendir(glfs, top);
+  }
+  if (!dir->fd) {
+    GB_FREE(dir);
+    return NULL;
+  }
+
+  /* a glfs_telldir() cookie */
+  if (offset) {
+    glfs_seekdir(dir->fd, (long)offset);
+  }
+
+  return dir;
+}
+
+
+/* The next block name, NULL at the end; *pos resumes at it */
+const char *
+blockMetaReaddir(gbMetaDir *dir, unsigned long long *pos)
+{
+  struct glfs_object *obj;
+  struct dirent *entry;
+  long here;
+
+
+  for (;;) {
+    if (!dir->fd) {
+      if (dir->layout == GB_META_LAYOUT_FLAT || dir->idx > GB_META_BUCKETS) {
+        return NULL;
+      }
+      if (dir->idx) {
+        obj = blockBucketHandle(dir->glfs, dir->idx - 1, false);
+      } else {
+        obj = blockDirHandle(dir->glfs, GB_CACHE_METADIR);
+      }
+      if (obj) {
+        dir->fd = glfs_h_opendir(dir->glfs, obj);
+        if (!dir->fd) {
+          return NULL;
+        }
+      } else if (errno != ENOENT) {
+        return NULL;
+      } else {
+        dir->idx++;   /* no blocks ever hashed to it */
+        dir->count = dir->skip = 0;
+        continue;
+      }
+    }
+
+    here = glfs_telldir(dir->fd);
+    entry = glfs_readdir(dir->fd);
+    if (!entry) {
+      if (dir->layout == GB_META_LAYOUT_FLAT) {
+        return NULL;
+      }
+      glfs_closedir(dir->fd);
+      dir->fd = NULL;
+      dir->idx++;
+      dir->count = dir->skip = 0;
+      continue;
+    }
+
+    /* dot files are ours: buckets, the layout, or left over by
+     * blockMetaCompact() */
+    if (entry->d_name[0] == '.' || !strcmp(entry->d_name, GB_TXLOCKFILE)) {
+      continue;
+    }
+
+    if (dir->layout == GB_META_LAYOUT_FLAT) {
+      *pos = here;
+      return entry->d_name;
+    }
+
+    if (dir->skip) {
+      dir->skip--;
+      dir->count++;
+      continue;
+    }
+    *pos = ((dir->idx + 1ULL) << 32) | dir->count++;
+    return entry->d_name;
+  }
+}
+
+
+int
+blockMetaClosedir(gbMetaDir *dir)
+{
+  int ret = 0;
+
+
+  if (!dir) {
+    return 0;
+  }
+
+  if (dir->fd) {
+    ret = glfs_closedir(dir->fd);
+  }
+  GB_FREE(dir);
+
+  return ret;
+}
+
+
+int
+glusterBlockDeleteMetaFile(struct glfs *glfs,
+                               char *volume, char *blockname)
+{
+  int ret;
+
+
+  ret = blockMetaUnlink(glfs, blockname);
+  if (ret && errno != ENOENT) {
+    LOG("gfapi", GB_LOG_ERROR, "glfs_unlink(%s) on volume %s failed[%s]",
+        blockname, volume, strerror(errno));
+    goto out;
+  }
+
+ out:
+  return ret;
+}
+
+
+void
+blockFreeMetaInfo(MetaInfo *info)
+{
+  int i;
+
+
+  if (!info)
+    return;
+
+  for (i = 0; i < info->nhosts; i++) {
+    GB_FREE(info->list[i]);
+  }
+
+  GB_FREE(info->list);
+  GB_FREE(info);
+}
+
+
+/* Reads all of metafile into *buf, NUL terminated. Takes one pread when
+ * it didn't grow since the fstat. */
+static int
+blockMetaRead(struct glfs *glfs, char *metafile, char **buf, int *errCode)
+{
+  struct glfs_fd *tgmfd = NULL;
+  struct stat st;
+  size_t size;
+  size_t len = 0;
+  ssize_t n;
+  int ret = -1;
+
+
+  *buf = NULL;
+
+  tgmfd = blockMetaOpen(glfs, metafile, O_RDONLY);
+  if (!tgmfd) {
+    if (errCode) {
+      *errCode = errno;
+    }
+    LOG("gfapi", GB_LOG_ERROR, "glfs_open(%s) failed[%s]", metafile,
+                               strerror(errno));
+    goto out;
+  }
+
+  if (glfs_fstat(tgmfd, &st)) {
+    if (errCode) {
+      *errCode = errno;
+    }
+    LOG("gfapi", GB_LOG_ERROR, "glfs_fstat(%s) failed[%s]", metafile,
+                               strerror(errno));
+    goto out;
+  }
+
+  /* a byte more than its size, to see it hit EOF in the same read */
+  size = st.st_size + 1;
+  if (GB_ALLOC_N(*buf, size + 1) < 0) {
+    if (errCode) {
+      *errCode = ENOMEM;
+    }
+    goto out;
+  }
+
+  while ((n = glfs_pread(tgmfd, *buf + len, size - len, len, 0)) > 0) {
+    len += n;
+    if (len < size) {
+      break;   /* short, so at EOF */
+    }
+
+    /* grew since */
+    if (GB_REALLOC_N(*buf, size * 2 + 1) < 0) {
+      if (errCode) {
+        *errCode = ENOMEM;
+      }
+      goto out;
+    }
+    size *= 2;
+  }
+  if (n < 0) {
+    if (errCode) {
+      *errCode = errno;
+    }
+    LOG("gfapi", GB_LOG_ERROR, "glfs_pread(%s) failed[%s]", metafile,
+                               strerror(errno));
+    goto out;
+  }
+  (*buf)[len] = '\0';
+
+  ret = 0;
+
+ out:
+  if (tgmfd && glfs_close(tgmfd) != 0) {
+    LOG("gfapi", GB_LOG_ERROR, "glfs_close(%s): failed[%s]",
+        metafile, strerror(errno));
+  }
+  if (ret) {
+    GB_FREE(*buf);
+  }
+
+  return ret;
+}
+
+
+/* Splits the next "key: value" line off *pos, in place. Returns false at
+ * the end of buf; lines without a ':' come back with a NULL *value. */
+static bool
+blockMetaNextLine(char **pos, char **key, char **value)
+{
+  char *line = *pos;
+  char *end;
+  char *sep;
+
+
+  if (!*line) {
+    return false;
+  }
+
+  end = strchr(line, '\n');
+  if (end) {
+    *end = '\0';
+    *pos = end + 1;
+  } else {
+    *pos = line + strlen(line);
+  }
+
+  *key = line;
+  *value = NULL;
+  sep = strchr(line, ':');
+  if (sep) {
+    *sep = '\0';
+    for (sep++; *sep == ' '; sep++);
+    *value = sep;
+  }
+
+  return true;
+}
+
+
+/* Upper bound of the host lines of a meta file */
+static size_t
+blockMetaLineCount(const char *buf)
+{
+  size_t count = 1;
+
+
+  while ((buf = strchr(buf, '\n'))) {
+    count++;
+    buf++;
+  }
+
+  return count;
+}
+
+
+static int
+blockStuffMetaInfo(MetaInfo *info, char *key, char *value)
+{
+  size_t i;
+
+
+  switch (blockMetaKeyEnumParse(key)) {
+  case GB_META_VOLUME:
+    GB_STRCPYSTATIC(info->volume, value);
+    break;
+  case GB_META_GBID:
+    GB_STRCPYSTATIC(info->gbid, value);
+    break;
+  case GB_META_SIZE:
+    sscanf(value, "%zu", &info->size);
+    break;
+  case GB_META_HA:
+    sscanf(value, "%zu", &info->mpath);
+    break;
+  case GB_META_ENTRYCREATE:
+    GB_STRCPYSTATIC(info->entry, value);
+    break;
+  case GB_META_PASSWD:
+    GB_STRCPYSTATIC(info->passwd, value);
+    break;
+
+  default:
+    /* the last line of a host wins */
+    for (i = 0; i < info->nhosts; i++) {
+      if (!strcmp(info->list[i]->addr, key)) {
+        GB_STRCPYSTATIC(info->list[i]->status, value);
+        return 0;
+      }
+    }
+    if (GB_ALLOC(info->list[info->nhosts]) < 0) {
+      return -1;
+    }
+    GB_STRCPYSTATIC(info->list[info->nhosts]->addr, key);
+    GB_STRCPYSTATIC(info->list[info->nhosts]->status, value);
+    info->nhosts++;
+    break;
+  }
+
+  return 0;
+}
+
+
+int
+blockParseValidServers(struct glfs* glfs, char *metafile,
+                       int *errCode, blockServerDefPtr *savelist, char *skiphost)
+{
+  blockServerDefPtr list = *savelist;
+  char *buf = NULL;
+  char *pos;
+  char *h, *s;
+  size_t i;
+  int ret = -1;
+  bool match;
+
+
+  if (blockMetaRead(glfs, metafile, &buf, errCode)) {
+    goto out;
+  }
+
+  /* room for all hosts the file can name */
+  if (!list) {
+    if (GB_ALLOC(list) < 0) {
+      goto out;
+    }
+  }
+  if (GB_REALLOC_N(list->hosts, list->nhosts + blockMetaLineCount(buf)) < 0) {
+    goto out;
+  }
+
+  pos = buf;
+  while (blockMetaNextLine(&pos, &h, &s)) {
+    if (!s) {
+      continue;
+    }
+
+    switch (blockMetaKeyEnumParse(h)) {
+    case GB_META_VOLUME:
+    case GB_META_GBID:
+    case GB_META_SIZE:
+    case GB_META_HA:
+    case GB_META_ENTRYCREATE:
+    case GB_META_PASSWD:
+      break;
+    default:
+      if (skiphost && !strcmp(h, skiphost)) {
+        break; /* switch case */
+      }
+
+      match = false;
+      for (i = 0; i < list->nhosts; i++) {
+        if (!strcmp(list->hosts[i], h)) {
+          match = true;
+          break; /* for loop */
+        }
+      }
+      if (!match && blockhostIsValid(s)) {
+        if (GB_STRDUP(list->hosts[list->nhosts], h) < 0) {
+          goto out;
+        }
+        list->nhosts++;
+      }
+      break; /* switch case */
+    }
+  }
+
+  if (list->nhosts || *savelist) {
+    *savelist = list;
+  } else {
+    blockServerDefFree(list);
+  }
+  list = NULL;
+  ret = 0;
+
+ out:
+  GB_FREE(buf);
+  if (list != *savelist) {
+    blockServerDefFree(list);
+  }
+
+  return ret;
+}
+
+
+int
+blockGetMetaInfo(struct glfs* glfs, char* metafile, MetaInfo *info,
+                 int *errCode)
+{
+  char *buf = NULL;
+  char *pos;
+  char *key, *value;
+  int ret = -1;
+
+
+  if (blockMetaRead(glfs, metafile, &buf, errCode)) {
+    goto out;
+  }
+
+  if (GB_REALLOC_N(info->list, info->nhosts + blockMetaLineCount(buf)) < 0) {
+    if (errCode) {
+      *errCode = ENOMEM;
+    }
+    goto out;
+  }
+
+  pos = buf;
+  while (blockMetaNextLine(&pos, &key, &value)) {
+    if (!value) {
+      continue;
+    }
+    if (blockStuffMetaInfo(info, key, value)) {
+      if (errCode) {
+        *errCode = errno;
+      }
+      LOG("gfapi", GB_LOG_ERROR,
+          "blockStuffMetaInfo: on volume %s for block %s failed[%s]",
+          info->volume, metafile, strerror(errno));
+      goto out;
+    }
+  }
+
+  ret = 0;
+
+ out:
+  GB_FREE(buf);
+
+  return ret;
+}
+
+
+typedef struct blockMetaKey {
+  char *key;
+  char *last;      /* value of its last line */
+  char *valid;     /* last in use status, of hosts */
+} blockMetaKey;
+
+
+/* Rewrites metafile to the state it describes, once it has more than
+ * GB_META_COMPACT_LINES lines. A host keeps its last in use status ahead
+ * of its last one, which blockParseValidServers() goes by. Call with the
+ * metadata lock held. */
+int
+blockMetaCompact(struct glfs *glfs, char *volume, char *metafile)
+{
+  char tname[PATH_MAX] = {0};
+  struct glfs_object *tmp = NULL;
+  struct glfs_object *dir;
+  struct glfs_object *obj;
+  struct glfs_fd *tgmfd = NULL;
+  blockMetaKey *keys = NULL;
+  char *buf = NULL;
+  char *out = NULL;
+  char *pos;
+  char *key, *value;
+  size_t lines;
+  size_t nkeys = 0;
+  size_t len = 0;
+  size_t i;
+  bool written = false;
+  int ret = -1;
+
+
+  if (blockMetaRead(glfs, metafile, &buf, NULL)) {
+    goto out;
+  }
+
+  lines = blockMetaLineCount(buf);
+  if (lines <= GB_META_COMPACT_LINES) {
+    ret = 0;
+    goto out;
+  }
+
+  if (GB_ALLOC_N(keys, lines) < 0 ||
+      GB_ALLOC_N(out, strlen(buf) + 2 * lines + 1) < 0) {
+    goto out;
+  }
+
+  pos = buf;
+  while (blockMetaNextLine(&pos, &key, &value)) {
+    if (!value) {
+      continue;
+    }
+    for (i = 0; i < nkeys && strcmp(keys[i].key, key); i++);
+    if (i == nkeys) {
+      keys[nkeys++].key = key;
+    }
+    keys[i].last = value;
+    if (blockMetaKeyEnumParse(key) == GB_METAKEY_MAX &&
+        blockhostIsValid(value)) {
+      keys[i].valid = value;
+    }
+  }
+
+  for (i = 0; i < nkeys; i++) {
+    if (keys[i].valid && keys[i].valid != keys[i].last) {
+      len += sprintf(out + len, "%s: %s\n", keys[i].key, keys[i].valid);
+    }
+    len += sprintf(out + len, "%s: %s\n", keys[i].key, keys[i].last);
+  }
+
+  obj = blockMetaLookup(glfs, metafile, &dir);
+  if (!obj) {
+    LOG("gfapi", GB_LOG_ERROR, "lookup of %s: on volume %s failed[%s]",
+        metafile, volume, strerror(errno));
+    goto out;
+  }
+  glfs_h_close(obj);
+
+  /* kept out of GB_METADIR, older daemons list all in there but
+   * meta.lock as blocks */
+  tmp = blockDirHandle(glfs, GB_CACHE_METATMPDIR);
+  if (!tmp) {
+    goto out;
+  }
+
+  snprintf(tname, sizeof tname, "%s.compact", metafile);
+  tgmfd = blockOpenIn(glfs, tmp, tname, O_WRONLY | O_CREAT | O_TRUNC | O_SYNC);
+  if (!tgmfd) {
+    LOG("gfapi", GB_LOG_ERROR, "glfs_creat(%s): on volume %s failed[%s]",
+        tname, volume, strerror(errno));
+    goto out;
+  }
+  written = true;
+
+  if (glfs_write(tgmfd, out, len, 0) != (ssize_t)len) {
+    LOG("gfapi", GB_LOG_ERROR, "glfs_write(%s): on volume %s failed[%s]",
+        tname, volume, strerror(errno));
+    goto out;
+  }
+
+  ret = glfs_close(tgmfd);
+  tgmfd = NULL;
+  if (ret) {
+    LOG("gfapi", GB_LOG_ERROR, "glfs_close(%s): on volume %s failed[%s]",
+        tname, volume, strerror(errno));
+    goto out;
+  }
+
+  ret = glfs_h_rename(glfs, tmp, tname, dir, metafile);
+  if (ret) {
+    LOG("gfapi", GB_LOG_ERROR, "glfs_rename(%s, %s): on volume %s failed[%s]",
+        tname, metafile, volume, strerror(errno));
+    goto out;
+  }
+  written = false;
+
+  LOG("mgmt", GB_LOG_INFO, "compacted metadata of %s/%s, %zu lines to %zu keys",
+      volume, metafile, lines, nkeys);
+
+ out:
+  if (tgmfd) {
+    glfs_close(tgmfd);
+  }
+  if (written) {
+    glfs_h_unlink(glfs, tmp, tname);
+  }
+  GB_FREE(keys);
+  GB_FREE(out);
+  GB_FREE(buf);
+
+  return ret;
+}
+
+
+gbMetaTxn *
+blockMetaTxnBegin(struct glfs *glfs, char *volume, char *name)
+{
+  gbMetaTxn *txn;
 
-    if (blk->prealloc && glfs_zerofill(tgfd, 0, blk->size)) {
-      *errCode = errno;
-      LOG("gfapi", GB_LOG_ERROR,
-          "glfs_zerofill(%s): on volume %s for block %s "
-          "of size %zu failed[%s]", gbid, blk->volume, blk->block_name,
-          blk->size, strerror(errno));
-      ret = -1;
-      goto unlink;
-    }
+
+  if (GB_ALLOC(txn) < 0) {
+    return NULL;
   }
+  txn->glfs = glfs;
+  GB_STRCPYSTATIC(txn->volume, volume);
+  GB_STRCPYSTATIC(txn->name, name);
+  pthread_mutex_init(&txn->lock, NULL);
+  pthread_cond_init(&txn->cond, NULL);
 
+  LOCK(metaTxnsLock);
+  list_add(&txn->list, &metaTxns);
+  UNLOCK(metaTxnsLock);
 
-unlink:
-  if (tgfd && glfs_close(tgfd) != 0) {
-    *errCode = errno;
-    LOG("gfapi", GB_LOG_ERROR,
-        "glfs_close(%s): on volume %s for block %s failed[%s]",
-        gbid, blk->volume, blk->block_name, strerror(errno));
-    ret = -1;
+  return txn;
+}
+
+
+/* All updates of txn have to be done */
+void
+blockMetaTxnEnd(gbMetaTxn *txn)
+{
+  if (!txn) {
+    return;
   }
 
-  if (ret && glfs_unlink(glfs, gbid) && errno != ENOENT) {
-    *errCode = errno;
-    LOG("gfapi", GB_LOG_ERROR,
-        "glfs_unlink(%s) on volume %s for block %s failed[%s]",
-        gbid, blk->volume, blk->block_name, strerror(errno));
+  LOCK(metaTxnsLock);
+  list_del(&txn->list);
+  UNLOCK(metaTxnsLock);
+
+  if (txn->fd && glfs_close(txn->fd)) {
+    LOG("mgmt", GB_LOG_ERROR, "glfs_close(%s): on volume %s failed[%s]",
+        txn->name, txn->volume, strerror(errno));
   }
+  pthread_mutex_destroy(&txn->lock);
+  pthread_cond_destroy(&txn->cond);
+  GB_FREE(txn->pending);
+  GB_FREE(txn);
+}
 
- out:
-  if (ret) {
-    if (!errMsg) {
-      GB_ASPRINTF (errMsg, "Not able to create storage for %s/%s [%s]",
-                   blk->volume, blk->block_name, strerror(*errCode));
-    }
 
-    GB_ASPRINTF(&tmp, "%s/%s", GB_METADIR, blk->block_name);
+static gbMetaTxn *
+blockMetaTxnLookup(struct glfs *glfs, char *name)
+{
+  gbMetaTxn *txn;
 
-    if (glfs_unlink(glfs, tmp) && errno != ENOENT) {
-      LOG("gfapi", GB_LOG_ERROR,
-          "glfs_unlink(%s) on volume %s for block %s failed[%s]",
-          tmp, blk->volume, blk->block_name, strerror(errno));
+
+  LOCK(metaTxnsLock);
+  list_for_each_entry(txn, &metaTxns, list) {
+    if (txn->glfs == glfs && !strcmp(txn->name, name)) {
+      UNLOCK(metaTxnsLock);
+      return txn;
     }
-    GB_FREE(tmp);
   }
+  UNLOCK(metaTxnsLock);
 
-  return ret;
+  return NULL;
 }
 
 
-int
-glusterBlockDeleteEntry(struct glfs *glfs, char *volume, char *gbid)
+/* Writes out the lines queued in txn, call with txn->lock held */
+static void
+blockMetaTxnWrite(gbMetaTxn *txn)
 {
-  int ret;
-
-
-  ret = glfs_chdir (glfs, GB_STOREDIR);
-  if (ret) {
-    LOG("gfapi", GB_LOG_ERROR, "glfs_chdir(%s) on volume %s failed[%s]",
-        GB_STOREDIR, volume, strerror(errno));
-    goto out;
+  char *buf = txn->pending;
+  size_t len = txn->npending;
+  unsigned long from = txn->written + 1;
+  unsigned long upto = txn->queued;
+  int ret = 0;
+
+
+  txn->writing = true;
+  txn->pending = NULL;
+  txn->npending = 0;
+  UNLOCK(txn->lock);
+
+  if (!txn->fd) {
+    txn->fd = blockMetaOpen(txn->glfs, txn->name,
+                            O_WRONLY | O_CREAT | O_APPEND | O_SYNC);
+    if (!txn->fd) {
+      ret = errno;
+      LOG("mgmt", GB_LOG_ERROR, "glfs_creat(%s): on volume %s failed[%s]",
+          txn->name, txn->volume, strerror(errno));
+    }
   }
 
-  ret = glfs_unlink(glfs, gbid);
-  if (ret && errno != ENOENT) {
-    LOG("gfapi", GB_LOG_ERROR, "glfs_unlink(%s) on volume %s failed[%s]",
-        gbid, volume, strerror(errno));
+  if (!ret && glfs_write(txn->fd, buf, len, 0) != (ssize_t)len) {
+    ret = errno ? errno : EIO;
+    LOG("mgmt", GB_LOG_ERROR, "glfs_write(%s): on volume %s failed[%s]",
+        txn->name, txn->volume, strerror(ret));
   }
+  GB_FREE(buf);
 
- out:
-  return ret;
+  LOCK(txn->lock);
+  txn->written = upto;
+  if (ret && !txn->failedAt) {
+    txn->failedAt = from;
+    txn->error = ret;
+  }
+  txn->writing = false;
+  pthread_cond_broadcast(&txn->cond);
 }
 
 
-struct glfs_fd *
-glusterBlockCreateMetaLockFile(struct glfs *glfs, char *volume, int *errCode,
-                               char **errMsg)
+static int
+blockMetaTxnAppend(gbMetaTxn *txn, const char *line)
 {
-  struct glfs_fd *lkfd;
-  int ret;
+  size_t len = strlen(line);
+  unsigned long mine;
+  int ret = -1;
 
 
-  ret = glfs_mkdir (glfs, GB_METADIR, 0);
-  if (ret && errno != EEXIST) {
-    *errCode = errno;
-    LOG("gfapi", GB_LOG_ERROR, "glfs_mkdir(%s) on volume %s failed[%s]",
-        GB_METADIR, volume, strerror(*errCode));
+  LOCK(txn->lock);
+  if (txn->failedAt) {
+    errno = txn->error;
     goto out;
   }
 
-  ret = glfs_chdir (glfs, GB_METADIR);
-  if (ret) {
-    *errCode = errno;
-    LOG("gfapi", GB_LOG_ERROR, "glfs_chdir(%s) on volume %s failed[%s]",
-        GB_METADIR, volume, strerror(*errCode));
+  if (GB_REALLOC_N(txn->pending, txn->npending + len + 1) < 0) {
     goto out;
   }
+  memcpy(txn->pending + txn->npending, line, len + 1);
+  txn->npending += len;
+  mine = ++txn->queued;
+
+  /* whoever finds no write running writes out all queued so far */
+  while (txn->written < mine) {
+    if (txn->writing) {
+      pthread_cond_wait(&txn->cond, &txn->lock);
+    } else if (txn->failedAt) {
+      /* the file is in doubt, nothing more goes out */
+      txn->written = txn->queued;
+      GB_FREE(txn->pending);
+      txn->npending = 0;
+    } else {
+      blockMetaTxnWrite(txn);
+    }
+  }
 
-  lkfd = glfs_creat(glfs, GB_TXLOCKFILE, O_RDWR, S_IRUSR | S_IWUSR);
-  if (!lkfd) {
-    *errCode = errno;
-    LOG("gfapi", GB_LOG_ERROR, "glfs_creat(%s) on volume %s failed[%s]",
-        GB_TXLOCKFILE, volume, strerror(*errCode));
+  if (txn->failedAt && mine >= txn->failedAt) {
+    errno = txn->error;
     goto out;
   }
-
-  return lkfd;
+  ret = 0;
 
  out:
-  GB_ASPRINTF (errMsg, "Not able to create Metadata on volume %s[%s]", volume,
-               strerror (*errCode));
-  return NULL;
+  UNLOCK(txn->lock);
+
+  return ret;
 }
 
-int
-glusterBlockDeleteMetaFile(struct glfs *glfs,
-                               char *volume, char *blockname)
+
+static pthread_mutex_t *
+blockMetaLockFor(const char *volume, const char *name)
 {
-  int ret;
+  unsigned long hash = 5381;
 
 
-  ret = glfs_chdir (glfs, GB_METADIR);
-  if (ret) {
-    LOG("gfapi", GB_LOG_ERROR,
-        "glfs_chdir(%s) on volume %s for block %s failed[%s]",
-        GB_METADIR, volume, blockname, strerror(errno));
-    goto out;
+  while (*volume) {
+    hash = hash * 33 + (unsigned char)*volume++;
   }
-
-  ret = glfs_unlink(glfs, blockname);
-  if (ret && errno != ENOENT) {
-    LOG("gfapi", GB_LOG_ERROR, "glfs_unlink(%s) on volume %s failed[%s]",
-        blockname, volume, strerror(errno));
-    goto out;
+  hash = hash * 33 + '/';
+  while (*name) {
+    hash = hash * 33 + (unsigned char)*name++;
   }
 
- out:
-  return ret;
+  return &metaLocks[hash % GB_META_LOCK_STRIPES];
 }
 
 
-void
-blockFreeMetaInfo(MetaInfo *info)
+/* Appends line to the meta file of block name, durably. Goes through the
+ * transaction on the block if there is one. */
+int
+blockMetaAppend(struct glfs *glfs, char *volume, char *name, const char *line)
 {
-  int i;
+  pthread_mutex_t *lock;
+  struct glfs_fd *tgmfd;
+  gbMetaTxn *txn;
+  int errsv = 0;
+  int ret = 0;
 
 
-  if (!info)
-    return;
+  txn = blockMetaTxnLookup(glfs, name);
+  if (txn) {
+    return blockMetaTxnAppend(txn, line);
+  }
 
-  for (i = 0; i < info->nhosts; i++) {
-    GB_FREE(info->list[i]);
+  lock = blockMetaLockFor(volume, name);
+
+  LOCK(*lock);
+  tgmfd = blockMetaOpen(glfs, name, O_WRONLY | O_CREAT | O_APPEND | O_SYNC);
+  if (!tgmfd) {
+    errsv = errno;
+    LOG("mgmt", GB_LOG_ERROR, "glfs_creat(%s): on volume %s failed[%s]",
+        name, volume, strerror(errno));
+    ret = -1;
+    goto out;
   }
 
-  GB_FREE(info->list);
-  GB_FREE(info);
+  if (glfs_write(tgmfd, line, strlen(line), 0) < 0) {
+    errsv = errno;
+    LOG("mgmt", GB_LOG_ERROR, "glfs_write(%s): on volume %s failed[%s]",
+        name, volume, strerror(errno));
+    ret = -1;
+  }
+
+  if (glfs_close(tgmfd) != 0) {
+    errsv = errno;
+    LOG("mgmt", GB_LOG_ERROR, "glfs_close(%s): on volume %s failed[%s]",
+        name, volume, strerror(errno));
+    ret = -1;
+  }
+
+ out:
+  UNLOCK(*lock);
+  if (errsv) {
+    errno = errsv;
+  }
+
+  return ret;
 }
 
 
+/* Replaces GB_METALAYOUTFILE, call with the namespace locked */
 static int
-blockStuffMetaInfo(MetaInfo *info, char *line)
+blockMetaLayoutWrite(struct glfs *glfs, char *volume, int layout)
 {
-  char *tmp = strdup(line);
-  char *opt = strtok(tmp, ":");
-  bool flag = 0;
-  int  ret = -1;
-  size_t i;
+  const char *tname = GB_METALAYOUTFILE ".tmp";
+  struct glfs_object *top;
+  struct glfs_fd *fd;
+  char buf[32];
+  int len;
 
 
-  switch (blockMetaKeyEnumParse(opt)) {
-  case GB_META_VOLUME:
-    GB_STRCPYSTATIC(info->volume, strchr(line, ' ') + 1);
-    break;
-  case GB_META_GBID:
-     GB_STRCPYSTATIC(info->gbid, strchr(line, ' ') + 1);
-    break;
-  case GB_META_SIZE:
-    sscanf(strchr(line, ' '), "%zu", &info->size);
-    break;
-  case GB_META_HA:
-    sscanf(strchr(line, ' '), "%zu", &info->mpath);
-    break;
-  case GB_META_ENTRYCREATE:
-    GB_STRCPYSTATIC(info->entry, strchr(line, ' ') + 1);
-    break;
-  case GB_META_PASSWD:
-    GB_STRCPYSTATIC(info->passwd, strchr(line, ' ') + 1);
-    break;
+  top = blockDirHandle(glfs, GB_CACHE_METADIR);
+  if (!top) {
+    return -1;
+  }
 
-  default:
-    if(!info->list) {
-      if(GB_ALLOC(info->list) < 0)
-        goto out;
-      if(GB_ALLOC(info->list[0]) < 0)
-        goto out;
-      GB_STRCPYSTATIC(info->list[0]->addr, opt);
-      GB_STRCPYSTATIC(info->list[0]->status, strchr(line, ' ') + 1);
-      info->nhosts = 1;
-    } else {
-      if(GB_REALLOC_N(info->list, info->nhosts+1) < 0)
-        goto out;
-      for (i = 0; i < info->nhosts; i++) {
-        if(!strcmp(info->list[i]->addr, opt)) {
-          GB_STRCPYSTATIC(info->list[i]->status, strchr(line, ' ') + 1);
-          flag = 1;
-          break;
-        }
-      }
-      if (!flag) {
-        if(GB_ALLOC(info->list[info->nhosts]) < 0)
-          goto out;
-        GB_STRCPYSTATIC(info->list[info->nhosts]->addr, opt);
-        GB_STRCPYSTATIC(info->list[info->nhosts]->status, strchr(line, ' ') + 1);
-        info->nhosts++;
-      }
-    }
-    break;
+  fd = blockOpenIn(glfs, top, tname, O_WRONLY | O_CREAT | O_TRUNC | O_SYNC);
+  if (!fd) {
+    LOG("gfapi", GB_LOG_ERROR, "glfs_creat(%s): on volume %s failed[%s]",
+        tname, volume, strerror(errno));
+    return -1;
   }
 
-  ret = 0;
+  len = snprintf(buf, sizeof buf, "%s\n", gbMetaLayoutLookup[layout]);
+  if (glfs_write(fd, buf, len, 0) != len) {
+    LOG("gfapi", GB_LOG_ERROR, "glfs_write(%s): on volume %s failed[%s]",
+        tname, volume, strerror(errno));
+    glfs_close(fd);
+    return -1;
+  }
 
- out:
-  GB_FREE(tmp);
+  if (glfs_close(fd) ||
+      glfs_h_rename(glfs, top, tname, top, GB_METALAYOUTFILE)) {
+    LOG("gfapi", GB_LOG_ERROR, "writing %s: on volume %s failed[%s]",
+        GB_METALAYOUTFILE, volume, strerror(errno));
+    return -1;
+  }
 
-  return ret;
+  storeCacheLayout(glfs, layout);
+
+  return 0;
 }
 
 
-int
-blockParseValidServers(struct glfs* glfs, char *metafile,
-                       int *errCode, blockServerDefPtr *savelist, char *skiphost)
+/* Moves up to GB_META_MIGRATE_BATCH meta files still in GB_METADIR into
+ * their buckets. The namespace stays locked, so listings and creates never
+ * see a batch halfway, and each block is locked while it moves; blocks in
+ * use are left for later and counted in *busy, rather than waited for
+ * with the namespace locked. Returns how many moved, 0 once none are left
+ * and the layout is hashed, or if all were busy. */
+static int
+blockMetaMigrateBatch(struct glfs *glfs, struct glfs_fd *lkfd, char *volume,
+                      size_t *busy)
 {
-  blockServerDefPtr list = *savelist;
-  char fpath[PATH_MAX] = {0};
-  struct glfs_fd *tgmfd = NULL;
-  char line[1024];
+  char (*names)[256] = NULL;
+  struct glfs_object *top;
+  struct glfs_object *bucket;
+  struct glfs_object *obj;
+  struct glfs_fd *tgmdfd = NULL;
+  struct dirent *entry;
+  size_t count = 0;
+  size_t i;
+  int moved = 0;
+  int layout;
+  int errCode = 0;
+  char *errMsg = NULL;
   int ret = -1;
-  char *h, *s, *sep;
-  size_t i, count = 0;
-  bool match;
 
 
-  snprintf(fpath, sizeof fpath, "%s/%s", GB_METADIR, metafile);
-  tgmfd = glfs_open(glfs, fpath, O_RDONLY);
-  if (!tgmfd) {
-    if (errCode) {
-      *errCode = errno;
-    }
-    LOG("gfapi", GB_LOG_ERROR, "glfs_open(%s) failed[%s]", metafile,
-                               strerror(errno));
-    goto out;
+  if (GB_ALLOC_N(names, GB_META_MIGRATE_BATCH) < 0) {
+    return -1;
   }
 
-  while ((ret = glfs_read (tgmfd, line, sizeof(line), 0)) > 0) {
-    /* clip till current line */
-    h = line;
-    sep = strchr(h, '\n');
-    *sep = '\0';
+  GB_METALOCK_OR_GOTO(lkfd, volume, errCode, errMsg, out);
 
-    count += strlen(h) + 1;
+  layout = blockMetaLayoutRefresh(glfs, queryCacheLayout(glfs));
+  if (layout == GB_META_LAYOUT_HASHED) {
+    ret = 0;
+    goto unlock;
+  }
 
-    /* Part before ':' */
-    sep = strchr(h, ':');
-    *sep = '\0';
+  /* from here on new blocks go to buckets, and lookups try both */
+  if (layout == GB_META_LAYOUT_FLAT &&
+      blockMetaLayoutWrite(glfs, volume, GB_META_LAYOUT_MIGRATING)) {
+    goto unlock;
+  }
 
-    switch (blockMetaKeyEnumParse(h)) {
-    case GB_META_VOLUME:
-    case GB_META_GBID:
-    case GB_META_SIZE:
-    case GB_META_HA:
-    case GB_META_ENTRYCREATE:
-    case GB_META_PASSWD:
-      break;
-    default:
-      if (skiphost && !strcmp(h, skiphost)) {
-        break; /* switch case */
-      }
-      /* Part after ':' and before '\n' */
-      s = sep + 1;
-      while(*s == ' ') {
-        s++;
-      }
+  top = blockDirHandle(glfs, GB_CACHE_METADIR);
+  if (top) {
+    tgmdfd = glfs_h_opendir(glfs, top);
+  }
+  if (!tgmdfd) {
+    LOG("gfapi", GB_LOG_ERROR, "glfs_opendir(%s): on volume %s failed[%s]",
+        GB_METADIR, volume, strerror(errno));
+    goto unlock;
+  }
 
-      if (!list) {
-        if (blockhostIsValid(s)) {
-          if (GB_ALLOC(list) < 0)
-            goto out;
-          if (GB_ALLOC(list->hosts) < 0)
-            goto out;
-          if (GB_STRDUP(list->hosts[0], h) < 0)
-            goto out;
+  while (count < GB_META_MIGRATE_BATCH && (entry = glfs_readdir(tgmdfd))) {
+    if (entry->d_name[0] != '.' && strcmp(entry->d_name, GB_TXLOCKFILE)) {
+      GB_STRCPYSTATIC(names[count], entry->d_name);
+      count++;
+    }
+  }
+  glfs_closedir(tgmdfd);
 
-          list->nhosts = 1;
-        }
-      } else {
-        match = false;
-        for (i = 0; i < list->nhosts; i++) {
-          if (!strcmp(list->hosts[i], h)) {
-            match = true;
-            break; /* for loop */
-          }
-        }
-        if (!match && blockhostIsValid(s)){
-          if(GB_REALLOC_N(list->hosts, list->nhosts+1) < 0)
-            goto out;
-          if (GB_STRDUP(list->hosts[list->nhosts], h) < 0)
-            goto out;
+  if (!count) {
+    ret = blockMetaLayoutWrite(glfs, volume, GB_META_LAYOUT_HASHED);
+    goto unlock;
+  }
 
-          list->nhosts++;
-        }
+  for (i = 0; i < count; i++) {
+    if (blockMetaTryLock(lkfd, volume, names[i])) {
+      if (errno != EBUSY) {
+        goto unlock;
       }
-      break; /* switch case */
+      (*busy)++;
+      continue;
     }
 
-    glfs_lseek(tgmfd, count, SEEK_SET);
-  }
+    bucket = blockBucketHandle(glfs, blockNameHash(names[i]) % GB_META_BUCKETS,
+                               true);
+    obj = bucket ? glfs_h_lookupat(glfs, bucket, names[i], NULL, 0) : NULL;
+    if (obj) {
+      /* never clobber one, the flat file stays where it is */
+      glfs_h_close(obj);
+      LOG("mgmt", GB_LOG_ERROR, "%s of volume %s is both in %s and its bucket",
+          names[i], volume, GB_METADIR);
+    } else if (bucket && errno == ENOENT &&
+               !glfs_h_rename(glfs, top, names[i], bucket, names[i])) {
+      moved++;
+    } else if (errno != ENOENT) {
+      LOG("mgmt", GB_LOG_ERROR, "moving %s/%s on volume %s failed[%s]",
+          GB_METADIR, names[i], volume, strerror(errno));
+    }
 
-  if (ret < 0 && errCode) { /*Failure from glfs_read*/
-    *errCode = errno;
-    goto out;
+    GB_BLOCKUNLOCK(lkfd, volume, names[i], errCode, errMsg);
   }
 
-  *savelist = list;
-  list = NULL;
-  ret = 0;
+  /* stuck, rather than going round forever */
+  ret = (moved || *busy) ? moved : -1;
+
+ unlock:
+  GB_METAUNLOCK(lkfd, volume, errCode, errMsg);
 
  out:
-  if (tgmfd && glfs_close(tgmfd) != 0) {
-    LOG("gfapi", GB_LOG_ERROR, "glfs_close(%s): failed[%s]",
-        metafile, strerror(errno));
+  if (errMsg) {
+    LOG("mgmt", GB_LOG_ERROR, "%s", errMsg);
+    GB_FREE(errMsg);
   }
-  blockServerDefFree(list);
+  GB_FREE(names);
 
   return ret;
 }
 
 
-int
-blockGetMetaInfo(struct glfs* glfs, char* metafile, MetaInfo *info,
-                 int *errCode)
+static void *
+blockMetaMigrate(void *data)
 {
-  size_t count = 0;
-  struct glfs_fd *tgmfd = NULL;
-  char line[1024];
-  char fpath[PATH_MAX] = {0};
-  char *tmp;
+  gbMetaMigration *mig = data;
+  struct glfs *glfs;
+  struct glfs_fd *lkfd;
+  size_t moved = 0;
+  size_t busy;
+  int errCode = 0;
+  char *errMsg = NULL;
   int ret;
 
-  snprintf(fpath, sizeof fpath, "%s/%s", GB_METADIR, metafile);
-  tgmfd = glfs_open(glfs, fpath, O_RDONLY);
-  if (!tgmfd) {
-    if (errCode) {
-      *errCode = errno;
-    }
-    LOG("gfapi", GB_LOG_ERROR, "glfs_open(%s) failed[%s]", metafile,
-                               strerror(errno));
+
+  LOG("mgmt", GB_LOG_INFO, "moving metadata of volume %s to %s layout",
+      mig->volume, gbMetaLayoutLookup[GB_META_LAYOUT_HASHED]);
+
+  /* the volume is looked up again for every batch, so the cache is free
+   * to evict it in between */
+  do {
     ret = -1;
-    goto out;
-  }
+    glfs = glusterBlockVolumeInit(mig->volume, &errCode, &errMsg);
+    if (!glfs) {
+      break;
+    }
 
-  while ((ret = glfs_read (tgmfd, line, sizeof(line), 0)) > 0) {
-    tmp = strtok(line,"\n");
-    count += strlen(tmp) + 1;
-    ret = blockStuffMetaInfo(info, tmp);
-    if (ret) {
-      if (errCode) {
-        *errCode = errno;
-      }
-      LOG("gfapi", GB_LOG_ERROR,
-          "blockStuffMetaInfo: on volume %s for block %s failed[%s]",
-          info->volume, metafile, strerror(errno));
-      goto out;
+    lkfd = glusterBlockCreateMetaLockFile(glfs, mig->volume, &errCode,
+                                          &errMsg);
+    if (!lkfd) {
+      glusterBlockVolumeRelease(glfs);
+      break;
     }
-    glfs_lseek(tgmfd, count, SEEK_SET);
+
+    busy = 0;
+    ret = blockMetaMigrateBatch(glfs, lkfd, mig->volume, &busy);
+    glusterBlockVolumeRelease(glfs);
+    if (ret > 0) {
+      moved += ret;
+    } else if (!ret && busy) {
+      /* all it got to were in use, give them time */
+      sleep(GB_META_MIGRATE_PAUSE);
+    }
+  } while (ret > 0 || (!ret && busy));
+
+  if (!ret) {
+    LOG("mgmt", GB_LOG_INFO, "metadata of volume %s is %s, moved %zu blocks",
+        mig->volume, gbMetaLayoutLookup[GB_META_LAYOUT_HASHED], moved);
+  } else {
+    LOG("mgmt", GB_LOG_ERROR, "moving metadata of volume %s stopped after "
+        "%zu blocks, it stays %s %s", mig->volume, moved,
+        gbMetaLayoutLookup[GB_META_LAYOUT_MIGRATING], errMsg ? errMsg : "");
   }
-  if (ret < 0 && errCode) {/*Failure from glfs_read*/
-    *errCode = errno;
-    goto out;
+  GB_FREE(errMsg);
+
+  LOCK(metaMigrationsLock);
+  list_del(&mig->list);
+  UNLOCK(metaMigrationsLock);
+  GB_FREE(mig);
+
+  return NULL;
+}
+
+
+/* Moves the volume to the hashed layout in the background, requests are
+ * served meanwhile */
+static void
+blockMetaMigrateStart(char *volume)
+{
+  gbMetaMigration *mig;
+  int ret;
+
+
+  LOCK(metaMigrationsLock);
+  list_for_each_entry(mig, &metaMigrations, list) {
+    if (!strcmp(mig->volume, volume)) {
+      UNLOCK(metaMigrationsLock);
+      return;
+    }
   }
 
- out:
-  if (tgmfd && glfs_close(tgmfd) != 0) {
-    LOG("gfapi", GB_LOG_ERROR, "glfs_close(%s): on volume %s failed[%s]",
-        metafile, info->volume, strerror(errno));
+  if (GB_ALLOC(mig) < 0) {
+    UNLOCK(metaMigrationsLock);
+    return;
   }
+  GB_STRCPYSTATIC(mig->volume, volume);
+  list_add(&mig->list, &metaMigrations);
+  UNLOCK(metaMigrationsLock);
 
-  return ret;
+  ret = blockStartDetached(blockMetaMigrate, mig);
+  if (ret) {
+    LOG("mgmt", GB_LOG_ERROR, "starting to move metadata of volume %s "
+        "failed[%s]", volume, strerror(ret));
+    LOCK(metaMigrationsLock);
+    list_del(&mig->list);
+    UNLOCK(metaMigrationsLock);
+    GB_FREE(mig);
+  }
 }
@@ -20,6 +20,34 @@
 # include  "lru.h"
 # include  "block.h"
 
+# define   GB_META_COMPACT_LINES   128
+# define   GB_METALOCK_SLOTS       (1UL << 30)  /* bytes of meta.lock */
+# define   GB_META_MIGRATE_BATCH   256
+# define   GB_META_MIGRATE_PAUSE   1    /* secs, when a batch found all busy */
+
+
+/* Where the meta files of a volume are, as GB_METALAYOUTFILE says; flat
+ * when there is none. Layouts only move down this list. */
+typedef enum gbMetaLayout {
+  GB_META_LAYOUT_FLAT      = 0,  /* all in GB_METADIR */
+  GB_META_LAYOUT_MIGRATING = 1,  /* hashed, some may still be flat */
+  GB_META_LAYOUT_HASHED    = 2,  /* in GB_META_BUCKETS subdirs of it */
+
+  GB_META_LAYOUT_MAX
+} gbMetaLayout;
+
+
+static const char *const gbMetaLayoutLookup[] = {
+  [GB_META_LAYOUT_FLAT]      = "flat",
+  [GB_META_LAYOUT_MIGRATING] = "migrating",
+  [GB_META_LAYOUT_HASHED]    = "hashed",
+
+  [GB_META_LAYOUT_MAX]       = NULL,
+};
+
+/* layout flat volumes are moved to at init */
+extern int gbMetaLayoutType;
+
 
 
 typedef struct NodeInfo {
@@ -39,10 +67,22 @@ typedef struct MetaInfo {
   NodeInfo **list;
 } MetaInfo;
 
+typedef struct gbMetaTxn gbMetaTxn;
+typedef struct gbMetaDir gbMetaDir;
+
+
+int
+gbMetaLayoutEnumParse(const char *opt);
 
 struct glfs *
 glusterBlockVolumeInit(char *volume, int *errCode, char **errMsg);
 
+int
+glusterBlockVolumeInitAsync(char *volume);
+
+void
+glusterBlockVolumeRelease(struct glfs *glfs);
+
 int
 glusterBlockCreateEntry(struct glfs *glfs, blockCreateCli *blk, char *gbid,
                         int *errCode, char **errMsg);
@@ -54,6 +94,33 @@ struct glfs_fd *
 glusterBlockCreateMetaLockFile(struct glfs *glfs, char *volume, int *errCode,
                                char **errMsg);
 
+int
+glusterBlockMetaLock(struct glfs_fd *lkfd, char *volume, char *block,
+                     int *errCode, char **errMsg);
+
+int
+glusterBlockMetaUnlock(struct glfs_fd *lkfd, char *volume, char *block,
+                       char **errMsg);
+
+int
+glusterBlockMetaLockShared(struct glfs *glfs, char *volume, char *block,
+                           int *errCode, char **errMsg);
+
+int
+glusterBlockMetaUnlockShared(char *volume, char *block, char **errMsg);
+
+int
+blockMetaAccess(struct glfs *glfs, char *name);
+
+gbMetaDir *
+blockMetaOpendir(struct glfs *glfs, unsigned long long offset);
+
+const char *
+blockMetaReaddir(gbMetaDir *dir, unsigned long long *pos);
+
+int
+blockMetaClosedir(gbMetaDir *dir);
+
 int
 glusterBlockDeleteMetaFile(struct glfs *glfs, char *volume, char *blockname);
 
@@ -68,4 +135,16 @@ int
 blockParseValidServers(struct glfs* glfs, char *metafile, int *errCode,
                        blockServerDefPtr *savelist, char *skiphost);
 
+int
+blockMetaCompact(struct glfs *glfs, char *volume, char *metafile);
+
+gbMetaTxn *
+blockMetaTxnBegin(struct glfs *glfs, char *volume, char *name);
+
+void
+blockMetaTxnEnd(gbMetaTxn *txn);
+
+int
+blockMetaAppend(struct glfs *glfs, char *volume, char *name, const char *line);
+
 #endif /* _GLFS_OPERATIONS_H */
@@ -0,0 +1,1235 @@
+/*
+  Copyright (c) 2018 Red Hat, Inc. <http://www.redhat.com>
+  This file is part of gluster-block.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+
+# define   _GNU_SOURCE
+# include  <dirent.h>
+# include  <fcntl.h>
+# include  <ftw.h>
+# include  <pthread.h>
+# include  <stdarg.h>
+# include  <sys/stat.h>
+# include  <sys/vfs.h>
+
+# include  "lio-operations.h"
+# include  "list.h"
+
+# ifndef   CONFIGFS_MAGIC
+# define   CONFIGFS_MAGIC       0x62656570
+# endif
+
+# define   GB_LIO_USER_HBA      "user_"
+# define   GB_LIO_TPGT          "tpgt_"
+# define   GB_LIO_LUN           "lun_"
+# define   GB_LIO_LUN_ALIAS     "gluster-block"
+# define   GB_LIO_PORTAL_PORT   3260
+# define   GB_LIO_CONFIG_GLFS   "Config: glfs/"
+
+
+int gbLioBackendType = GB_LIO_TARGETCLI;
+
+static char configfsRoot[PATH_MAX] = GB_CONFIGFS_ROOT;
+
+/* A plain directory tree standing in for configfs (tests), where we
+ * have to create the default groups the kernel would, and can't rely
+ * on rmdir() taking the attribute files along. */
+static bool configfsFake;
+
+static pthread_mutex_t indexLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *const soGroups[] = {"attrib", "wwn", NULL};
+static const char *const tpgGroups[] = {"acls", "attrib", "auth", "lun", "np",
+                                        "param", NULL};
+
+static int gbLioIndexBuild(void);
+
+
+int
+gbLioBackendEnumParse(const char *opt)
+{
+  int i;
+
+
+  if (!opt) {
+    return GB_LIO_BACKEND_MAX;
+  }
+
+  for (i = 0; i < GB_LIO_BACKEND_MAX; i++) {
+    if (!strcmp(opt, gbLioBackendLookup[i])) {
+      return i;
+    }
+  }
+
+  return i;
+}
+
+
+static void
+gbLioLog(char **out, const char *fmt, ...)
+{
+  va_list ap;
+  char *line = NULL;
+  char *tmp = *out;
+
+
+  va_start(ap, fmt);
+  if (vasprintf(&line, fmt, ap) == -1) {
+    line = NULL;
+  }
+  va_end(ap);
+
+  if (!line) {
+    return;
+  }
+
+  if (GB_ASPRINTF(out, "%s%s\n", tmp?tmp:"", line) == -1) {
+    *out = tmp;
+  } else {
+    GB_FREE(tmp);
+  }
+  GB_FREE(line);
+}
+
+
+static int
+gbLioWrite(const char *dir, const char *attr, const char *fmt, ...)
+{
+  char path[PATH_MAX];
+  char *val = NULL;
+  va_list ap;
+  int fd;
+  int ret = -1;
+  int errsv = 0;
+
+
+  snprintf(path, sizeof(path), "%s/%s", dir, attr);
+
+  va_start(ap, fmt);
+  if (vasprintf(&val, fmt, ap) == -1) {
+    val = NULL;
+  }
+  va_end(ap);
+
+  if (!val) {
+    return -1;
+  }
+
+  fd = open(path, O_WRONLY | (configfsFake ? (O_CREAT | O_TRUNC) : 0), 0644);
+  if (fd < 0) {
+    errsv = errno;
+    LOG("mgmt", GB_LOG_ERROR, "open(%s) failed (%s)", path, strerror(errno));
+    goto out;
+  }
+
+  if (write(fd, val, strlen(val)) != (ssize_t)strlen(val)) {
+    errsv = errno;
+    LOG("mgmt", GB_LOG_ERROR, "write(%s, %s) failed (%s)",
+        path, val, strerror(errno));
+    close(fd);
+    goto out;
+  }
+  close(fd);
+
+  ret = 0;
+ out:
+  GB_FREE(val);
+  if (errsv) {
+    errno = errsv;
+  }
+
+  return ret;
+}
+
+
+static int
+gbLioMkdir(const char *path, const char *const *groups)
+{
+  char sub[PATH_MAX];
+
+
+  if (mkdir(path, 0755)) {
+    return -1;
+  }
+
+  for (; configfsFake && groups && *groups; groups++) {
+    snprintf(sub, sizeof(sub), "%s/%s", path, *groups);
+    if (mkdir(sub, 0755) && errno != EEXIST) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+static int
+gbLioUnlinkCb(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+  return remove(path);
+}
+
+
+static int
+gbLioRmdir(const char *path)
+{
+  if (configfsFake) {
+    return nftw(path, gbLioUnlinkCb, 16, FTW_DEPTH | FTW_PHYS);
+  }
+
+  return rmdir(path);
+}
+
+
+/* Calls fn on every entry of dir whose name starts with prefix, stops at
+ * the first fn that doesn't return 0 and passes on what it returned. */
+static int
+gbLioForEach(const char *dir, const char *prefix,
+             int (*fn)(const char *path, const char *name, void *data),
+             void *data)
+{
+  DIR *dp;
+  struct dirent *entry;
+  char path[PATH_MAX];
+  int ret = 0;
+
+
+  dp = opendir(dir);
+  if (!dp) {
+    return -1;
+  }
+
+  while ((entry = readdir(dp))) {
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+      continue;
+    }
+    if (prefix && strncmp(entry->d_name, prefix, strlen(prefix))) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    ret = fn(path, entry->d_name, data);
+    if (ret) {
+      break;
+    }
+  }
+  closedir(dp);
+
+  return ret;
+}
+
+
+static int
+gbLioHbaMaxCb(const char *path, const char *name, void *data)
+{
+  int *max = data;
+  int idx;
+
+
+  if (sscanf(name, GB_LIO_USER_HBA "%d", &idx) == 1 && idx > *max) {
+    *max = idx;
+  }
+
+  return 0;
+}
+
+
+typedef struct gbLioLookup {
+  const char *name;
+  char *path;
+  size_t len;
+} gbLioLookup;
+
+
+static int
+gbLioSoFindCb(const char *path, const char *name, void *data)
+{
+  gbLioLookup *lookup = data;
+  struct stat st;
+
+
+  snprintf(lookup->path, lookup->len, "%s/%s", path, lookup->name);
+  if (!stat(lookup->path, &st) && S_ISDIR(st.st_mode)) {
+    return 1;
+  }
+
+  return 0;
+}
+
+
+/* path of the user:* storage object called name */
+static int
+gbLioSoFind(const char *name, char *path, size_t len)
+{
+  char core[PATH_MAX];
+  gbLioLookup lookup = {name, path, len};
+
+
+  snprintf(core, sizeof(core), "%s/core", configfsRoot);
+  if (gbLioForEach(core, GB_LIO_USER_HBA, gbLioSoFindCb, &lookup) == 1) {
+    return 0;
+  }
+
+  return -1;
+}
+
+
+static int
+gbLioSoCreate(blockCreate *blk, char *so, size_t len)
+{
+  char core[PATH_MAX];
+  char hba[PATH_MAX];
+  int idx = -1;
+
+
+  snprintf(core, sizeof(core), "%s/core", configfsRoot);
+  if (gbLioForEach(core, GB_LIO_USER_HBA, gbLioHbaMaxCb, &idx)) {
+    return -1;
+  }
+
+  /* one hba per storage object, as rtslib does */
+  do {
+    snprintf(hba, sizeof(hba), "%s/" GB_LIO_USER_HBA "%d", core, ++idx);
+  } while (mkdir(hba, 0755) && errno == EEXIST);
+
+  snprintf(so, len, "%s/%s", hba, blk->block_name);
+  if (gbLioMkdir(so, soGroups)) {
+    rmdir(hba);
+    return -1;
+  }
+
+  if (gbLioWrite(so, "control", "dev_config=glfs/%s@%s%s/%s",
+                 blk->volume, blk->ipaddr, GB_STOREDIR, blk->gbid) ||
+      gbLioWrite(so, "control", "dev_size=%zu", (size_t)blk->size) ||
+      gbLioWrite(so, "enable", "1") ||
+      gbLioWrite(so, "wwn/vpd_unit_serial", "%s", blk->gbid)) {
+    gbLioRmdir(so);
+    rmdir(hba);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static int
+gbLioSoDelete(const char *so)
+{
+  char hba[PATH_MAX];
+  char *sep;
+
+
+  snprintf(hba, sizeof(hba), "%s", so);
+  sep = strrchr(hba, '/');
+  if (sep) {
+    *sep = '\0';
+  }
+
+  if (gbLioRmdir(so)) {
+    return -1;
+  }
+
+  return rmdir(hba);
+}
+
+
+static int
+gbLioLunUnlinkCb(const char *path, const char *name, void *data)
+{
+  struct stat st;
+
+
+  if (!lstat(path, &st) && S_ISLNK(st.st_mode)) {
+    return unlink(path);
+  }
+
+  return 0;
+}
+
+
+static int
+gbLioLunDeleteCb(const char *path, const char *name, void *data)
+{
+  if (gbLioForEach(path, NULL, gbLioLunUnlinkCb, NULL)) {
+    return -1;
+  }
+
+  return gbLioRmdir(path);
+}
+
+
+static int
+gbLioPortalDeleteCb(const char *path, const char *name, void *data)
+{
+  return gbLioRmdir(path);
+}
+
+
+static int
+gbLioTpgDeleteCb(const char *path, const char *name, void *data)
+{
+  char sub[PATH_MAX];
+
+
+  gbLioWrite(path, "enable", "0");
+
+  snprintf(sub, sizeof(sub), "%s/lun", path);
+  if (gbLioForEach(sub, GB_LIO_LUN, gbLioLunDeleteCb, NULL)) {
+    return -1;
+  }
+
+  snprintf(sub, sizeof(sub), "%s/np", path);
+  if (gbLioForEach(sub, NULL, gbLioPortalDeleteCb, NULL)) {
+    return -1;
+  }
+
+  return gbLioRmdir(path);
+}
+
+
+static int
+gbLioTpgCreate(const char *target, size_t tpgt, const char *so,
+               const char *addr, bool enable, blockCreate *blk, char **out)
+{
+  char tpg[PATH_MAX];
+  char path[PATH_MAX];
+
+
+  snprintf(tpg, sizeof(tpg), "%s/" GB_LIO_TPGT "%zu", target, tpgt);
+  if (gbLioMkdir(tpg, tpgGroups)) {
+    gbLioLog(out, "Could not create TPG %zu (%s)", tpgt, strerror(errno));
+    return -1;
+  }
+  gbLioLog(out, "Created TPG %zu.", tpgt);
+
+  snprintf(path, sizeof(path), "%s/lun/" GB_LIO_LUN "0", tpg);
+  if (gbLioMkdir(path, NULL)) {
+    gbLioLog(out, "Could not create LUN 0 (%s)", strerror(errno));
+    return -1;
+  }
+  snprintf(path, sizeof(path), "%s/lun/" GB_LIO_LUN "0/" GB_LIO_LUN_ALIAS, tpg);
+  if (symlink(so, path)) {
+    gbLioLog(out, "Could not create LUN 0 (%s)", strerror(errno));
+    return -1;
+  }
+  gbLioLog(out, "Created LUN 0.");
+
+  snprintf(path, sizeof(path), "%s/np/%s:%d", tpg, addr, GB_LIO_PORTAL_PORT);
+  if (gbLioMkdir(path, NULL)) {
+    gbLioLog(out, "Could not create network portal %s:%d (%s)",
+             addr, GB_LIO_PORTAL_PORT, strerror(errno));
+    return -1;
+  }
+  gbLioLog(out, "Created network portal %s:%d.", addr, GB_LIO_PORTAL_PORT);
+
+  if (enable) {
+    if (gbLioWrite(tpg, "enable", "1")) {
+      return -1;
+    }
+  } else if (gbLioWrite(tpg, "attrib/tpg_enabled_sendtargets", "0")) {
+    return -1;
+  }
+
+  if (blk->auth_mode && gbLioWrite(tpg, "attrib/authentication", "1")) {
+    return -1;
+  }
+
+  if (gbLioWrite(tpg, "attrib/generate_node_acls", "1") ||
+      gbLioWrite(tpg, "attrib/demo_mode_write_protect", "0")) {
+    return -1;
+  }
+
+  if (blk->auth_mode) {
+    if (gbLioWrite(tpg, "auth/userid", "%s", blk->gbid) ||
+        gbLioWrite(tpg, "auth/password", "%s", blk->passwd)) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+int
+glusterBlockLioInit(void)
+{
+  struct statfs sfs;
+  char path[PATH_MAX];
+  char *root;
+
+
+  root = getenv("GB_CONFIGFS_ROOT");
+  if (root) {
+    if (strlen(root) >= PATH_MAX / 2) {
+      LOG("mgmt", GB_LOG_ERROR, "GB_CONFIGFS_ROOT is too long: %s", root);
+      return -1;
+    }
+    GB_STRCPYSTATIC(configfsRoot, root);
+  }
+
+  if (gbLioBackendType != GB_LIO_CONFIGFS) {
+    goto out;
+  }
+
+  if (statfs(configfsRoot, &sfs)) {
+    LOG("mgmt", GB_LOG_WARNING, "%s is not usable (%s), using targetcli",
+        configfsRoot, strerror(errno));
+    gbLioBackendType = GB_LIO_TARGETCLI;
+    goto out;
+  }
+
+  configfsFake = (sfs.f_type != CONFIGFS_MAGIC);
+  if (configfsFake) {
+    snprintf(path, sizeof(path), "%s/core", configfsRoot);
+    if (mkdir(path, 0755) && errno != EEXIST) {
+      LOG("mgmt", GB_LOG_ERROR, "mkdir(%s) failed (%s)", path, strerror(errno));
+      return -1;
+    }
+  }
+
+  LOG("mgmt", GB_LOG_INFO, "configuring LIO through %s%s", configfsRoot,
+      configfsFake ? " (not configfs)" : "");
+
+ out:
+  /* up front, instead of on the first request */
+  LOCK(indexLock);
+  gbLioIndexBuild();
+  UNLOCK(indexLock);
+
+  return 0;
+}
+
+
+static int
+gbLioTargetDelete(const char *target)
+{
+  /* the LUNs of the target hold the storage object */
+  if (gbLioForEach(target, GB_LIO_TPGT, gbLioTpgDeleteCb, NULL)) {
+    return -1;
+  }
+
+  return gbLioRmdir(target);
+}
+
+
+/* 0 once all of blk is configured, -1 with what got done of it taken
+ * down again */
+int
+glusterBlockLioCreate(blockCreate *blk, blockServerDefPtr list, char **out)
+{
+  char so[PATH_MAX];
+  char path[PATH_MAX];
+  char target[PATH_MAX] = {0, };
+  size_t i;
+  int errsv;
+
+
+  if (gbLioSoCreate(blk, so, sizeof(so))) {
+    gbLioLog(out, "Could not create storage object %s (%s)",
+             blk->block_name, strerror(errno));
+    return -1;
+  }
+  gbLioLog(out, "Created storage object %s size %zu.",
+           blk->block_name, (size_t)blk->size);
+
+  if (gbLioWrite(so, "attrib/cmd_time_out", "0")) {
+    goto fail;
+  }
+
+  /* the fabric module is loaded on first use */
+  snprintf(path, sizeof(path), "%s/iscsi", configfsRoot);
+  if (mkdir(path, 0755) && errno != EEXIST) {
+    gbLioLog(out, "Could not load iscsi fabric (%s)", strerror(errno));
+    goto fail;
+  }
+
+  snprintf(path, sizeof(path), "%s/iscsi/" GB_LIO_IQN_PREFIX "%s",
+           configfsRoot, blk->gbid);
+  if (gbLioMkdir(path, NULL)) {
+    gbLioLog(out, "Could not create target %s%s (%s)",
+             GB_LIO_IQN_PREFIX, blk->gbid, strerror(errno));
+    goto fail;
+  }
+  GB_STRCPYSTATIC(target, path);
+  gbLioLog(out, "Created target %s%s.", GB_LIO_IQN_PREFIX, blk->gbid);
+
+  /* one tpg per node, only ours is enabled */
+  for (i = 1; i <= list->nhosts; i++) {
+    if (gbLioTpgCreate(target, i, so, list->hosts[i-1],
+                       !strcmp(blk->ipaddr, list->hosts[i-1]), blk, out)) {
+      goto fail;
+    }
+  }
+
+  return 0;
+
+ fail:
+  errsv = errno;
+  if (target[0] && gbLioTargetDelete(target)) {
+    LOG("mgmt", GB_LOG_ERROR, "removing half created target %s failed (%s)",
+        target, strerror(errno));
+  }
+  if (gbLioSoDelete(so)) {
+    LOG("mgmt", GB_LOG_ERROR,
+        "removing half created storage object %s failed (%s)",
+        so, strerror(errno));
+  }
+  errno = errsv;
+
+  return -1;
+}
+
+
+int
+glusterBlockLioDelete(blockDelete *blk, char **out)
+{
+  char so[PATH_MAX];
+  char target[PATH_MAX];
+  int ret = 0;
+
+
+  snprintf(target, sizeof(target), "%s/iscsi/" GB_LIO_IQN_PREFIX "%s",
+           configfsRoot, blk->gbid);
+  if (!access(target, F_OK)) {
+    if (gbLioTargetDelete(target)) {
+      gbLioLog(out, "Could not delete target %s%s (%s)",
+               GB_LIO_IQN_PREFIX, blk->gbid, strerror(errno));
+      ret = -1;
+    } else {
+      gbLioLog(out, "Deleted target %s%s.", GB_LIO_IQN_PREFIX, blk->gbid);
+    }
+  }
+
+  if (!gbLioSoFind(blk->block_name, so, sizeof(so))) {
+    if (gbLioSoDelete(so)) {
+      gbLioLog(out, "Could not delete storage object %s (%s)",
+               blk->block_name, strerror(errno));
+      ret = -1;
+    } else {
+      gbLioLog(out, "Deleted storage object %s.", blk->block_name);
+    }
+  }
+
+  return ret;
+}
+
+
+static int
+gbLioTpgAuthCb(const char *path, const char *name, void *data)
+{
+  blockModify *blk = ((void **)data)[0];
+  char **out = ((void **)data)[1];
+
+
+  if (gbLioWrite(path, "attrib/authentication", "%d", blk->auth_mode ? 1 : 0)) {
+    gbLioLog(out, "Could not set authentication on %s (%s)", name,
+             strerror(errno));
+    return -1;
+  }
+
+  if (blk->auth_mode &&
+      (gbLioWrite(path, "auth/userid", "%s", blk->gbid) ||
+       gbLioWrite(path, "auth/password", "%s", blk->passwd))) {
+    gbLioLog(out, "Could not set credentials on %s (%s)", name,
+             strerror(errno));
+    return -1;
+  }
+  gbLioLog(out, "Authentication %s on %s.",
+           blk->auth_mode ? "enabled" : "disabled", name);
+
+  return 0;
+}
+
+
+int
+glusterBlockLioModifyAuth(blockModify *blk, char **out)
+{
+  char target[PATH_MAX];
+  void *data[2] = {blk, out};
+
+
+  snprintf(target, sizeof(target), "%s/iscsi/" GB_LIO_IQN_PREFIX "%s",
+           configfsRoot, blk->gbid);
+
+  return gbLioForEach(target, GB_LIO_TPGT, gbLioTpgAuthCb, data);
+}
+
+
+static int
+gbLioPortalFindCb(const char *path, const char *name, void *data)
+{
+  gbLioLookup *lookup = data;
+  struct stat st;
+
+
+  snprintf(lookup->path, lookup->len, "%s/np/%s:%d",
+           path, lookup->name, GB_LIO_PORTAL_PORT);
+  if (!stat(lookup->path, &st)) {
+    /* hand back the tpg */
+    snprintf(lookup->path, lookup->len, "%s", path);
+    return 1;
+  }
+
+  return 0;
+}
+
+
+static int
+gbLioPortalTpg(const char *gbid, const char *addr, char *tpg, size_t len)
+{
+  char target[PATH_MAX];
+  gbLioLookup lookup = {addr, tpg, len};
+
+
+  snprintf(target, sizeof(target), "%s/iscsi/" GB_LIO_IQN_PREFIX "%s",
+           configfsRoot, gbid);
+
+  return gbLioForEach(target, GB_LIO_TPGT, gbLioPortalFindCb, &lookup);
+}
+
+
+/* moves the portal of blk->ripaddr, on whichever tpg it is, to blk->ipaddr */
+int
+glusterBlockLioReplacePortal(blockReplace *blk, char **out)
+{
+  char tpg[PATH_MAX];
+  char path[PATH_MAX];
+
+
+  if (gbLioPortalTpg(blk->gbid, blk->ripaddr, tpg, sizeof(tpg)) != 1) {
+    gbLioLog(out, "No network portal %s:%d", blk->ripaddr, GB_LIO_PORTAL_PORT);
+    return -1;
+  }
+
+  snprintf(path, sizeof(path), "%s/np/%s:%d",
+           tpg, blk->ripaddr, GB_LIO_PORTAL_PORT);
+  if (gbLioRmdir(path)) {
+    gbLioLog(out, "Could not delete network portal %s:%d (%s)",
+             blk->ripaddr, GB_LIO_PORTAL_PORT, strerror(errno));
+    return -1;
+  }
+  gbLioLog(out, "Deleted network portal %s:%d", blk->ripaddr,
+           GB_LIO_PORTAL_PORT);
+
+  snprintf(path, sizeof(path), "%s/np/%s:%d",
+           tpg, blk->ipaddr, GB_LIO_PORTAL_PORT);
+  if (gbLioMkdir(path, NULL)) {
+    gbLioLog(out, "Could not create network portal %s:%d (%s)",
+             blk->ipaddr, GB_LIO_PORTAL_PORT, strerror(errno));
+    return -1;
+  }
+  gbLioLog(out, "Created network portal %s:%d.", blk->ipaddr,
+           GB_LIO_PORTAL_PORT);
+
+  return 0;
+}
+
+
+/* What configfs has for our blocks, by file gbid, so the checks done
+ * before every change don't have to walk configfs or run targetcli ls.
+ * Built on first use and kept current with the changes this daemon makes;
+ * a change that didn't go through cleanly has it rebuilt. */
+
+typedef struct gbLioPortal {
+  char addr[256];
+  size_t tpgt;
+} gbLioPortal;
+
+typedef struct gbLioEntry {
+  char gbid[128];
+  char name[256];          /* storage object, "" if there is none */
+  char volume[256];        /* its backing volume, "" if not known */
+  bool target;
+  gbLioPortal *portals;    /* of the target */
+  size_t nportals;
+
+  struct list_head list;
+} gbLioEntry;
+
+static struct list_head lioIndex[GB_LIO_INDEX_BUCKETS];
+static bool indexValid;
+
+
+static struct list_head *
+gbLioIndexBucket(const char *gbid)
+{
+  unsigned long hash = 5381;
+
+
+  while (*gbid) {
+    hash = hash * 33 + (unsigned char)*gbid++;
+  }
+
+  return &lioIndex[hash % GB_LIO_INDEX_BUCKETS];
+}
+
+
+static gbLioEntry *
+gbLioIndexLookup(const char *gbid, bool create)
+{
+  struct list_head *bucket = gbLioIndexBucket(gbid);
+  gbLioEntry *entry;
+
+
+  list_for_each_entry(entry, bucket, list) {
+    if (!strcmp(entry->gbid, gbid)) {
+      return entry;
+    }
+  }
+
+  if (!create || GB_ALLOC(entry) < 0) {
+    return NULL;
+  }
+  GB_STRCPYSTATIC(entry->gbid, gbid);
+  list_add(&entry->list, bucket);
+
+  return entry;
+}
+
+
+static void
+gbLioIndexRemove(gbLioEntry *entry)
+{
+  list_del(&entry->list);
+  GB_FREE(entry->portals);
+  GB_FREE(entry);
+}
+
+
+static int
+gbLioIndexPortalAdd(gbLioEntry *entry, const char *addr, size_t tpgt)
+{
+  if (GB_REALLOC_N(entry->portals, entry->nportals + 1) < 0) {
+    return -1;
+  }
+  GB_STRCPYSTATIC(entry->portals[entry->nportals].addr, addr);
+  entry->portals[entry->nportals].tpgt = tpgt;
+  entry->nportals++;
+
+  return 0;
+}
+
+
+static void
+gbLioIndexClear(void)
+{
+  gbLioEntry *entry, *tmp;
+  size_t i;
+
+
+  for (i = 0; i < GB_LIO_INDEX_BUCKETS; i++) {
+    if (!lioIndex[i].next) {
+      INIT_LIST_HEAD(&lioIndex[i]);
+    }
+    list_for_each_entry_safe(entry, tmp, &lioIndex[i], list) {
+      gbLioIndexRemove(entry);
+    }
+  }
+  indexValid = false;
+}
+
+
+/* "... Config: glfs/<volume>@<host>/block-store/<gbid> ..." in the info
+ * of a tcmu storage object; a fake configfs has no info to read */
+static void
+gbLioIndexSoVolume(const char *path, gbLioEntry *entry)
+{
+  char info[PATH_MAX];
+  char buf[1024] = {0, };
+  char *vol;
+  int fd;
+  ssize_t n;
+
+
+  snprintf(info, sizeof(info), "%s/info", path);
+  fd = open(info, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0) {
+    return;
+  }
+
+  vol = strstr(buf, GB_LIO_CONFIG_GLFS);
+  if (!vol) {
+    return;
+  }
+  vol += strlen(GB_LIO_CONFIG_GLFS);
+  vol[strcspn(vol, "@ \n")] = '\0';
+  GB_STRCPYSTATIC(entry->volume, vol);
+}
+
+
+static int
+gbLioIndexSoCb(const char *path, const char *name, void *data)
+{
+  gbLioEntry *entry;
+  char serial[PATH_MAX];
+  char buf[256] = {0, };
+  char *gbid;
+  int fd;
+  ssize_t n;
+
+
+  /* "T10 VPD Unit Serial Number: <gbid>" */
+  snprintf(serial, sizeof(serial), "%s/wwn/vpd_unit_serial", path);
+  fd = open(serial, O_RDONLY);
+  if (fd < 0) {
+    return 0;   /* hba_info and such */
+  }
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0) {
+    return 0;
+  }
+  buf[strcspn(buf, "\n")] = '\0';
+  gbid = strrchr(buf, ' ');
+  gbid = gbid ? gbid + 1 : buf;
+  if (!*gbid) {
+    return 0;
+  }
+
+  entry = gbLioIndexLookup(gbid, true);
+  if (!entry) {
+    return -1;
+  }
+  GB_STRCPYSTATIC(entry->name, name);
+  gbLioIndexSoVolume(path, entry);
+
+  return 0;
+}
+
+
+static int
+gbLioIndexHbaCb(const char *path, const char *name, void *data)
+{
+  return gbLioForEach(path, NULL, gbLioIndexSoCb, NULL);
+}
+
+
+static int
+gbLioIndexPortalCb(const char *path, const char *name, void *data)
+{
+  char addr[256];
+  char *port;
+
+
+  GB_STRCPYSTATIC(addr, name);
+  port = strrchr(addr, ':');
+  if (port) {
+    *port = '\0';
+  }
+
+  return gbLioIndexPortalAdd(((void **)data)[0], addr,
+                             *(size_t *)((void **)data)[1]);
+}
+
+
+static int
+gbLioIndexTpgCb(const char *path, const char *name, void *data)
+{
+  char np[PATH_MAX];
+  size_t tpgt;
+  void *args[2] = {data, &tpgt};
+
+
+  if (sscanf(name, GB_LIO_TPGT "%zu", &tpgt) != 1) {
+    return 0;
+  }
+
+  snprintf(np, sizeof(np), "%s/np", path);
+  if (access(np, F_OK)) {
+    return 0;
+  }
+
+  return gbLioForEach(np, NULL, gbLioIndexPortalCb, args);
+}
+
+
+static int
+gbLioIndexTargetCb(const char *path, const char *name, void *data)
+{
+  gbLioEntry *entry;
+
+
+  entry = gbLioIndexLookup(name + strlen(GB_LIO_IQN_PREFIX), true);
+  if (!entry) {
+    return -1;
+  }
+  entry->target = true;
+
+  return gbLioForEach(path, GB_LIO_TPGT, gbLioIndexTpgCb, entry);
+}
+
+
+/* call with indexLock held */
+static int
+gbLioIndexBuild(void)
+{
+  char path[PATH_MAX];
+
+
+  if (indexValid) {
+    return 0;
+  }
+
+  gbLioIndexClear();
+
+  snprintf(path, sizeof(path), "%s/core", configfsRoot);
+  if (gbLioForEach(path, GB_LIO_USER_HBA, gbLioIndexHbaCb, NULL)) {
+    goto fail;
+  }
+
+  /* no iscsi dir, until the fabric module is loaded */
+  snprintf(path, sizeof(path), "%s/iscsi", configfsRoot);
+  if (!access(path, F_OK) &&
+      gbLioForEach(path, GB_LIO_IQN_PREFIX, gbLioIndexTargetCb, NULL)) {
+    goto fail;
+  }
+
+  indexValid = true;
+  LOG("mgmt", GB_LOG_DEBUG, "indexed LIO config under %s", configfsRoot);
+
+  return 0;
+
+ fail:
+  LOG("mgmt", GB_LOG_WARNING, "indexing LIO config under %s failed (%s)",
+      configfsRoot, strerror(errno));
+  gbLioIndexClear();
+
+  return -1;
+}
+
+
+void
+glusterBlockLioIndexInvalidate(void)
+{
+  LOCK(indexLock);
+  indexValid = false;
+  UNLOCK(indexLock);
+}
+
+
+/* 1 if storage object name serves file gbid, 0 if not, -1 if the index
+ * isn't available */
+int
+glusterBlockLioIndexHas(const char *name, const char *gbid)
+{
+  gbLioEntry *entry;
+  int ret = -1;
+
+
+  LOCK(indexLock);
+  if (!gbLioIndexBuild()) {
+    entry = gbLioIndexLookup(gbid, false);
+    ret = (entry && !strcmp(entry->name, name));
+  }
+  UNLOCK(indexLock);
+
+  return ret;
+}
+
+
+/* 1 if the target of gbid has a portal on addr, with the tpg it is on in
+ * *tpgt, 0 if not, -1 if the index isn't available */
+int
+glusterBlockLioIndexPortal(const char *gbid, const char *addr, size_t *tpgt)
+{
+  gbLioEntry *entry;
+  size_t i;
+  int ret = -1;
+
+
+  LOCK(indexLock);
+  if (!gbLioIndexBuild()) {
+    ret = 0;
+    entry = gbLioIndexLookup(gbid, false);
+    for (i = 0; entry && i < entry->nportals; i++) {
+      if (!strcmp(entry->portals[i].addr, addr)) {
+        if (tpgt) {
+          *tpgt = entry->portals[i].tpgt;
+        }
+        ret = 1;
+        break;
+      }
+    }
+  }
+  UNLOCK(indexLock);
+
+  return ret;
+}
+
+
+/* number of tpgs of the target of gbid, -1 if the index isn't available */
+int
+glusterBlockLioIndexTpgs(const char *gbid)
+{
+  gbLioEntry *entry;
+  size_t i;
+  int ret = -1;
+
+
+  LOCK(indexLock);
+  if (!gbLioIndexBuild()) {
+    ret = 0;
+    entry = gbLioIndexLookup(gbid, false);
+    for (i = 0; entry && i < entry->nportals; i++) {
+      if (entry->portals[i].tpgt > (size_t)ret) {
+        ret = entry->portals[i].tpgt;
+      }
+    }
+  }
+  UNLOCK(indexLock);
+
+  return ret;
+}
+
+
+/* Distinct volumes backing the blocks configured on this node, in
+ * *volumes, to free with glusterBlockLioIndexVolumesFree() */
+int
+glusterBlockLioIndexVolumes(char ***volumes, size_t *count)
+{
+  gbLioEntry *entry;
+  size_t i, j;
+  int ret = -1;
+
+
+  *volumes = NULL;
+  *count = 0;
+
+  LOCK(indexLock);
+  if (gbLioIndexBuild()) {
+    goto out;
+  }
+
+  for (i = 0; i < GB_LIO_INDEX_BUCKETS; i++) {
+    list_for_each_entry(entry, &lioIndex[i], list) {
+      if (!entry->volume[0]) {
+        continue;
+      }
+      for (j = 0; j < *count; j++) {
+        if (!strcmp((*volumes)[j], entry->volume)) {
+          break;
+        }
+      }
+      if (j < *count) {
+        continue;
+      }
+      if (GB_REALLOC_N(*volumes, *count + 1) < 0 ||
+          GB_STRDUP((*volumes)[*count], entry->volume) < 0) {
+        goto out;
+      }
+      (*count)++;
+    }
+  }
+  ret = 0;
+
+ out:
+  UNLOCK(indexLock);
+  if (ret) {
+    glusterBlockLioIndexVolumesFree(*volumes, *count);
+    *volumes = NULL;
+    *count = 0;
+  }
+
+  return ret;
+}
+
+
+void
+glusterBlockLioIndexVolumesFree(char **volumes, size_t count)
+{
+  size_t i;
+
+
+  for (i = 0; i < count; i++) {
+    GB_FREE(volumes[i]);
+  }
+  GB_FREE(volumes);
+}
+
+
+/* after blk got created as glusterBlockLioCreate() does it */
+void
+glusterBlockLioIndexAdd(blockCreate *blk, blockServerDefPtr list)
+{
+  gbLioEntry *entry;
+  size_t i;
+
+
+  LOCK(indexLock);
+  if (!indexValid) {
+    goto out;
+  }
+
+  entry = gbLioIndexLookup(blk->gbid, true);
+  if (!entry) {
+    indexValid = false;
+    goto out;
+  }
+  GB_STRCPYSTATIC(entry->name, blk->block_name);
+  GB_STRCPYSTATIC(entry->volume, blk->volume);
+  entry->target = true;
+  entry->nportals = 0;
+  for (i = 0; i < list->nhosts; i++) {
+    if (gbLioIndexPortalAdd(entry, list->hosts[i], i + 1)) {
+      indexValid = false;
+      break;
+    }
+  }
+
+ out:
+  UNLOCK(indexLock);
+}
+
+
+void
+glusterBlockLioIndexDel(const char *gbid)
+{
+  gbLioEntry *entry;
+
+
+  LOCK(indexLock);
+  if (indexValid) {
+    entry = gbLioIndexLookup(gbid, false);
+    if (entry) {
+      gbLioIndexRemove(entry);
+    }
+  }
+  UNLOCK(indexLock);
+}
+
+
+void
+glusterBlockLioIndexMovePortal(const char *gbid, const char *from,
+                               const char *to)
+{
+  gbLioEntry *entry;
+  size_t i;
+
+
+  LOCK(indexLock);
+  if (!indexValid) {
+    goto out;
+  }
+
+  entry = gbLioIndexLookup(gbid, false);
+  for (i = 0; entry && i < entry->nportals; i++) {
+    if (!strcmp(entry->portals[i].addr, from)) {
+      GB_STRCPYSTATIC(entry->portals[i].addr, to);
+      goto out;
+    }
+  }
+  indexValid = false;
+
+ out:
+  UNLOCK(indexLock);
+}
@@ -0,0 +1,96 @@
+/*
+  Copyright (c) 2018 Red Hat, Inc. <http://www.redhat.com>
+  This file is part of gluster-block.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+
+# ifndef   _LIO_OPERATIONS_H
+# define   _LIO_OPERATIONS_H   1
+
+# include  "common.h"
+# include  "block.h"
+
+# define   GB_CONFIGFS_ROOT     "/sys/kernel/config/target"
+# define   GB_LIO_IQN_PREFIX    "iqn.2016-12.org.gluster-block:"
+# define   GB_LIO_INDEX_BUCKETS 1024
+
+
+/* How the LIO configuration of this node is changed */
+typedef enum gbLioBackend {
+  GB_LIO_TARGETCLI = 0,  /* targetcli scripts, one python process each */
+  GB_LIO_CONFIGFS  = 1,  /* writes under GB_CONFIGFS_ROOT */
+
+  GB_LIO_BACKEND_MAX
+} gbLioBackend;
+
+
+static const char *const gbLioBackendLookup[] = {
+  [GB_LIO_TARGETCLI] = "targetcli",
+  [GB_LIO_CONFIGFS]  = "configfs",
+
+  [GB_LIO_BACKEND_MAX] = NULL,
+};
+
+extern int gbLioBackendType;
+
+
+/* The functions below append targetcli style messages to *out, so the
+ * output validation is the same for both backends. */
+
+int
+gbLioBackendEnumParse(const char *opt);
+
+int
+glusterBlockLioInit(void);
+
+int
+glusterBlockLioCreate(blockCreate *blk, blockServerDefPtr list, char **out);
+
+int
+glusterBlockLioDelete(blockDelete *blk, char **out);
+
+int
+glusterBlockLioModifyAuth(blockModify *blk, char **out);
+
+int
+glusterBlockLioReplacePortal(blockReplace *blk, char **out);
+
+
+/* Index of the blocks configured on this node, which holds for either
+ * backend as targetcli goes through configfs too */
+
+void
+glusterBlockLioIndexInvalidate(void);
+
+int
+glusterBlockLioIndexHas(const char *name, const char *gbid);
+
+int
+glusterBlockLioIndexPortal(const char *gbid, const char *addr, size_t *tpgt);
+
+int
+glusterBlockLioIndexTpgs(const char *gbid);
+
+int
+glusterBlockLioIndexVolumes(char ***volumes, size_t *count);
+
+void
+glusterBlockLioIndexVolumesFree(char **volumes, size_t count);
+
+void
+glusterBlockLioIndexAdd(blockCreate *blk, blockServerDefPtr list);
+
+void
+glusterBlockLioIndexDel(const char *gbid);
+
+void
+glusterBlockLioIndexMovePortal(const char *gbid, const char *from,
+                               const char *to);
+
+
+# endif /* _LIO_OPERATIONS_H */
@@ -75,6 +75,7 @@ struct blockInfoCli {
 struct blockListCli {
   char      volume[255];
   u_quad_t  offset;      /* dentry d_name offset */
+  u_int     limit;       /* blocks per reply, 0 for all */
   enum JsonResponseFormat     json_resp;
 };
 
@@ -101,6 +102,18 @@ struct blockResponse {
   opaque    xdata<>;    /* future reserve */
 };
 
+struct blockCreateBatch {
+  blockCreate blocks<>;
+};
+
+struct blockDeleteBatch {
+  blockDelete blocks<>;
+};
+
+struct blockBatchResponse {
+  blockResponse results<>;  /* one per block, in request order */
+};
+
 program GLUSTER_BLOCK {
   version GLUSTER_BLOCK_VERS {
     blockResponse BLOCK_CREATE(blockCreate) = 1;
@@ -108,6 +121,8 @@ program GLUSTER_BLOCK {
     blockResponse BLOCK_MODIFY(blockModify) = 3;
     blockResponse BLOCK_VERSION() = 4;
     blockResponse BLOCK_REPLACE(blockReplace) = 5;
+    blockBatchResponse BLOCK_CREATE_BATCH(blockCreateBatch) = 6;
+    blockBatchResponse BLOCK_DELETE_BATCH(blockDeleteBatch) = 7;
   } = 1;
 } = 21215311; /* B2 L12 O15 C3 K11 */
 
@@ -17,4 +17,17 @@ gluster_block_cli_1(struct svc_req *rqstp, register SVCXPRT *transp);
 void
 gluster_block_1(struct svc_req *rqstp, register SVCXPRT *transp);
 
+/* worker pool backed dispatchers, see rpc/block_svc_dispatch.c */
+void
+gluster_block_cli_1_mt(struct svc_req *rqstp, register SVCXPRT *transp);
+
+void
+gluster_block_1_mt(struct svc_req *rqstp, register SVCXPRT *transp);
+
+int
+glusterBlockSvcDispatchInit(void);
+
+void
+glusterBlockSvcRun(void);
+
 # endif /* _BLOCK_SVC_H */
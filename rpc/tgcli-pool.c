@@ -0,0 +1,319 @@
+/*
+  Copyright (c) 2018 Red Hat, Inc. <http://www.redhat.com>
+  This file is part of gluster-block.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+
+# define   _GNU_SOURCE
+# include  <poll.h>
+# include  <pthread.h>
+# include  <signal.h>
+# include  <sys/wait.h>
+
+# include  "tgcli-pool.h"
+# include  "runner.h"
+
+# define   GB_TGCLI_BIN       "targetcli"
+# define   GB_TGCLI_REFRESH   "/ refresh"
+# define   GB_TGCLI_MARK      "gb-batch-end-"
+/* newer targetcli holds a lock on this for as long as it runs */
+# define   GB_TGCLI_LOCKFILE  "/var/run/targetcli.lock"
+
+
+/* A targetcli reading commands from a pipe, which saves starting python
+ * and importing rtslib for every batch of commands */
+typedef struct gbTgcli {
+  pid_t pid;       /* 0 when not running */
+  int in;          /* its stdin */
+  int out;         /* its stdout and stderr */
+  bool busy;
+} gbTgcli;
+
+size_t gbTgcliProcCount = GB_TGCLI_PROCS_DEFAULT;
+
+static gbTgcli procs[GB_TGCLI_PROCS_MAX];
+static pthread_mutex_t procsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t procsCond = PTHREAD_COND_INITIALIZER;
+static unsigned long batchSeq;
+static bool procsDisabled;
+
+
+static time_t
+glusterBlockTgcliNow(void)
+{
+  struct timespec now;
+
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec;
+}
+
+
+static void
+glusterBlockTgcliStop(gbTgcli *proc)
+{
+  if (!proc->pid) {
+    return;
+  }
+
+  close(proc->in);
+  close(proc->out);
+  kill(proc->pid, SIGKILL);
+  waitpid(proc->pid, NULL, 0);
+
+  proc->pid = 0;
+}
+
+
+static int
+glusterBlockTgcliStart(gbTgcli *proc)
+{
+  char *argv[] = {GB_TGCLI_BIN, NULL};
+
+
+  /* python would block buffer its output to a pipe */
+  if (gbSpawn(argv, "PYTHONUNBUFFERED=1", &proc->pid, &proc->in, &proc->out)) {
+    proc->pid = 0;
+    return -1;
+  }
+
+  LOG("mgmt", GB_LOG_INFO, "started %s co-process, pid %d",
+      GB_TGCLI_BIN, proc->pid);
+
+  return 0;
+}
+
+
+/* A targetcli that locks out every other one while it runs can't be
+ * kept running: admins, the target service and our own one shot
+ * fallback would all fail, and only they would notice. */
+static void
+glusterBlockTgcliDisable(const char *why)
+{
+  size_t i;
+
+
+  LOCK(procsLock);
+  if (!procsDisabled) {
+    LOG("mgmt", GB_LOG_WARNING,
+        "%s %s, running it per batch instead of as co-process",
+        GB_TGCLI_BIN, why);
+    procsDisabled = true;
+    pthread_cond_broadcast(&procsCond);
+  }
+  /* busy ones are stopped when their batch is done */
+  for (i = 0; i < GB_TGCLI_PROCS_MAX; i++) {
+    if (!procs[i].busy) {
+      glusterBlockTgcliStop(&procs[i]);
+    }
+  }
+  UNLOCK(procsLock);
+}
+
+
+/* Throws away what is left over from the previous batch, if anything */
+static void
+glusterBlockTgcliDrain(gbTgcli *proc)
+{
+  struct pollfd pfd = {0, };
+  char buf[1024];
+
+
+  pfd.fd = proc->out;
+  pfd.events = POLLIN;
+  while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+    if (read(proc->out, buf, sizeof(buf)) <= 0) {
+      break;
+    }
+  }
+}
+
+
+static int
+glusterBlockTgcliWrite(gbTgcli *proc, const char *buf, size_t len)
+{
+  ssize_t n;
+
+
+  while (len) {
+    n = write(proc->in, buf, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+
+/* Collects what proc prints up to the line naming mark. Returns -1 if it
+ * died or hung on the way, *out holds what it printed until then. */
+static int
+glusterBlockTgcliRead(gbTgcli *proc, const char *mark, char **out)
+{
+  struct pollfd pfd = {0, };
+  time_t deadline = glusterBlockTgcliNow() + GB_TGCLI_TIMEOUT;
+  time_t left;
+  size_t size = 8192;
+  size_t len = 0;
+  char *buf = NULL;
+  char *end;
+  ssize_t n;
+  int ret = -1;
+
+
+  if (GB_ALLOC_N(buf, size) < 0) {
+    return -1;
+  }
+
+  pfd.fd = proc->out;
+  pfd.events = POLLIN;
+  while (!(end = strstr(buf, mark))) {
+    left = deadline - glusterBlockTgcliNow();
+    if (left <= 0) {
+      LOG("mgmt", GB_LOG_ERROR, "%s co-process %d timed out",
+          GB_TGCLI_BIN, proc->pid);
+      goto out;
+    }
+
+    n = poll(&pfd, 1, left * 1000);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      LOG("mgmt", GB_LOG_ERROR, "poll() failed (%s)", strerror(errno));
+      goto out;
+    } else if (!n) {
+      continue;
+    }
+
+    if (len == size - 1) {
+      if (GB_REALLOC_N(buf, size * 2) < 0) {
+        goto out;
+      }
+      size *= 2;
+    }
+
+    n = read(proc->out, buf + len, size - len - 1);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      LOG("mgmt", GB_LOG_ERROR, "%s co-process %d exited",
+          GB_TGCLI_BIN, proc->pid);
+      goto out;
+    }
+    len += n;
+    buf[len] = '\0';
+  }
+
+  /* targetcli complaining about the unknown marker command isn't output */
+  while (end > buf && end[-1] != '\n') {
+    end--;
+  }
+  *end = '\0';
+  ret = 0;
+
+ out:
+  *out = buf;
+
+  return ret;
+}
+
+
+/* Runs script on one of the targetcli co-processes. Returns -1 if that
+ * isn't possible, and nothing ran; otherwise *out has all it printed,
+ * which the caller has to validate as with a one shot targetcli. */
+int
+glusterBlockTgcliRun(const char *script, char **out)
+{
+  gbTgcli *proc = NULL;
+  char *batch = NULL;
+  char mark[64];
+  bool fresh;
+  size_t i;
+  int ret = -1;
+
+
+  *out = NULL;
+
+  LOCK(procsLock);
+  while (!procsDisabled && !proc) {
+    for (i = 0; i < gbTgcliProcCount; i++) {
+      if (!procs[i].busy && (!proc || (procs[i].pid && !proc->pid))) {
+        proc = &procs[i];
+      }
+    }
+    if (!proc) {
+      pthread_cond_wait(&procsCond, &procsLock);
+    }
+  }
+  if (!proc) {
+    UNLOCK(procsLock);
+    return -1;
+  }
+  proc->busy = true;
+  snprintf(mark, sizeof(mark), "%s%lu", GB_TGCLI_MARK, ++batchSeq);
+  UNLOCK(procsLock);
+
+  fresh = !proc->pid;
+  if (fresh && !access(GB_TGCLI_LOCKFILE, F_OK)) {
+    glusterBlockTgcliDisable("takes a lock on " GB_TGCLI_LOCKFILE);
+    goto out;
+  }
+  if (fresh && glusterBlockTgcliStart(proc)) {
+    goto out;
+  }
+
+  /* its object tree is stale once anything else changed LIO, and it
+   * tells the batch is done by complaining about the mark command */
+  if (GB_ASPRINTF(&batch, "%s\n%s\n%s\n", GB_TGCLI_REFRESH, script, mark) == -1) {
+    goto out;
+  }
+
+  glusterBlockTgcliDrain(proc);
+
+  LOG("mgmt", GB_LOG_DEBUG, "command (co-process %d), %s", proc->pid, script);
+  if (glusterBlockTgcliWrite(proc, batch, strlen(batch))) {
+    LOG("mgmt", GB_LOG_ERROR, "writing to %s co-process %d failed (%s)",
+        GB_TGCLI_BIN, proc->pid, strerror(errno));
+    glusterBlockTgcliStop(proc);
+    goto out;
+  }
+  ret = 0;
+
+  if (glusterBlockTgcliRead(proc, mark, out)) {
+    glusterBlockTgcliStop(proc);
+    if (fresh) {
+      /* e.g. one locked out by another instance, maybe our own */
+      glusterBlockTgcliDisable("doesn't work as co-process");
+    }
+  } else if (fresh && !access(GB_TGCLI_LOCKFILE, F_OK)) {
+    /* it ran, but took the lock on the way */
+    glusterBlockTgcliDisable("takes a lock on " GB_TGCLI_LOCKFILE);
+  }
+  LOG("mgmt", GB_LOG_DEBUG, "raw output, %s", *out?*out:"");
+
+ out:
+  GB_FREE(batch);
+
+  LOCK(procsLock);
+  /* don't leave one behind holding the lock */
+  if (procsDisabled) {
+    glusterBlockTgcliStop(proc);
+  }
+  proc->busy = false;
+  pthread_cond_signal(&procsCond);
+  UNLOCK(procsLock);
+
+  return ret;
+}
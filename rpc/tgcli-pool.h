@@ -0,0 +1,30 @@
+/*
+  Copyright (c) 2018 Red Hat, Inc. <http://www.redhat.com>
+  This file is part of gluster-block.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+
+# ifndef   _TGCLI_POOL_H
+# define   _TGCLI_POOL_H   1
+
+# include  "common.h"
+
+# define   GB_TGCLI_PROCS_DEFAULT   1
+# define   GB_TGCLI_PROCS_MAX       8
+# define   GB_TGCLI_TIMEOUT         300  /* secs, same as the rpc timeout */
+
+
+/* targetcli processes kept running, started on first use */
+extern size_t gbTgcliProcCount;
+
+
+int
+glusterBlockTgcliRun(const char *script, char **out);
+
+
+# endif /* _TGCLI_POOL_H */
@@ -19,6 +19,8 @@
 HOST=$(hostname)
 VOLNAME="block-test"
 BLKNAME="sample-block"
+SLOWBLK="sample-block-slow"
+PAGEBLK="sample-block-page"
 BRKDIR="/tmp/block/"
 
 
@@ -40,6 +42,8 @@ function cleanup()
 
   # Block delete
   gluster-block delete ${VOLNAME}/${BLKNAME} --json-pretty
+  gluster-block delete ${VOLNAME}/${SLOWBLK} >/dev/null 2>&1
+  gluster-block delete ${VOLNAME}/${PAGEBLK} >/dev/null 2>&1
 
   gluster --mode=script vol stop ${VOLNAME}
   gluster --mode=script vol del ${VOLNAME}
@@ -48,6 +52,71 @@ function cleanup()
 }
 
 
+# Is a posix write lock on meta.lock of the volume held, per the brick
+function meta_lock_held()
+{
+  rm -f /var/run/gluster/*.dump.*
+  gluster --mode=script vol statedump ${VOLNAME} >/dev/null || return 1
+  sleep 1;
+  grep -A 20 "path=/block-meta/meta.lock" /var/run/gluster/*.dump.* |
+    grep -q "posixlk.*(ACTIVE)=type=WRITE"
+}
+
+
+# A request on one block is done and lets go of its lock, while another
+# one still holds the lock of its block
+function block_lock_outlives_other_request()
+{
+  local slowpid;
+
+  gluster-block create ${VOLNAME}/${SLOWBLK} ha 1 prealloc full ${HOST} 4GiB &
+  slowpid=$!
+  sleep 1;
+
+  gluster-block create ${VOLNAME}/${BLKNAME} ha 1 ${HOST} 1GiB || return 1
+  gluster-block delete ${VOLNAME}/${BLKNAME} || return 1
+
+  if kill -0 ${slowpid} 2>/dev/null; then
+    meta_lock_held || return 1
+  else
+    echo "create of ${SLOWBLK} was done too soon, lock not checked"
+  fi
+
+  wait ${slowpid}
+}
+
+
+# A page of one block ends with the offset of the next one
+function list_first_page()
+{
+  gluster-block list ${VOLNAME} limit 1 | grep -q "^next offset: [0-9]\+$"
+}
+
+
+# Following the offsets page by page lists every block once, and ends
+function list_all_pages()
+{
+  local out;
+  local offset="";
+  local listed="";
+  local pages=0;
+
+  while true; do
+    out=$(gluster-block list ${VOLNAME} ${offset:+offset ${offset}} limit 1) ||
+      return 1
+    listed="${listed} $(echo "${out}" | grep -v "^next offset: \|^\*Nil\*$")"
+    offset=$(echo "${out}" | sed -n "s/^next offset: //p")
+    pages=$((pages + 1))
+    [ -z "${offset}" ] && break
+    [ ${pages} -gt 4 ] && return 1
+  done
+
+  [ $(echo ${listed} | wc -w) -eq 2 ] &&
+    echo " ${listed} " | grep -q " ${BLKNAME} " &&
+    echo " ${listed} " | grep -q " ${PAGEBLK} "
+}
+
+
 function force_terminate()
 {
   local ret=$?;
@@ -88,6 +157,12 @@ TEST gluster-block list ${VOLNAME}
 # Block info
 TEST gluster-block info ${VOLNAME}/${BLKNAME}
 
+# Block list in pages
+TEST gluster-block create ${VOLNAME}/${PAGEBLK} ha 1 ${HOST} 1GiB
+TEST list_first_page
+TEST list_all_pages
+TEST gluster-block delete ${VOLNAME}/${PAGEBLK}
+
 # Modify Block with auth disable
 TEST gluster-block modify ${VOLNAME}/${BLKNAME} auth disable
 
@@ -100,6 +175,12 @@ TEST gluster-block create ${VOLNAME}/${BLKNAME} ha 1 auth enable ${HOST} 1GiB
 # Block delete
 TEST gluster-block delete ${VOLNAME}/${BLKNAME}
 
+# Block lock held through a request on another block of the volume
+TEST block_lock_outlives_other_request
+
+# Block delete
+TEST gluster-block delete ${VOLNAME}/${SLOWBLK}
+
 echo -e "\n*** JSON responses ***\n"
 
 # Block create and expect json response
@@ -9,6 +9,9 @@
 */
 
 
+# include <pthread.h>
+# include <sys/stat.h>
+
 # include "capabilities.h"
 
 
@@ -32,29 +35,24 @@ gbCapabilitiesEnumParse(const char *cap)
 }
 
 
-int
-gbSetCapabilties(blockResponse **c)
+/* GB_CAPS_FILE is parsed once, then again only when it changes on disk */
+static pthread_mutex_t capsLock = PTHREAD_MUTEX_INITIALIZER;
+static gbCapObj capsCache[GB_CAP_MAX];
+static struct stat capsStat;
+static bool capsValid;
+static u_quad_t bootId;
+
+
+static int
+gbCapabilitiesParse(FILE *fp, gbCapObj *caps)
 {
-  FILE * fp;
   char *line = NULL;
   size_t len = 0;
   int count = 0;
   int ret = 0;
-  blockResponse *reply = *c;
-  gbCapObj *caps = NULL;
   char *p, *sep;
 
 
-  fp = fopen(GB_CAPS_FILE, "r");
-  if (fp == NULL) {
-    return -1;
-  }
-
-  if (GB_ALLOC_N(caps, GB_CAP_MAX) < 0) {
-    fclose(fp);
-    return -1;
-  }
-
   while ((getline(&line, &len, fp)) != -1) {
     if (!line) {
       continue;
@@ -97,13 +95,121 @@ gbSetCapabilties(blockResponse **c)
     goto out;
   }
 
-  reply->xdata.xdata_len = GB_CAP_MAX * sizeof(gbCapObj);
-  reply->xdata.xdata_val = (char *) caps;
-
   ret = 0;
  out:
   GB_FREE(line);
+
+  return ret;
+}
+
+
+static int
+gbCapabilitiesLoad(void)
+{
+  FILE *fp;
+  struct stat st;
+  gbCapObj caps[GB_CAP_MAX] = {{{0}, 0}, };
+
+
+  if (stat(GB_CAPS_FILE, &st)) {
+    return -1;
+  }
+
+  if (capsValid && st.st_ino == capsStat.st_ino &&
+      st.st_size == capsStat.st_size &&
+      st.st_mtim.tv_sec == capsStat.st_mtim.tv_sec &&
+      st.st_mtim.tv_nsec == capsStat.st_mtim.tv_nsec) {
+    return 0;
+  }
+
+  fp = fopen(GB_CAPS_FILE, "r");
+  if (fp == NULL) {
+    return -1;
+  }
+
+  if (gbCapabilitiesParse(fp, caps)) {
+    fclose(fp);
+    return -1;
+  }
   fclose(fp);
 
+  memcpy(capsCache, caps, sizeof(capsCache));
+  capsStat = st;
+  capsValid = true;
+  LOG("mgmt", GB_LOG_INFO, "loaded capabilities from %s", GB_CAPS_FILE);
+
+  return 0;
+}
+
+
+int
+gbSetCapabilties(blockResponse **c)
+{
+  blockResponse *reply = *c;
+  gbCapObj *caps = NULL;
+  int ret = -1;
+
+
+  if (GB_ALLOC_N(caps, GB_CAP_MAX) < 0) {
+    return -1;
+  }
+
+  LOCK(capsLock);
+  if (gbCapabilitiesLoad()) {
+    UNLOCK(capsLock);
+    GB_FREE(caps);
+    goto out;
+  }
+  memcpy(caps, capsCache, sizeof(capsCache));
+  UNLOCK(capsLock);
+
+  reply->xdata.xdata_len = GB_CAP_MAX * sizeof(gbCapObj);
+  reply->xdata.xdata_val = (char *) caps;
+  reply->offset = gbCapabilitiesBootId();
+
+  ret = 0;
+ out:
   return ret;
 }
+
+
+/* Changes with every daemon start, lets peers tell a restart apart from
+ * a reconnect and drop what they cached about us. */
+u_quad_t
+gbCapabilitiesBootId(void)
+{
+  struct timespec now;
+
+
+  LOCK(capsLock);
+  if (!bootId) {
+    clock_gettime(CLOCK_REALTIME, &now);
+    bootId = ((u_quad_t)now.tv_sec << 32) ^ now.tv_nsec ^ getpid();
+  }
+  UNLOCK(capsLock);
+
+  return bootId;
+}
+
+
+gbCapResp *
+gbCapRespDup(gbCapResp *caps)
+{
+  gbCapResp *dup = NULL;
+
+
+  if (!caps || GB_ALLOC(dup) < 0) {
+    return NULL;
+  }
+
+  if (GB_ALLOC_N(dup->response, caps->capMax) < 0) {
+    GB_FREE(dup);
+    return NULL;
+  }
+
+  memcpy(dup->response, caps->response, caps->capMax * sizeof(gbCapObj));
+  dup->capMax = caps->capMax;
+  dup->bootId = caps->bootId;
+
+  return dup;
+}
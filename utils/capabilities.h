@@ -22,6 +22,7 @@ typedef struct gbCapObj {
 typedef struct gbCapResp {
   int capMax;
   gbCapObj *response;
+  u_quad_t bootId;   /* of the daemon which replied, 0 for older versions */
 } gbCapResp;
 
 
@@ -30,9 +31,11 @@ enum gbCapabilities {
   GB_CREATE_HA_CAP,
   GB_CREATE_PREALLOC_CAP,
   GB_CREATE_AUTH_CAP,
+  GB_CREATE_BATCH_CAP,
 
   GB_DELETE_CAP,
   GB_DELETE_FORCE_CAP,
+  GB_DELETE_BATCH_CAP,
 
   GB_MODIFY_CAP,
   GB_MODIFY_AUTH_CAP,
@@ -50,9 +53,11 @@ static const char *const gbCapabilitiesLookup[] = {
   [GB_CREATE_HA_CAP]           = "create_ha",
   [GB_CREATE_PREALLOC_CAP]     = "create_prealloc",
   [GB_CREATE_AUTH_CAP]         = "create_auth",
+  [GB_CREATE_BATCH_CAP]        = "create_batch",
 
   [GB_DELETE_CAP]              = "delete",
   [GB_DELETE_FORCE_CAP]        = "delete_force",
+  [GB_DELETE_BATCH_CAP]        = "delete_batch",
 
   [GB_MODIFY_CAP]              = "modify",
   [GB_MODIFY_AUTH_CAP]         = "modify_auth",
@@ -67,3 +72,5 @@ static const char *const gbCapabilitiesLookup[] = {
 
 int gbCapabilitiesEnumParse(const char *cap);
 int gbSetCapabilties (blockResponse **c);
+u_quad_t gbCapabilitiesBootId(void);
+gbCapResp *gbCapRespDup(gbCapResp *caps);
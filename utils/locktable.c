@@ -0,0 +1,226 @@
+/*
+  Copyright (c) 2018 Red Hat, Inc. <http://www.redhat.com>
+  This file is part of gluster-block.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+
+# include "locktable.h"
+
+
+gbLockTable gbMetaLockTable = GB_LOCK_TABLE_INITIALIZER(gbMetaLockTable);
+
+typedef struct gbLockEntry {
+  char *key;
+  size_t refs;      /* holders + waiters */
+  bool held;        /* exclusively */
+  size_t sharers;   /* holding it shared */
+  size_t writers;   /* waiting for it exclusively */
+  void *data;       /* what the sharers hold it through */
+  pthread_cond_t cond;
+
+  struct list_head list;
+} gbLockEntry;
+
+
+static gbLockEntry *
+gbLockTableLookup(gbLockTable *table, const char *key)
+{
+  gbLockEntry *entry;
+
+
+  list_for_each_entry(entry, &table->entries, list) {
+    if (!strcmp(entry->key, key)) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+
+/* Call with table->lock held */
+static gbLockEntry *
+gbLockTableGet(gbLockTable *table, const char *key)
+{
+  gbLockEntry *entry;
+
+
+  entry = gbLockTableLookup(table, key);
+  if (!entry) {
+    if (GB_ALLOC(entry) < 0) {
+      return NULL;
+    }
+    if (GB_STRDUP(entry->key, key) < 0) {
+      GB_FREE(entry);
+      return NULL;
+    }
+    pthread_cond_init(&entry->cond, NULL);
+    list_add(&entry->list, &table->entries);
+  }
+  entry->refs++;
+
+  return entry;
+}
+
+
+int
+gbLockTableAcquire(gbLockTable *table, const char *key)
+{
+  gbLockEntry *entry;
+
+
+  LOCK(table->lock);
+  entry = gbLockTableGet(table, key);
+  if (!entry) {
+    UNLOCK(table->lock);
+    return -1;
+  }
+
+  entry->writers++;
+  while (entry->held || entry->sharers) {
+    pthread_cond_wait(&entry->cond, &table->lock);
+  }
+  entry->writers--;
+  entry->held = true;
+  UNLOCK(table->lock);
+
+  return 0;
+}
+
+
+/* As gbLockTableAcquire(), but -1 with errno EBUSY instead of waiting */
+int
+gbLockTableTryAcquire(gbLockTable *table, const char *key)
+{
+  gbLockEntry *entry;
+
+
+  LOCK(table->lock);
+  entry = gbLockTableGet(table, key);
+  if (!entry) {
+    UNLOCK(table->lock);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* somebody else has a reference too, the entry stays */
+  if (entry->held || entry->sharers || entry->writers) {
+    entry->refs--;
+    UNLOCK(table->lock);
+    errno = EBUSY;
+    return -1;
+  }
+  entry->held = true;
+  UNLOCK(table->lock);
+
+  return 0;
+}
+
+
+int
+gbLockTableAcquireShared(gbLockTable *table, const char *key, bool *first)
+{
+  gbLockEntry *entry;
+
+
+  LOCK(table->lock);
+  entry = gbLockTableGet(table, key);
+  if (!entry) {
+    UNLOCK(table->lock);
+    return -1;
+  }
+
+  /* waiting writers go first, or a stream of readers starves them */
+  while (entry->held || entry->writers) {
+    pthread_cond_wait(&entry->cond, &table->lock);
+  }
+  *first = !entry->sharers;
+  if (*first) {
+    entry->held = true;
+  } else {
+    entry->sharers++;
+  }
+  UNLOCK(table->lock);
+
+  return 0;
+}
+
+
+void
+gbLockTableShare(gbLockTable *table, const char *key, void *data)
+{
+  gbLockEntry *entry;
+
+
+  LOCK(table->lock);
+  entry = gbLockTableLookup(table, key);
+  if (entry) {
+    entry->data = data;
+    entry->held = false;
+    entry->sharers++;
+    pthread_cond_broadcast(&entry->cond);
+  }
+  UNLOCK(table->lock);
+}
+
+
+int
+gbLockTableReleaseShared(gbLockTable *table, const char *key, bool *last,
+                         void **data)
+{
+  gbLockEntry *entry;
+
+
+  LOCK(table->lock);
+  entry = gbLockTableLookup(table, key);
+  if (!entry || !entry->sharers) {
+    UNLOCK(table->lock);
+    LOG("mgmt", GB_LOG_ERROR, "release of unknown shared lock %s", key);
+    return -1;
+  }
+
+  *last = (entry->sharers == 1);
+  entry->sharers--;
+  if (*last) {
+    entry->held = true;
+    *data = entry->data;
+    entry->data = NULL;
+  } else {
+    entry->refs--;
+  }
+  UNLOCK(table->lock);
+
+  return 0;
+}
+
+
+void
+gbLockTableRelease(gbLockTable *table, const char *key)
+{
+  gbLockEntry *entry;
+
+
+  LOCK(table->lock);
+  entry = gbLockTableLookup(table, key);
+  if (!entry) {
+    UNLOCK(table->lock);
+    LOG("mgmt", GB_LOG_ERROR, "release of unknown lock %s", key);
+    return;
+  }
+
+  entry->held = false;
+  if (--entry->refs) {
+    pthread_cond_broadcast(&entry->cond);
+  } else {
+    list_del(&entry->list);
+    pthread_cond_destroy(&entry->cond);
+    GB_FREE(entry->key);
+    GB_FREE(entry);
+  }
+  UNLOCK(table->lock);
+}
@@ -0,0 +1,64 @@
+/*
+  Copyright (c) 2018 Red Hat, Inc. <http://www.redhat.com>
+  This file is part of gluster-block.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+
+# ifndef   _LOCKTABLE_H
+# define   _LOCKTABLE_H   1
+
+# include  <pthread.h>
+
+# include  "common.h"
+# include  "list.h"
+
+
+/* Named in-process locks, entries live only while somebody holds or
+ * waits on them. */
+typedef struct gbLockTable {
+  pthread_mutex_t lock;
+  struct list_head entries;
+} gbLockTable;
+
+# define  GB_LOCK_TABLE_INITIALIZER(name)                            \
+          { PTHREAD_MUTEX_INITIALIZER, LIST_HEAD_INIT(name.entries) }
+
+
+/* glfs_posix_lock() on meta.lock is owned by the process, and all of its
+ * locks go through one fd, so threads taking the same byte of it must be
+ * kept apart here first */
+extern gbLockTable gbMetaLockTable;
+
+
+int
+gbLockTableAcquire(gbLockTable *table, const char *key);
+
+int
+gbLockTableTryAcquire(gbLockTable *table, const char *key);
+
+void
+gbLockTableRelease(gbLockTable *table, const char *key);
+
+/* Shared holders of key rely on one lock between them, which belongs to
+ * the entry and not to any one of them: the first one gets key
+ * exclusively, takes that lock and hands it over as data to
+ * gbLockTableShare() (or calls gbLockTableRelease() if it failed). The
+ * last one to leave gets key exclusively with data back, drops that lock
+ * and calls gbLockTableRelease(). Everybody else only counts. */
+int
+gbLockTableAcquireShared(gbLockTable *table, const char *key, bool *first);
+
+void
+gbLockTableShare(gbLockTable *table, const char *key, void *data);
+
+int
+gbLockTableReleaseShared(gbLockTable *table, const char *key, bool *last,
+                         void **data);
+
+
+# endif /* _LOCKTABLE_H */
@@ -8,96 +8,455 @@
   cases as published by the Free Software Foundation.
 */
 
+# include <pthread.h>
+# include <stdint.h>
+# include <time.h>
+
 # include "lru.h"
 
 
+/* Entries are on the Cache list warmest first, and hashed by volume name
+ * and by glfs for lookups. An evicted entry leaves the list and the name
+ * index at once, but stays in the glfs index until its last user lets go
+ * of it. lruLock guards all of it. */
 static struct list_head Cache;
-static int lruCount;
+static struct list_head nameIndex[LRU_BUCKETS];
+static struct list_head glfsIndex[LRU_BUCKETS];
+static size_t lruCount;
+static size_t lruRss;                       /* estimated, of the cached */
+static size_t lruRssEstimate = LRU_RSS_DEFAULT;  /* for the unmeasured */
+static pthread_mutex_t lruLock = PTHREAD_MUTEX_INITIALIZER;
 size_t glfsLruCount = 5;  /* default lru cache size */
+size_t glfsLruIdleTimeout;  /* seconds unused before eviction, 0 never */
+size_t glfsLruMemory;       /* MiB the cached may take, 0 unbounded */
 
 typedef struct Entry {
   char volume[255];
   glfs_t *glfs;
+  struct glfs_object *dirs[GB_CACHE_DIRS];
+  struct glfs_fd *lkfd;  /* of GB_TXLOCKFILE, all our locks go through it */
+  int layout;  /* of GB_METADIR, as last read */
+  size_t refs;    /* users, each from queryCache() or appendNewEntry() */
+  bool evicted;   /* glfs_fini() when the last of them leaves */
+  size_t rss;     /* estimated footprint of glfs */
+  time_t used;    /* when last handed out or given back */
 
   struct list_head list;
+  struct list_head byName;
+  struct list_head byGlfs;
 } Entry;
 
 
+static time_t
+lruNow(void)
+{
+  struct timespec ts;
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec;
+}
+
+
+static struct list_head *
+nameBucket(const char *volname)
+{
+  unsigned long hash = 5381;
+
+
+  while (*volname) {
+    hash = hash * 33 + (unsigned char)*volname++;
+  }
+
+  return &nameIndex[hash % LRU_BUCKETS];
+}
+
+
+static struct list_head *
+glfsBucket(glfs_t *glfs)
+{
+  return &glfsIndex[((uintptr_t)glfs >> 4) % LRU_BUCKETS];
+}
+
+
+static Entry *
+findVolume(const char *volname)
+{
+  Entry *tmp;
+
+
+  list_for_each_entry(tmp, nameBucket(volname), byName) {
+    if (!strcmp(tmp->volume, volname)) {
+      return tmp;
+    }
+  }
+
+  return NULL;
+}
+
+
+static Entry *
+findEntry(glfs_t *glfs)
+{
+  Entry *tmp;
+
+
+  list_for_each_entry(tmp, glfsBucket(glfs), byGlfs) {
+    if (tmp->glfs == glfs) {
+      return tmp;
+    }
+  }
+
+  return NULL;
+}
+
+
 static void
+freeEntry(Entry *tmp)
+{
+  int i;
+
+
+  /* unused now, or it would still be referenced, so no locks go along */
+  if (tmp->lkfd) {
+    glfs_close(tmp->lkfd);
+  }
+  for (i = 0; i < GB_CACHE_DIRS; i++) {
+    if (tmp->dirs[i]) {
+      glfs_h_close(tmp->dirs[i]);
+    }
+  }
+  glfs_fini(tmp->glfs);
+  GB_FREE(tmp);
+}
+
+
+/* Unlinks the coldest entry, call with lruLock held. Returns it if it is
+ * not in use, and up to the caller to free. */
+static Entry *
 releaseColdEntry(void)
 {
   Entry *tmp;
-  struct list_head *pos, *q = &Cache;
 
 
-  list_for_each_prev(pos, q) {
-    tmp = list_entry(pos, Entry, list);
-    list_del(pos);
+  if (list_empty(&Cache)) {
+    return NULL;
+  }
 
-    glfs_fini(tmp->glfs);
-    GB_FREE(tmp);
-    lruCount--;
+  tmp = list_entry(Cache.prev, Entry, list);
+  list_del(&tmp->list);
+  list_del(&tmp->byName);
+  tmp->evicted = true;
+  lruCount--;
+  lruRss -= tmp->rss;
 
-    break;
+  if (tmp->refs) {
+    return NULL;  /* the last releaseCache() frees it */
   }
+  list_del(&tmp->byGlfs);
+
+  return tmp;
 }
 
 
-int
-appendNewEntry(const char *volname, glfs_t *fs)
+/* Evicts from the cold end until the cache is back within both the
+ * count and the memory bounds, sparing the warmest entry. Entries free to
+ * go are moved on to reap, call with lruLock held. */
+static void
+releaseColdEntries(struct list_head *reap)
 {
-  Entry *tmp;
+  Entry *cold;
+
+
+  while (lruCount > 1 &&
+         (lruCount > glfsLruCount ||
+          (glfsLruMemory && lruRss > (glfsLruMemory << 20)))) {
+    cold = releaseColdEntry();
+    if (cold) {
+      list_add(&cold->list, reap);
+    }
+  }
+}
+
+
+static void
+freeEntries(struct list_head *reap)
+{
+  Entry *tmp, *next;
 
 
-  if (lruCount == glfsLruCount) {
-    releaseColdEntry();
+  list_for_each_entry_safe(tmp, next, reap, list) {
+    list_del(&tmp->list);
+    freeEntry(tmp);
   }
+}
+
+
+/* The caller keeps a reference to fs, as from queryCache(). rss is what
+ * fs was measured to take, 0 if it couldn't be told apart. */
+int
+appendNewEntry(const char *volname, glfs_t *fs, size_t rss)
+{
+  LIST_HEAD(reap);
+  Entry *tmp;
+
 
   if (GB_ALLOC(tmp) < 0) {
     return -1;
   }
   GB_STRCPYSTATIC(tmp->volume, volname);
   tmp->glfs = fs;
+  tmp->refs = 1;
+
+  LOCK(lruLock);
+  if (rss) {
+    lruRssEstimate = (lruRssEstimate * 3 + rss) / 4;
+  }
+  tmp->rss = rss ? rss : lruRssEstimate;
+  tmp->used = lruNow();
 
-  list_add(&(tmp->list), &Cache);
+  list_add(&tmp->list, &Cache);
+  list_add(&tmp->byName, nameBucket(volname));
+  list_add(&tmp->byGlfs, glfsBucket(fs));
 
   lruCount++;
+  lruRss += tmp->rss;
+  releaseColdEntries(&reap);
+  UNLOCK(lruLock);
+
+  /* glfs_fini() takes a while, lookups needn't wait for it */
+  freeEntries(&reap);
 
   return 0;
 }
 
 
-static void
-boostEntryWarmness(const char *volname)
+/* The glfs comes with a reference, to be given back to releaseCache() */
+glfs_t *
+queryCache(const char *volname)
 {
   Entry *tmp;
-  struct list_head *pos, *q;
+  glfs_t *glfs = NULL;
 
 
-  list_for_each_safe(pos, q, &Cache){
-    tmp = list_entry(pos, Entry, list);
-    if (!strcmp(tmp->volume, volname)) {
-      list_del(pos);
-      list_add(&(tmp->list), &Cache);
-      break;
-    }
+  LOCK(lruLock);
+  tmp = findVolume(volname);
+  if (tmp) {
+    list_move(&tmp->list, &Cache);
+    tmp->refs++;
+    tmp->used = lruNow();
+    glfs = tmp->glfs;
   }
+  UNLOCK(lruLock);
+
+  return glfs;
 }
 
 
-glfs_t *
-queryCache(const char *volname)
+/* One more reference to a glfs somebody already holds one to, for
+ * releaseCache() too */
+void
+holdCache(glfs_t *glfs)
 {
   Entry *tmp;
-  struct list_head *pos, *q, *r = &Cache;
 
 
-  list_for_each_safe(pos, q, r){
-    tmp = list_entry(pos, Entry, list);
-    if (!strcmp(tmp->volume, volname)) {
-      boostEntryWarmness(volname);
-      return tmp->glfs;
+  LOCK(lruLock);
+  tmp = findEntry(glfs);
+  if (tmp) {
+    tmp->refs++;
+  }
+  UNLOCK(lruLock);
+}
+
+
+void
+releaseCache(glfs_t *glfs)
+{
+  Entry *tmp;
+
+
+  if (!glfs) {
+    return;
+  }
+
+  LOCK(lruLock);
+  tmp = findEntry(glfs);
+  if (tmp) {
+    tmp->used = lruNow();
+  }
+  if (!tmp || --tmp->refs || !tmp->evicted) {
+    UNLOCK(lruLock);
+    return;
+  }
+  list_del(&tmp->byGlfs);
+  UNLOCK(lruLock);
+
+  freeEntry(tmp);
+}
+
+
+struct glfs_object *
+queryCacheDir(glfs_t *glfs, int dir)
+{
+  struct glfs_object *obj = NULL;
+  Entry *tmp;
+
+
+  LOCK(lruLock);
+  tmp = findEntry(glfs);
+  if (tmp) {
+    obj = tmp->dirs[dir];
+  }
+  UNLOCK(lruLock);
+
+  return obj;
+}
+
+
+/* Keeps obj with the cached glfs, unless another thread was first; the
+ * handle kept is returned either way and obj is closed if it isn't it */
+struct glfs_object *
+storeCacheDir(glfs_t *glfs, int dir, struct glfs_object *obj)
+{
+  struct glfs_object *kept;
+  Entry *tmp;
+
+
+  LOCK(lruLock);
+  tmp = findEntry(glfs);
+  if (tmp && !tmp->dirs[dir]) {
+    tmp->dirs[dir] = obj;
+  }
+  kept = tmp ? tmp->dirs[dir] : NULL;
+  UNLOCK(lruLock);
+
+  if (kept != obj) {
+    glfs_h_close(obj);
+  }
+  if (!kept) {
+    errno = ESTALE;  /* glfs left the cache, and is gone */
+  }
+
+  return kept;
+}
+
+
+struct glfs_fd *
+queryCacheLockFd(glfs_t *glfs)
+{
+  struct glfs_fd *lkfd = NULL;
+  Entry *tmp;
+
+
+  LOCK(lruLock);
+  tmp = findEntry(glfs);
+  if (tmp) {
+    lkfd = tmp->lkfd;
+  }
+  UNLOCK(lruLock);
+
+  return lkfd;
+}
+
+
+/* As storeCacheDir(), for the fd of GB_TXLOCKFILE */
+struct glfs_fd *
+storeCacheLockFd(glfs_t *glfs, struct glfs_fd *lkfd)
+{
+  struct glfs_fd *kept;
+  Entry *tmp;
+
+
+  LOCK(lruLock);
+  tmp = findEntry(glfs);
+  if (tmp && !tmp->lkfd) {
+    tmp->lkfd = lkfd;
+  }
+  kept = tmp ? tmp->lkfd : NULL;
+  UNLOCK(lruLock);
+
+  if (kept != lkfd) {
+    glfs_close(lkfd);
+  }
+  if (!kept) {
+    errno = ESTALE;
+  }
+
+  return kept;
+}
+
+
+/* 0, the flat layout, for a glfs not in the cache */
+int
+queryCacheLayout(glfs_t *glfs)
+{
+  Entry *tmp;
+  int layout = 0;
+
+
+  LOCK(lruLock);
+  tmp = findEntry(glfs);
+  if (tmp) {
+    layout = tmp->layout;
+  }
+  UNLOCK(lruLock);
+
+  return layout;
+}
+
+
+/* layouts only ever move on, a stale read never takes one back */
+void
+storeCacheLayout(glfs_t *glfs, int layout)
+{
+  Entry *tmp;
+
+
+  LOCK(lruLock);
+  tmp = findEntry(glfs);
+  if (tmp && layout > tmp->layout) {
+    tmp->layout = layout;
+  }
+  UNLOCK(lruLock);
+}
+
+
+/* Evicts the entries nobody used for glfsLruIdleTimeout, looking a few
+ * times per timeout */
+static void *
+releaseIdleProc(void *data)
+{
+  struct timespec pause = {0, };
+  Entry *tmp, *next;
+  LIST_HEAD(reap);
+  time_t now;
+
+
+  pause.tv_sec = glfsLruIdleTimeout / 4 ? glfsLruIdleTimeout / 4 : 1;
+
+  while (1) {
+    nanosleep(&pause, NULL);
+
+    LOCK(lruLock);
+    now = lruNow();
+    list_for_each_entry_safe(tmp, next, &Cache, list) {
+      if (tmp->refs || now - tmp->used < (time_t)glfsLruIdleTimeout) {
+        continue;
+      }
+      list_del(&tmp->list);
+      list_del(&tmp->byName);
+      list_del(&tmp->byGlfs);
+      lruCount--;
+      lruRss -= tmp->rss;
+      list_add(&tmp->list, &reap);
+      LOG("gfapi", GB_LOG_INFO, "releasing volume %s, idle for %zus",
+          tmp->volume, (size_t)(now - tmp->used));
     }
+    UNLOCK(lruLock);
+
+    freeEntries(&reap);
   }
 
   return NULL;
@@ -107,5 +466,22 @@ queryCache(const char *volname)
 void
 initCache(void)
 {
+  pthread_t tid;
+  size_t i;
+
+
   INIT_LIST_HEAD(&Cache);
+  for (i = 0; i < LRU_BUCKETS; i++) {
+    INIT_LIST_HEAD(&nameIndex[i]);
+    INIT_LIST_HEAD(&glfsIndex[i]);
+  }
+
+  if (glfsLruIdleTimeout) {
+    if (pthread_create(&tid, NULL, releaseIdleProc, NULL)) {
+      LOG("gfapi", GB_LOG_ERROR, "%s",
+          "starting the idle glfs eviction thread failed");
+    } else {
+      pthread_detach(tid);
+    }
+  }
 }
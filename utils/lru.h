@@ -13,11 +13,26 @@
 # define   _LRU_H   1
 
 # include  <glusterfs/api/glfs.h>
+# include  <glusterfs/api/glfs-handles.h>
 
 # include  "common.h"
 # include  "list.h"
 
-# define   LRU_COUNT_MAX   512
+# define   LRU_COUNT_MAX          512
+# define   LRU_IDLE_TIMEOUT_MAX   604800       /* seconds, a week */
+# define   LRU_MEMORY_MAX         1048576      /* MiB */
+# define   LRU_RSS_DEFAULT        (32UL << 20) /* per glfs, until measured */
+# define   LRU_BUCKETS            1024  /* of its lookup indexes */
+
+/* directory handles kept along with a cached volume, bucket b of a hashed
+ * GB_METADIR is GB_CACHE_BUCKETS + b */
+enum {
+  GB_CACHE_METADIR = 0,
+  GB_CACHE_STOREDIR,
+  GB_CACHE_METATMPDIR,
+  GB_CACHE_BUCKETS,
+  GB_CACHE_DIRS = GB_CACHE_BUCKETS + GB_META_BUCKETS
+};
 
 void
 initCache(void);
@@ -26,7 +41,31 @@ glfs_t *
 queryCache(const char *volname);
 
 int
-appendNewEntry(const char *volname, glfs_t *glfs);
+appendNewEntry(const char *volname, glfs_t *glfs, size_t rss);
+
+void
+holdCache(glfs_t *glfs);
+
+void
+releaseCache(glfs_t *glfs);
+
+struct glfs_object *
+queryCacheDir(glfs_t *glfs, int dir);
+
+struct glfs_object *
+storeCacheDir(glfs_t *glfs, int dir, struct glfs_object *obj);
+
+struct glfs_fd *
+queryCacheLockFd(glfs_t *glfs);
+
+struct glfs_fd *
+storeCacheLockFd(glfs_t *glfs, struct glfs_fd *lkfd);
+
+int
+queryCacheLayout(glfs_t *glfs);
+
+void
+storeCacheLayout(glfs_t *glfs, int layout);
 
 
 # endif /* _LRU_H */
@@ -0,0 +1,293 @@
+/*
+  Copyright (c) 2018 Red Hat, Inc. <http://www.redhat.com>
+  This file is part of gluster-block.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+
+# define   _GNU_SOURCE
+# include  <fcntl.h>
+# include  <poll.h>
+# include  <signal.h>
+# include  <spawn.h>
+# include  <sys/syscall.h>
+# include  <sys/wait.h>
+
+# include  "runner.h"
+
+
+extern char **environ;
+
+
+static long
+gbRunNow(void)
+{
+  struct timespec now;
+
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/* fd that polls readable once pid exits, -1 on kernels without pidfds */
+static int
+gbRunPidfd(pid_t pid)
+{
+# ifdef SYS_pidfd_open
+  return syscall(SYS_pidfd_open, pid, 0);
+# else
+  errno = ENOSYS;
+  return -1;
+# endif
+}
+
+
+int
+gbSpawn(char *const argv[], const char *env, pid_t *pid, int *in, int *out)
+{
+  posix_spawn_file_actions_t actions;
+  char **envp = environ;
+  int inp[2] = {-1, -1};
+  int outp[2] = {-1, -1};
+  size_t n = 0;
+  size_t i;
+  int errsv = 0;
+  int ret = -1;
+
+
+  if (pipe2(inp, O_CLOEXEC) || pipe2(outp, O_CLOEXEC)) {
+    errsv = errno;
+    LOG("mgmt", GB_LOG_ERROR, "pipe2() failed (%s)", strerror(errno));
+    goto out;
+  }
+
+  if (env) {
+    while (environ[n]) {
+      n++;
+    }
+    if (GB_ALLOC_N(envp, n + 2) < 0) {
+      errsv = ENOMEM;
+      goto out;
+    }
+    for (i = 0; i < n; i++) {
+      envp[i] = environ[i];
+    }
+    envp[n] = (char *)env;
+  }
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, inp[0], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, outp[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, outp[1], STDERR_FILENO);
+  ret = posix_spawnp(pid, argv[0], &actions, NULL, argv, envp);
+  posix_spawn_file_actions_destroy(&actions);
+  if (ret) {
+    errsv = ret;
+    LOG("mgmt", GB_LOG_ERROR, "starting %s failed (%s)",
+        argv[0], strerror(ret));
+    ret = -1;
+    goto out;
+  }
+
+  *in = inp[1];
+  *out = outp[0];
+  inp[1] = outp[0] = -1;
+
+ out:
+  for (i = 0; i < 2; i++) {
+    if (inp[i] != -1) {
+      close(inp[i]);
+    }
+    if (outp[i] != -1) {
+      close(outp[i]);
+    }
+  }
+  if (envp != environ) {
+    GB_FREE(envp);
+  }
+  if (errsv) {
+    errno = errsv;
+  }
+
+  return ret;
+}
+
+
+int
+gbRun(char *const argv[], const char *input, time_t timeout, gbRunResult *res)
+{
+  struct pollfd pfd[2];
+  struct timespec pause = {0, 0};
+  long backoff = 1;
+  long start = gbRunNow();
+  long deadline = start + timeout * 1000;
+  long left;
+  size_t size = 8192;
+  size_t inlen = input ? strlen(input) : 0;
+  size_t inoff = 0;
+  bool feeding;
+  pid_t pid;
+  int in = -1;
+  int out = -1;
+  int pidfd = -1;
+  int status;
+  ssize_t n;
+  int ret = -1;
+
+
+  memset(res, 0, sizeof(*res));
+  res->status = -1;
+
+  if (GB_ALLOC_N(res->out, size) < 0) {
+    return -1;
+  }
+
+  LOG("mgmt", GB_LOG_DEBUG, "command, %s", argv[0]);
+  if (gbSpawn(argv, NULL, &pid, &in, &out)) {
+    return -1;
+  }
+
+  if (!inlen) {
+    close(in);
+    in = -1;
+  } else {
+    fcntl(in, F_SETFL, O_NONBLOCK);
+  }
+
+  while (out != -1) {
+    left = deadline - gbRunNow();
+    if (left <= 0) {
+      LOG("mgmt", GB_LOG_ERROR, "%s timed out after %ld secs, killing it",
+          argv[0], (long)timeout);
+      res->timedOut = true;
+      kill(pid, SIGKILL);
+      break;
+    }
+
+    pfd[0].fd = out;
+    pfd[0].events = POLLIN;
+    feeding = (in != -1);
+    if (feeding) {
+      pfd[1].fd = in;
+      pfd[1].events = POLLOUT;
+    }
+
+    n = poll(pfd, feeding ? 2 : 1, left);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      LOG("mgmt", GB_LOG_ERROR, "poll() failed (%s)", strerror(errno));
+      kill(pid, SIGKILL);
+      break;
+    }
+
+    if (feeding && pfd[1].revents) {
+      n = write(in, input + inoff, inlen - inoff);
+      if (n > 0) {
+        inoff += n;
+      }
+      /* EOF for it, once it has all; it may also quit before reading all */
+      if (inoff == inlen ||
+          (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        close(in);
+        in = -1;
+      }
+    }
+
+    if (pfd[0].revents) {
+      if (res->len == size - 1) {
+        if (GB_REALLOC_N(res->out, size * 2) < 0) {
+          kill(pid, SIGKILL);
+          break;
+        }
+        size *= 2;
+      }
+
+      n = read(out, res->out + res->len, size - res->len - 1);
+      if (n > 0) {
+        res->len += n;
+        res->out[res->len] = '\0';
+      } else if (!n || errno != EINTR) {
+        close(out);
+        out = -1;
+      }
+    }
+  }
+
+  if (in != -1) {
+    close(in);
+  }
+  if (out != -1) {
+    close(out);
+  }
+
+  /* closing its stdout doesn't mean it is done, sleep on its pidfd until
+   * it exits or the deadline comes, backing off where there is none */
+  if (!res->timedOut) {
+    pidfd = gbRunPidfd(pid);
+  }
+  while (!res->timedOut &&
+         (!(n = waitpid(pid, &status, WNOHANG)) || (n < 0 && errno == EINTR))) {
+    left = deadline - gbRunNow();
+    if (left <= 0) {
+      LOG("mgmt", GB_LOG_ERROR, "%s timed out after %ld secs, killing it",
+          argv[0], (long)timeout);
+      res->timedOut = true;
+      kill(pid, SIGKILL);
+      break;
+    }
+
+    if (pidfd != -1) {
+      pfd[0].fd = pidfd;
+      pfd[0].events = POLLIN;
+      poll(pfd, 1, left);
+      continue;
+    }
+
+    backoff = (backoff * 2 < GB_RUN_REAP_MSECS) ?
+              backoff * 2 : GB_RUN_REAP_MSECS;
+    if (backoff > left) {
+      backoff = left;
+    }
+    pause.tv_sec = backoff / 1000;
+    pause.tv_nsec = (backoff % 1000) * 1000000;
+    nanosleep(&pause, NULL);
+  }
+  if (pidfd != -1) {
+    close(pidfd);
+  }
+
+  /* SIGKILL can't be caught or ignored, it won't take long */
+  if (res->timedOut) {
+    do {
+      n = waitpid(pid, &status, 0);
+    } while (n < 0 && errno == EINTR);
+  }
+  if (n == pid && WIFEXITED(status)) {
+    res->status = WEXITSTATUS(status);
+    ret = 0;
+  }
+
+  res->msecs = gbRunNow() - start;
+  LOG("mgmt", GB_LOG_DEBUG, "%s exited %d after %ld ms, output, %s",
+      argv[0], res->status, res->msecs, res->out);
+  if (res->msecs >= GB_RUN_SLOW_MSECS) {
+    LOG("mgmt", GB_LOG_WARNING, "%s took %ld ms", argv[0], res->msecs);
+  }
+
+  return ret;
+}
+
+
+void
+gbRunResultFree(gbRunResult *res)
+{
+  GB_FREE(res->out);
+  res->len = 0;
+}
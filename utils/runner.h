@@ -0,0 +1,52 @@
+/*
+  Copyright (c) 2018 Red Hat, Inc. <http://www.redhat.com>
+  This file is part of gluster-block.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+
+# ifndef   _RUNNER_H
+# define   _RUNNER_H   1
+
+# include  <sys/types.h>
+
+# include  "utils.h"
+
+# define   GB_RUN_TIMEOUT       300  /* secs, same as the rpc timeout */
+# define   GB_RUN_SLOW_MSECS    5000 /* logged as slow from here on */
+# define   GB_RUN_REAP_MSECS    100  /* longest pause between reap attempts,
+                                      * where there is no pidfd */
+
+
+typedef struct gbRunResult {
+  int status;        /* exit status, -1 if it didn't exit by itself */
+  bool timedOut;     /* and got killed for that */
+  char *out;         /* stdout and stderr, NUL terminated */
+  size_t len;
+  long msecs;        /* from spawn until it was reaped */
+} gbRunResult;
+
+
+/* Starts argv[0] from PATH with env added to the environment (if not
+ * NULL), *in and *out are pipes to its stdin and its stdout/stderr. No
+ * shell is involved and nothing of the daemon is copied but the
+ * mappings, which vfork style spawning shares. */
+int
+gbSpawn(char *const argv[], const char *env, pid_t *pid, int *in, int *out);
+
+/* Runs argv to completion, feeding it input (may be NULL) and capturing
+ * all it prints in res. Killed after timeout secs. Returns 0 when it
+ * exited (res->status tells how), -1 if it couldn't run or was killed.
+ * Either way res is to be freed with gbRunResultFree(). */
+int
+gbRun(char *const argv[], const char *input, time_t timeout, gbRunResult *res);
+
+void
+gbRunResultFree(gbRunResult *res);
+
+
+# endif /* _RUNNER_H */
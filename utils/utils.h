@@ -43,7 +43,10 @@
 
 # define  GB_METADIR             "/block-meta"
 # define  GB_STOREDIR            "/block-store"
+# define  GB_METATMPDIR          "/.block-meta-tmp"  /* meta files being rewritten */
 # define  GB_TXLOCKFILE          "meta.lock"
+# define  GB_METALAYOUTFILE      ".layout"   /* in GB_METADIR, if not flat */
+# define  GB_META_BUCKETS        256         /* subdirs of a hashed GB_METADIR */
 
 # define  GB_MAX_LOGFILENAME     64  /* max strlen of file name */
 
@@ -157,125 +160,89 @@ extern struct gbConf gbConf;
             }                                                          \
           } while (0)
 
-# define  GB_METALOCK_OR_GOTO(lkfd, volume, errCode, errMsg, label)  \
-          do {                                                       \
-            struct flock lock = {0, };                               \
-            lock.l_type = F_WRLCK;                                   \
-            if (glfs_posix_lock (lkfd, F_SETLKW, &lock)) {           \
-              LOG("mgmt", GB_LOG_ERROR, "glfs_posix_lock() on "      \
-                  "volume %s failed[%s]", volume, strerror(errno));  \
-              errCode = errno;                                       \
-              if (!errMsg) {                                         \
-                    GB_ASPRINTF (&errMsg, "Not able to acquire "     \
-                        "lock on %s[%s]", volume, strerror(errCode));\
-              }                                                      \
-              goto label;                                            \
-            }                                                        \
+/* block NULL is the namespace of the volume: names coming and going;
+ * info and list only read, and share it through the RD variants. All of
+ * them lock through the one lock fd of the volume, the RD ones find it
+ * from glfs */
+# define  GB_LOCK_OR_GOTO(lkfd, volume, block, errCode, errMsg, label) \
+          do {                                                        \
+            if (glusterBlockMetaLock(lkfd, volume, block,             \
+                                     &errCode, &errMsg)) {            \
+              goto label;                                             \
+            }                                                         \
+          } while (0)
+
+# define  GB_RDLOCK_OR_GOTO(glfs, volume, block, errCode, errMsg,      \
+                            label)                                    \
+          do {                                                        \
+            if (glusterBlockMetaLockShared(glfs, volume, block,       \
+                                           &errCode, &errMsg)) {      \
+              goto label;                                             \
+            }                                                         \
           } while (0)
 
-# define  GB_METAUPDATE_OR_GOTO(lock, glfs, fname,                      \
+# define  GB_METALOCK_OR_GOTO(lkfd, volume, errCode, errMsg, label)    \
+          GB_LOCK_OR_GOTO(lkfd, volume, NULL, errCode, errMsg, label)
+
+# define  GB_METARDLOCK_OR_GOTO(glfs, volume, errCode, errMsg, label)  \
+          GB_RDLOCK_OR_GOTO(glfs, volume, NULL, errCode, errMsg, label)
+
+# define  GB_BLOCKLOCK_OR_GOTO(lkfd, volume, block, errCode, errMsg,   \
+                               label)                                 \
+          GB_LOCK_OR_GOTO(lkfd, volume, block, errCode, errMsg, label)
+
+# define  GB_BLOCKRDLOCK_OR_GOTO(glfs, volume, block, errCode, errMsg, \
+                                 label)                               \
+          GB_RDLOCK_OR_GOTO(glfs, volume, block, errCode, errMsg, label)
+
+/* see blockMetaAppend() */
+# define  GB_METAUPDATE_OR_GOTO(glfs, fname,                            \
                                 volume, ret, errMsg, label,...)         \
           do {                                                          \
             char *write;                                                \
-            struct glfs_fd *tgmfd;                                      \
-            LOCK(lock);                                                 \
-            ret = glfs_chdir (glfs, GB_METADIR);                        \
-            if (ret) {                                                  \
-              GB_ASPRINTF(&errMsg, "Failed to update transaction log "  \
-                "for %s/%s[%s]", volume, fname, strerror(errno));       \
-              LOG("gfapi", GB_LOG_ERROR, "glfs_chdir(%s) on "           \
-                  "volume %s failed[%s]", GB_METADIR, volume,           \
-                  strerror(errno));                                     \
-              UNLOCK(lock);                                             \
-              ret = -1;                                                 \
-              goto label;                                               \
-            }                                                           \
-            tgmfd = glfs_creat(glfs, fname,                             \
-                               O_WRONLY | O_APPEND | O_SYNC,            \
-                               S_IRUSR | S_IWUSR);                      \
-            if (!tgmfd) {                                               \
-              GB_ASPRINTF(&errMsg, "Failed to update transaction log "  \
-                "for %s/%s[%s]", volume, fname, strerror(errno));       \
-              LOG("mgmt", GB_LOG_ERROR, "glfs_creat(%s): on "           \
-                  "volume %s failed[%s]", fname, volume,                \
-                  strerror(errno));                                     \
-              UNLOCK(lock);                                             \
-              ret = -1;                                                 \
-              goto label;                                               \
-            }                                                           \
             if (GB_ASPRINTF(&write, __VA_ARGS__) < 0) {                 \
               ret = -1;                                                 \
+              goto label;                                               \
             }                                                           \
-            if (!ret) {                                                 \
-              if(glfs_write (tgmfd, write, strlen(write), 0) < 0) {     \
-                GB_ASPRINTF(&errMsg, "Failed to update transaction log "\
-                  "for %s/%s[%s]", volume, fname, strerror(errno));     \
-                LOG("mgmt", GB_LOG_ERROR, "glfs_write(%s): on "         \
-                    "volume %s failed[%s]", fname, volume,              \
-                    strerror(errno));                                   \
-                ret = -1;                                               \
-              }                                                         \
-              GB_FREE(write);                                           \
-            }                                                           \
-            if (tgmfd && glfs_close(tgmfd) != 0) {                      \
+            ret = blockMetaAppend(glfs, volume, fname, write);          \
+            if (ret) {                                                  \
               GB_ASPRINTF(&errMsg, "Failed to update transaction log "  \
                 "for %s/%s[%s]", volume, fname, strerror(errno));       \
-              LOG("mgmt", GB_LOG_ERROR, "glfs_close(%s): on "           \
-                  "volume %s failed[%s]", fname, volume,                \
-                  strerror(errno));                                     \
-              UNLOCK(lock);                                             \
-              ret = -1;                                                 \
-              goto label;                                               \
             }                                                           \
-            UNLOCK(lock);                                               \
+            GB_FREE(write);                                             \
             if (ret) {                                                  \
               goto label;                                               \
             }                                                           \
           } while (0)
 
-# define  GB_METAUNLOCK(lkfd, volume, ret, errMsg)                   \
-          do {                                                       \
-            struct flock lock = {0, };                               \
-            lock.l_type = F_UNLCK;                                   \
-            if (glfs_posix_lock(lkfd, F_SETLK, &lock)) {             \
-              if (!errMsg) {                                         \
-                    GB_ASPRINTF (&errMsg, "Not able to acquire "     \
-                        "lock on %s[%s]", volume, strerror(errno));  \
-              }                                                      \
-              LOG("mgmt", GB_LOG_ERROR, "glfs_posix_lock() on "      \
-                  "volume %s failed[%s]", volume, strerror(errno));  \
-              ret = -1;                                              \
-            }                                                        \
+# define  GB_UNLOCK(lkfd, volume, block, ret, errMsg)                \
+          do {                                                        \
+            if (glusterBlockMetaUnlock(lkfd, volume, block,           \
+                                       &errMsg)) {                    \
+              ret = -1;                                               \
+            }                                                         \
           } while (0)
 
-# define  GB_CMD_EXEC_AND_VALIDATE(cmd, sr, blk, vol, opt)             \
-          do {                                                         \
-            FILE *fp;                                                  \
-            char tmp[1024];                                            \
-            LOG("mgmt", GB_LOG_DEBUG, "command, %s", cmd);             \
-            fp = popen(cmd, "r");                                      \
-            snprintf(tmp, 1024, "%s/%s", vol?vol:"", blk->block_name); \
-            if (fp) {                                                  \
-              size_t newLen = fread(sr->out, sizeof(char), 8192, fp);  \
-              if (ferror( fp ) != 0)                                   \
-                LOG("mgmt", GB_LOG_ERROR,                              \
-                    "reading command %s output for %s failed(%s)", tmp,\
-                    cmd, strerror(errno));                             \
-              else                                                     \
-                sr->out[newLen++] = '\0';                              \
-              sr->exit = blockValidateCommandOutput(sr->out, opt,      \
-                                                    (void*)blk);       \
-              pclose(fp);                                              \
-            } else {                                                   \
-              LOG("mgmt", GB_LOG_ERROR,                                \
-                  "popen(): for %s executing command %s failed(%s)",   \
-                  tmp, cmd, strerror(errno));                          \
-            }                                                          \
-            LOG("mgmt", GB_LOG_DEBUG, "raw output, %s", sr->out);      \
-            LOG("mgmt", GB_LOG_INFO, "command exit code, %d",          \
-                 sr->exit);                                            \
+# define  GB_RDUNLOCK(volume, block, ret, errMsg)                      \
+          do {                                                        \
+            if (glusterBlockMetaUnlockShared(volume, block,           \
+                                             &errMsg)) {              \
+              ret = -1;                                               \
+            }                                                         \
           } while (0)
 
+# define  GB_METAUNLOCK(lkfd, volume, ret, errMsg)                     \
+          GB_UNLOCK(lkfd, volume, NULL, ret, errMsg)
+
+# define  GB_METARDUNLOCK(volume, ret, errMsg)                         \
+          GB_RDUNLOCK(volume, NULL, ret, errMsg)
+
+# define  GB_BLOCKUNLOCK(lkfd, volume, block, ret, errMsg)             \
+          GB_UNLOCK(lkfd, volume, block, ret, errMsg)
+
+# define  GB_BLOCKRDUNLOCK(volume, block, ret, errMsg)                 \
+          GB_RDUNLOCK(volume, block, ret, errMsg)
+
 # define GB_OUT_VALIDATE_OR_GOTO(out, label, errStr, blk, vol, ...)    \
          do {                                                          \
            char *tmp;                                                  \
@@ -401,6 +368,14 @@ typedef enum gbDaemonCmdlineOption {
   GB_DAEMON_USAGE          = 3,
   GB_DAEMON_GLFS_LRU_COUNT = 4,
   GB_DAEMON_LOG_LEVEL      = 5,
+  GB_DAEMON_RPC_WORKERS    = 6,
+  GB_DAEMON_VOLUME_WORKERS = 7,
+  GB_DAEMON_BACKEND        = 8,
+  GB_DAEMON_TGCLI_PROCS    = 9,
+  GB_DAEMON_META_LAYOUT    = 10,
+  GB_DAEMON_PREWARM        = 11,
+  GB_DAEMON_GLFS_LRU_IDLE  = 12,
+  GB_DAEMON_GLFS_LRU_MEM   = 13,
 
   GB_DAEMON_OPT_MAX
 } gbDaemonCmdlineOption;
@@ -412,6 +387,14 @@ static const char *const gbDaemonCmdlineOptLookup[] = {
   [GB_DAEMON_USAGE]          = "usage",
   [GB_DAEMON_GLFS_LRU_COUNT] = "glfs-lru-count",
   [GB_DAEMON_LOG_LEVEL]      = "log-level",
+  [GB_DAEMON_RPC_WORKERS]    = "rpc-workers",
+  [GB_DAEMON_VOLUME_WORKERS] = "volume-workers",
+  [GB_DAEMON_BACKEND]        = "backend",
+  [GB_DAEMON_TGCLI_PROCS]    = "targetcli-procs",
+  [GB_DAEMON_META_LAYOUT]    = "meta-layout",
+  [GB_DAEMON_PREWARM]        = "prewarm-volumes",
+  [GB_DAEMON_GLFS_LRU_IDLE]  = "glfs-lru-idle-timeout",
+  [GB_DAEMON_GLFS_LRU_MEM]   = "glfs-lru-memory",
 
   [GB_DAEMON_OPT_MAX]        = NULL,
 };
@@ -545,10 +528,6 @@ void logTimeNow(char* buf, size_t bufSize);
 
 int initLogging(void);
 
-int gbRunnerExitStatus(int exitStatus);
-
-int gbRunner(char *cmd);
-
 int gbAlloc(void *ptrptr, size_t size,
             const char *filename, const char *funcname, size_t linenr);
 
@@ -0,0 +1,397 @@
+/*
+  Copyright (c) 2018 Red Hat, Inc. <http://www.redhat.com>
+  This file is part of gluster-block.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+
+# include "workers.h"
+
+# define   GB_SLOW_WAIT_SECS   1.0   /* waits above this are logged at INFO */
+# define   GB_WORK_STATS_MAX   128   /* keys whose waits are remembered */
+
+
+typedef struct gbWork {
+  gbWorkFn fn;
+  void *data;
+  gbWorkBatch *batch;
+  struct timespec queued;
+
+  struct list_head list;
+} gbWork;
+
+typedef struct gbWorkQueue {
+  char *key;               /* NULL holds the unkeyed work */
+  struct list_head works;
+  size_t depth;            /* waiting to run */
+  size_t running;
+
+  struct list_head list;
+} gbWorkQueue;
+
+typedef struct gbWorkStats {
+  char *key;
+  size_t served;
+  double waitTotal;        /* seconds */
+  double waitMax;
+
+  struct list_head list;
+} gbWorkStats;
+
+
+static double
+gbSecondsSince(struct timespec *then)
+{
+  struct timespec now;
+
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - then->tv_sec) + (now.tv_nsec - then->tv_nsec) / 1e9;
+}
+
+
+static void
+gbWorkBatchDone(gbWorkBatch *batch)
+{
+  LOCK(batch->lock);
+  if (!--batch->pending) {
+    pthread_cond_broadcast(&batch->cond);
+  }
+  UNLOCK(batch->lock);
+}
+
+
+static gbWorkQueue *
+gbWorkQueueLookup(gbWorkerPool *pool, const char *key)
+{
+  gbWorkQueue *queue;
+
+
+  list_for_each_entry(queue, &pool->queues, list) {
+    if (!key && !queue->key) {
+      return queue;
+    }
+    if (key && queue->key && !strcmp(key, queue->key)) {
+      return queue;
+    }
+  }
+
+  return NULL;
+}
+
+
+static void
+gbWorkQueueFree(gbWorkQueue *queue)
+{
+  list_del(&queue->list);
+  GB_FREE(queue->key);
+  GB_FREE(queue);
+}
+
+
+static void
+gbWorkStatsFree(gbWorkStats *stats)
+{
+  list_del(&stats->list);
+  GB_FREE(stats->key);
+  GB_FREE(stats);
+}
+
+
+/* Keys come from the requests, so only the most recently served
+ * GB_WORK_STATS_MAX of them are remembered. NULL if out of memory. */
+static gbWorkStats *
+gbWorkStatsGet(gbWorkerPool *pool, const char *key)
+{
+  gbWorkStats *stats;
+
+
+  list_for_each_entry(stats, &pool->stats, list) {
+    if ((!key && !stats->key) ||
+        (key && stats->key && !strcmp(key, stats->key))) {
+      list_move(&stats->list, &pool->stats);
+      return stats;
+    }
+  }
+
+  if (pool->nstats == GB_WORK_STATS_MAX) {
+    gbWorkStatsFree(list_entry(pool->stats.prev, gbWorkStats, list));
+    pool->nstats--;
+  }
+
+  if (GB_ALLOC(stats) < 0) {
+    return NULL;
+  }
+  if (key && GB_STRDUP(stats->key, key) < 0) {
+    GB_FREE(stats);
+    return NULL;
+  }
+  list_add(&stats->list, &pool->stats);
+  pool->nstats++;
+
+  return stats;
+}
+
+
+/* first queue in service order with work that is allowed to run now */
+static gbWorkQueue *
+gbWorkQueueNextRunnable(gbWorkerPool *pool)
+{
+  gbWorkQueue *queue;
+
+
+  list_for_each_entry(queue, &pool->queues, list) {
+    if (!queue->depth) {
+      continue;
+    }
+    if (queue->key && queue->running >= pool->maxPerKey) {
+      continue;
+    }
+    return queue;
+  }
+
+  return NULL;
+}
+
+
+static void *
+gbWorkerThreadProc(void *vargp)
+{
+  gbWorkerPool *pool = (gbWorkerPool *)vargp;
+  gbWorkQueue *queue;
+  gbWorkStats *stats;
+  gbWork *work;
+  double wait, avg, max;
+  size_t depth, served;
+  int level;
+
+
+  LOCK(pool->lock);
+  while (1) {
+    while (!(queue = gbWorkQueueNextRunnable(pool))) {
+      if (pool->stop && !pool->pending) {
+        goto out;
+      }
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+
+    work = list_entry(queue->works.next, gbWork, list);
+    list_del(&work->list);
+    queue->depth--;
+    queue->running++;
+    pool->pending--;
+
+    /* let the other keys go first next time */
+    list_move_tail(&queue->list, &pool->queues);
+
+    wait = gbSecondsSince(&work->queued);
+    served = 1;
+    avg = max = wait;
+    stats = gbWorkStatsGet(pool, queue->key);
+    if (stats) {
+      stats->served++;
+      stats->waitTotal += wait;
+      if (wait > stats->waitMax) {
+        stats->waitMax = wait;
+      }
+      served = stats->served;
+      avg = stats->waitTotal / served;
+      max = stats->waitMax;
+    }
+    depth = queue->depth;
+    UNLOCK(pool->lock);
+
+    level = (wait >= GB_SLOW_WAIT_SECS) ? GB_LOG_INFO : GB_LOG_DEBUG;
+    LOG("mgmt", level, "%s queue %s: waited %.3fs, %zu more queued "
+        "(served %zu, avg wait %.3fs, max wait %.3fs)", pool->name,
+        queue->key ? queue->key : "-", wait, depth, served, avg, max);
+
+    work->fn(work->data);
+    if (work->batch) {
+      gbWorkBatchDone(work->batch);
+    }
+    GB_FREE(work);
+
+    LOCK(pool->lock);
+    queue->running--;
+    /* the key is whatever the request named, don't keep it around */
+    if (!queue->depth && !queue->running) {
+      gbWorkQueueFree(queue);
+    }
+    /* a capped key may be runnable again */
+    pthread_cond_signal(&pool->cond);
+  }
+
+ out:
+  UNLOCK(pool->lock);
+
+  return NULL;
+}
+
+
+gbWorkerPool *
+gbWorkerPoolCreate(const char *name, size_t nworkers, size_t maxPerKey)
+{
+  gbWorkerPool *pool;
+  size_t i;
+  int ret;
+
+
+  if (!nworkers || nworkers > GB_WORKERS_MAX || !maxPerKey) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (GB_ALLOC(pool) < 0) {
+    return NULL;
+  }
+
+  if (GB_ALLOC_N(pool->tid, nworkers) < 0) {
+    GB_FREE(pool);
+    return NULL;
+  }
+
+  GB_STRCPYSTATIC(pool->name, name);
+  pool->maxPerKey = maxPerKey;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  INIT_LIST_HEAD(&pool->queues);
+  INIT_LIST_HEAD(&pool->stats);
+
+  for (i = 0; i < nworkers; i++) {
+    ret = pthread_create(&pool->tid[i], NULL, gbWorkerThreadProc, pool);
+    if (ret) {
+      LOG("mgmt", GB_LOG_ERROR, "failed to start worker %zu of pool %s (%s)",
+          i, pool->name, strerror(ret));
+      break;
+    }
+    pool->nworkers++;
+  }
+
+  if (pool->nworkers != nworkers) {
+    gbWorkerPoolDestroy(pool);
+    errno = ret;
+    return NULL;
+  }
+
+  LOG("mgmt", GB_LOG_INFO, "started %zu workers for %s pool, "
+      "at most %zu per key", pool->nworkers, pool->name, pool->maxPerKey);
+
+  return pool;
+}
+
+
+static int
+gbWorkerPoolQueue(gbWorkerPool *pool, const char *key, gbWorkBatch *batch,
+                  gbWorkFn fn, void *data)
+{
+  gbWorkQueue *queue;
+  gbWork *work;
+
+
+  if (GB_ALLOC(work) < 0) {
+    return -1;
+  }
+  work->fn = fn;
+  work->data = data;
+  work->batch = batch;
+  clock_gettime(CLOCK_MONOTONIC, &work->queued);
+
+  LOCK(pool->lock);
+  queue = gbWorkQueueLookup(pool, key);
+  if (!queue) {
+    /* freed again by the worker that empties it */
+    if (GB_ALLOC(queue) < 0 || (key && GB_STRDUP(queue->key, key) < 0)) {
+      UNLOCK(pool->lock);
+      GB_FREE(queue);
+      GB_FREE(work);
+      return -1;
+    }
+    INIT_LIST_HEAD(&queue->works);
+    list_add_tail(&queue->list, &pool->queues);
+  }
+
+  list_add_tail(&work->list, &queue->works);
+  queue->depth++;
+  pool->pending++;
+  pthread_cond_signal(&pool->cond);
+  UNLOCK(pool->lock);
+
+  return 0;
+}
+
+
+int
+gbWorkerPoolSubmit(gbWorkerPool *pool, const char *key,
+                   gbWorkFn fn, void *data)
+{
+  return gbWorkerPoolQueue(pool, key, NULL, fn, data);
+}
+
+
+/* Never fails, work which can't be queued is run by the caller. */
+void
+gbWorkBatchSubmit(gbWorkerPool *pool, gbWorkBatch *batch,
+                  gbWorkFn fn, void *data)
+{
+  LOCK(batch->lock);
+  batch->pending++;
+  UNLOCK(batch->lock);
+
+  if (!pool || gbWorkerPoolQueue(pool, NULL, batch, fn, data)) {
+    fn(data);
+    gbWorkBatchDone(batch);
+  }
+}
+
+
+void
+gbWorkBatchWait(gbWorkBatch *batch)
+{
+  LOCK(batch->lock);
+  while (batch->pending) {
+    pthread_cond_wait(&batch->cond, &batch->lock);
+  }
+  UNLOCK(batch->lock);
+}
+
+
+/* Drains the queues, then joins the workers. */
+void
+gbWorkerPoolDestroy(gbWorkerPool *pool)
+{
+  gbWorkQueue *queue, *tmp;
+  gbWorkStats *stats, *next;
+  size_t i;
+
+
+  if (!pool) {
+    return;
+  }
+
+  LOCK(pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->cond);
+  UNLOCK(pool->lock);
+
+  for (i = 0; i < pool->nworkers; i++) {
+    pthread_join(pool->tid[i], NULL);
+  }
+
+  list_for_each_entry_safe(queue, tmp, &pool->queues, list) {
+    gbWorkQueueFree(queue);
+  }
+  list_for_each_entry_safe(stats, next, &pool->stats, list) {
+    gbWorkStatsFree(stats);
+  }
+
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->lock);
+  GB_FREE(pool->tid);
+  GB_FREE(pool);
+}
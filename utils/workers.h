@@ -0,0 +1,75 @@
+/*
+  Copyright (c) 2018 Red Hat, Inc. <http://www.redhat.com>
+  This file is part of gluster-block.
+
+  This file is licensed to you under your choice of the GNU Lesser
+  General Public License, version 3 or any later version (LGPLv3 or
+  later), or the GNU General Public License, version 2 (GPLv2), in all
+  cases as published by the Free Software Foundation.
+*/
+
+
+# ifndef   _WORKERS_H
+# define   _WORKERS_H   1
+
+# include  <pthread.h>
+
+# include  "common.h"
+# include  "list.h"
+
+# define   GB_WORKERS_DEFAULT       8
+# define   GB_WORKERS_MAX           64
+# define   GB_KEY_WORKERS_DEFAULT   4  /* blocks lock apart, half the
+                                         * workers leaves room for others */
+
+
+typedef void (*gbWorkFn)(void *data);
+
+/* Work is queued FIFO per key (the volume name), keys are served round
+ * robin. At most maxPerKey items of one key and nworkers items overall
+ * run at once, unkeyed work is only bound by the latter. */
+typedef struct gbWorkerPool {
+  char name[16];
+  size_t nworkers;
+  size_t maxPerKey;
+  pthread_t *tid;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct list_head queues;   /* gbWorkQueue's with work, in service order */
+  struct list_head stats;    /* gbWorkStats, most recently served first */
+  size_t nstats;
+  size_t pending;
+  bool stop;
+} gbWorkerPool;
+
+/* Work submitted as one batch, so the submitter can wait for all of it */
+typedef struct gbWorkBatch {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t pending;
+} gbWorkBatch;
+
+# define   GB_WORK_BATCH_INITIALIZER                                  \
+           {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0}
+
+
+gbWorkerPool *
+gbWorkerPoolCreate(const char *name, size_t nworkers, size_t maxPerKey);
+
+int
+gbWorkerPoolSubmit(gbWorkerPool *pool, const char *key,
+                   gbWorkFn fn, void *data);
+
+void
+gbWorkBatchSubmit(gbWorkerPool *pool, gbWorkBatch *batch,
+                  gbWorkFn fn, void *data);
+
+void
+gbWorkBatchWait(gbWorkBatch *batch);
+
+void
+gbWorkerPoolDestroy(gbWorkerPool *pool);
+
+
+# endif /* _WORKERS_H */